@@ -3,13 +3,12 @@ void* fl_rand(void* shape_ptr, int64_t shape_len) {
   try {
     LOCK_GUARD
 
-    auto shape = arrayArg<long long>(shape_ptr, shape_len, g_row_major, false);
     fl::Tensor t;
-    t = fl::rand(fl::Shape(shape));
+    t = fl::rand(shapeArg(shape_ptr, shape_len));
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -19,13 +18,12 @@ void* fl_randn(void* shape_ptr, int64_t shape_len) {
   try {
     LOCK_GUARD
 
-    auto shape = arrayArg<long long>(shape_ptr, shape_len, g_row_major, false);
     fl::Tensor t;
-    t = fl::randn(fl::Shape(shape));
+    t = fl::randn(shapeArg(shape_ptr, shape_len));
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -36,12 +34,11 @@ void* fl_full(void* shape_ptr, int64_t shape_len, float val) {
     LOCK_GUARD
 
     auto shape = arrayArg<long long>(shape_ptr, shape_len, g_row_major, false);
-    fl::Tensor t;
-    t = fl::full(fl::Shape(shape), val);
-    g_bytes_used += t.bytes();
-    return new fl::Tensor(t);
+    return constantHandle(
+        constantKey("full", fl::dtype::f32, shape, {val}),
+        [&] { return fl::full(fl::Shape(std::move(shape)), val); });
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -51,12 +48,10 @@ void* fl_identity(int64_t dim) {
   try {
     LOCK_GUARD
 
-    fl::Tensor t;
-    t = fl::identity(dim);
-    g_bytes_used += t.bytes();
-    return new fl::Tensor(t);
+    return constantHandle(constantKey("identity", fl::dtype::f32, {dim}, {}),
+                          [&] { return fl::identity(dim); });
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -66,12 +61,11 @@ void* fl_arange(float start, float end, float step) {
   try {
     LOCK_GUARD
 
-    fl::Tensor t;
-    t = fl::arange(start, end, step);
-    g_bytes_used += t.bytes();
-    return new fl::Tensor(t);
+    return constantHandle(
+        constantKey("arange", fl::dtype::f32, {}, {start, end, step}),
+        [&] { return fl::arange(start, end, step); });
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -87,12 +81,17 @@ void* fl_iota(void* dims_ptr,
     auto dims = arrayArg<long long>(dims_ptr, dims_len, g_row_major, false);
     auto tileDims =
         arrayArg<long long>(tileDims_ptr, tileDims_len, g_row_major, false);
-    fl::Tensor t;
-    t = fl::iota(fl::Shape(dims), fl::Shape(tileDims));
-    g_bytes_used += t.bytes();
-    return new fl::Tensor(t);
+    auto key_dims = dims;
+    key_dims.emplace_back(-1);
+    key_dims.insert(key_dims.end(), tileDims.begin(), tileDims.end());
+    return constantHandle(
+        constantKey("iota", fl::dtype::f32, key_dims, {}),
+        [&] {
+          return fl::iota(fl::Shape(std::move(dims)),
+                          fl::Shape(std::move(tileDims)));
+        });
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -103,13 +102,12 @@ void* fl_reshape(void* tensor, void* shape_ptr, int64_t shape_len) {
     LOCK_GUARD
 
     auto* tensor_ptr = reinterpret_cast<fl::Tensor*>(tensor);
-    auto shape = arrayArg<long long>(shape_ptr, shape_len, g_row_major, false);
     fl::Tensor t;
-    t = fl::reshape(*tensor_ptr, fl::Shape(shape));
+    t = fl::reshape(*tensor_ptr, shapeArg(shape_ptr, shape_len));
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -120,14 +118,13 @@ void* fl_transpose(void* tensor, void* axes_ptr, int64_t axes_len) {
     LOCK_GUARD
 
     auto* tensor_ptr = reinterpret_cast<fl::Tensor*>(tensor);
-    auto axes = arrayArg<long long>(axes_ptr, axes_len, g_row_major,
-                                    tensor_ptr->ndim());
     fl::Tensor t;
-    t = fl::transpose(*tensor_ptr, fl::Shape(axes));
+    t = fl::transpose(*tensor_ptr,
+                      shapeArg(axes_ptr, axes_len, tensor_ptr->ndim()));
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -138,13 +135,12 @@ void* fl_tile(void* tensor, void* shape_ptr, int64_t shape_len) {
     LOCK_GUARD
 
     auto* tensor_ptr = reinterpret_cast<fl::Tensor*>(tensor);
-    auto shape = arrayArg<long long>(shape_ptr, shape_len, g_row_major, false);
     fl::Tensor t;
-    t = fl::tile(*tensor_ptr, fl::Shape(shape));
+    t = fl::tile(*tensor_ptr, shapeArg(shape_ptr, shape_len));
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -154,14 +150,17 @@ void* fl_concatenate(void* tensors_ptr, int64_t tensors_len, int32_t axis) {
   try {
     LOCK_GUARD
 
-    auto tensors = ptrArrayArg<fl::Tensor>(tensors_ptr, tensors_len);
-    auto used_axis = axisArg(axis, g_row_major, (&tensors[0])->ndim());
+    TensorSpan tensors(tensors_ptr, tensors_len);
+    if (tensors_len == 0) {
+      throw std::invalid_argument("fl_concatenate expects at least one tensor");
+    }
+    auto used_axis = axisArg(axis, g_row_major, tensors[0].ndim());
     fl::Tensor t;
-    t = fl::concatenate(tensors, used_axis);
+    t = concatenate(tensors, used_axis);
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -177,7 +176,7 @@ void* fl_nonzero(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -193,7 +192,7 @@ void* fl_negative(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -209,7 +208,7 @@ void* fl_logicalNot(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -225,7 +224,7 @@ void* fl_exp(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -241,7 +240,7 @@ void* fl_log(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -257,7 +256,7 @@ void* fl_log1p(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -273,7 +272,7 @@ void* fl_sin(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -289,7 +288,7 @@ void* fl_cos(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -305,7 +304,7 @@ void* fl_sqrt(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -321,7 +320,7 @@ void* fl_tanh(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -337,7 +336,7 @@ void* fl_floor(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -353,7 +352,7 @@ void* fl_ceil(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -369,7 +368,7 @@ void* fl_rint(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -385,7 +384,7 @@ void* fl_absolute(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -401,7 +400,7 @@ void* fl_sigmoid(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -417,7 +416,7 @@ void* fl_erf(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -433,7 +432,7 @@ void* fl_flip(void* tensor, uint32_t dim) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -451,7 +450,7 @@ void* fl_clip(void* tensor, void* low, void* high) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -468,7 +467,7 @@ void* fl_roll(void* tensor, int shift, int32_t axis) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -484,7 +483,7 @@ void* fl_isnan(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -500,7 +499,7 @@ void* fl_isinf(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -516,7 +515,7 @@ void* fl_sign(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -536,7 +535,7 @@ void* fl_tril(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -556,7 +555,7 @@ void* fl_triu(void* tensor) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -574,7 +573,7 @@ void* fl_where(void* cond, void* x, void* y) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -590,7 +589,7 @@ void* fl_sort(void* tensor, uint32_t dim) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -607,7 +606,7 @@ void* fl_add(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -624,7 +623,7 @@ void* fl_sub(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -641,7 +640,7 @@ void* fl_mul(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -658,7 +657,7 @@ void* fl_div(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -675,7 +674,7 @@ void* fl_eq(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -692,7 +691,7 @@ void* fl_neq(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -709,7 +708,7 @@ void* fl_lessThan(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -726,7 +725,7 @@ void* fl_lessThanEqual(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -743,7 +742,7 @@ void* fl_greaterThan(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -760,7 +759,7 @@ void* fl_greaterThanEqual(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -777,7 +776,7 @@ void* fl_logicalOr(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -794,7 +793,7 @@ void* fl_logicalAnd(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -811,7 +810,7 @@ void* fl_mod(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -828,7 +827,7 @@ void* fl_bitwiseAnd(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -845,7 +844,7 @@ void* fl_bitwiseOr(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -862,7 +861,7 @@ void* fl_bitwiseXor(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -879,7 +878,7 @@ void* fl_lShift(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -896,7 +895,7 @@ void* fl_rShift(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -913,7 +912,7 @@ void* fl_minimum(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -930,7 +929,7 @@ void* fl_maximum(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -947,7 +946,7 @@ void* fl_power(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -968,7 +967,7 @@ void* fl_matmul(void* tensor, void* other) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -993,7 +992,7 @@ void* fl_conv2d(void* tensor,
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1008,27 +1007,12 @@ void* fl_amin(void* tensor, void* axes_ptr, int64_t axes_len, bool keep_dims) {
         arrayArg<int>(axes_ptr, axes_len, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::amin(*tensor_ptr, axes, keep_dims);
-
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1043,27 +1027,12 @@ void* fl_amax(void* tensor, void* axes_ptr, int64_t axes_len, bool keep_dims) {
         arrayArg<int>(axes_ptr, axes_len, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::amax(*tensor_ptr, axes, keep_dims);
-
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1077,26 +1046,13 @@ void* fl_argmin(void* tensor, int32_t axis, bool keep_dims) {
     auto used_axis = axisArg(axis, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::argmin(*tensor_ptr, used_axis, keep_dims);
-
-    auto axes_set = std::unordered_set<int>{static_cast<int>(used_axis)};
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(
+        t, reducedShape(tensor_ptr->shape(), used_axis, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1110,26 +1066,13 @@ void* fl_argmax(void* tensor, int32_t axis, bool keep_dims) {
     auto used_axis = axisArg(axis, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::argmax(*tensor_ptr, used_axis, keep_dims);
-
-    auto axes_set = std::unordered_set<int>{static_cast<int>(used_axis)};
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(
+        t, reducedShape(tensor_ptr->shape(), used_axis, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1144,27 +1087,12 @@ void* fl_sum(void* tensor, void* axes_ptr, int64_t axes_len, bool keep_dims) {
         arrayArg<int>(axes_ptr, axes_len, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::sum(*tensor_ptr, axes, keep_dims);
-
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1181,7 +1109,7 @@ void* fl_cumsum(void* tensor, int32_t axis) {
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1196,27 +1124,12 @@ void* fl_mean(void* tensor, void* axes_ptr, int64_t axes_len, bool keep_dims) {
         arrayArg<int>(axes_ptr, axes_len, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::mean(*tensor_ptr, axes, keep_dims);
-
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1231,27 +1144,12 @@ void* fl_median(void* tensor, void* axes_ptr, int64_t axes_len, bool keep_dims)
         arrayArg<int>(axes_ptr, axes_len, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::median(*tensor_ptr, axes, keep_dims);
-
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1270,27 +1168,12 @@ void* fl_var(void* tensor,
         arrayArg<int>(axes_ptr, axes_len, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::var(*tensor_ptr, axes, bias, keep_dims);
-
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1305,27 +1188,12 @@ void* fl_std(void* tensor, void* axes_ptr, int64_t axes_len, bool keep_dims) {
         arrayArg<int>(axes_ptr, axes_len, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::std(*tensor_ptr, axes, keep_dims);
-
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1350,26 +1218,12 @@ void* fl_norm(void* tensor,
       t = fl::amax(t, axes, keep_dims);
     }
 
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1387,27 +1241,12 @@ void* fl_countNonzero(void* tensor,
         arrayArg<int>(axes_ptr, axes_len, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::countNonzero(*tensor_ptr, axes, keep_dims);
-
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1422,27 +1261,12 @@ void* fl_any(void* tensor, void* axes_ptr, int64_t axes_len, bool keep_dims) {
         arrayArg<int>(axes_ptr, axes_len, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::any(*tensor_ptr, axes, keep_dims);
-
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1457,27 +1281,12 @@ void* fl_all(void* tensor, void* axes_ptr, int64_t axes_len, bool keep_dims) {
         arrayArg<int>(axes_ptr, axes_len, g_row_major, tensor_ptr->ndim());
     fl::Tensor t;
     t = fl::all(*tensor_ptr, axes, keep_dims);
-
-    auto axes_set = std::unordered_set<int>(axes.begin(), axes.end());
-
-    auto base_shape = tensor_ptr->shape().get();
-    std::vector<fl::Dim> new_shape;
-    for (auto idx = 0; idx < base_shape.size(); ++idx) {
-      if (axes_set.count(idx) || (axes_set.size() == 0)) {
-        if (keep_dims) {
-          new_shape.emplace_back(1);
-        }
-        continue;
-      }
-      new_shape.emplace_back(base_shape[idx]);
-    }
-    const auto& shape = fl::Shape(new_shape);
-    t = fl::reshape(t, shape);
+    t = fl::reshape(t, reducedShape(tensor_ptr->shape(), axes, keep_dims));
 
     g_bytes_used += t.bytes();
     return new fl::Tensor(t);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
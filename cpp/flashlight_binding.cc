@@ -1,7 +1,32 @@
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
-#include <iostream>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include "arrow_c_data.h"
 #include "dltensor.h"
 #include "flashlight/fl/autograd/Functions.h"
 #include "flashlight/fl/autograd/tensor/AutogradExtension.h"
@@ -24,19 +49,122 @@
 #define FMT_BOLD_WHITE "\033[1m\033[97m"
 #define FMT_BOLD_ITALIC_WHITE "\033[1m\033[3m\033[97m"
 
-#define HANDLE_EXCEPTION(what)                                         \
-  {                                                                    \
-    std::cerr << FMT_RED << "native code error" << FMT_GRAY << ": "    \
-              << FMT_BOLD_WHITE << what << FMT_RESET << FMT_GRAY       \
-              << "\n                  at " << FMT_BOLD_ITALIC_WHITE    \
-              << __func__ << FMT_RESET << FMT_GRAY << " (" << FMT_CYAN \
-              << __FILE__ << FMT_GRAY << ":" << FMT_YELLOW << __LINE__ \
-              << FMT_GRAY << ")" << FMT_RESET << std::endl;            \
-    return nullptr;                                                    \
+// Error codes reported by `fl_lastError`.
+enum ErrorCode : int {
+  kErrorNone = 0,
+  kErrorInvalidArgument = 1,
+  kErrorOutOfRange = 2,
+  kErrorOutOfMemory = 3,
+  kErrorRuntime = 4,
+  kErrorUnknown = 5,
+};
+
+// Last failure on the calling thread. Failing calls overwrite it, successful
+// calls leave it alone. Messages are truncated to the fixed buffer so
+// recording an error never allocates.
+struct LastError {
+  int code = kErrorNone;
+  char message[512] = {};
+  const char* function = "";
+};
+
+static thread_local LastError t_last_error;
+
+// Failures logged to stderr per second; 0 turns logging off.
+static std::atomic<int> g_error_log_rate = 10;
+
+// Classifies an exception caught as std::exception.
+int errorCode(const std::exception& e) {
+  if (dynamic_cast<const std::bad_alloc*>(&e)) {
+    return kErrorOutOfMemory;
+  }
+  if (dynamic_cast<const std::out_of_range*>(&e)) {
+    return kErrorOutOfRange;
+  }
+  if (dynamic_cast<const std::logic_error*>(&e)) {
+    return kErrorInvalidArgument;
+  }
+  return kErrorRuntime;
+}
+
+// Writes one formatted line per failure, up to `g_error_log_rate` a second;
+// the rest are counted and summarized when the next second starts.
+void logError(const LastError& error, const char* file, int line) {
+  const int rate = g_error_log_rate;
+  if (rate <= 0) {
+    return;
+  }
+  static std::mutex mutex;
+  static int64_t window = -1;
+  static int64_t logged = 0;
+  static int64_t suppressed = 0;
+  const int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+  std::lock_guard<std::mutex> guard(mutex);
+  if (now != window) {
+    if (suppressed) {
+      std::fprintf(stderr, FMT_GRAY "(%lld native errors not logged)" FMT_RESET
+                   "\n", static_cast<long long>(suppressed));
+    }
+    window = now;
+    logged = 0;
+    suppressed = 0;
+  }
+  if (logged++ >= rate) {
+    ++suppressed;
+    return;
+  }
+  std::fprintf(stderr,
+               FMT_RED "native code error" FMT_GRAY ": " FMT_BOLD_WHITE
+                       "%s" FMT_RESET FMT_GRAY "\n                  at "
+                       FMT_BOLD_ITALIC_WHITE "%s" FMT_RESET FMT_GRAY
+                       " (" FMT_CYAN "%s" FMT_GRAY ":" FMT_YELLOW
+                       "%d" FMT_GRAY ")" FMT_RESET "\n",
+               error.message, error.function, file, line);
+}
+
+void recordError(int code,
+                 const char* what,
+                 const char* function,
+                 const char* file,
+                 int line) {
+  auto& error = t_last_error;
+  error.code = code;
+  std::snprintf(error.message, sizeof(error.message), "%s", what);
+  error.function = function;
+  logError(error, file, line);
+}
+
+void recordError(const std::exception& e,
+                 const char* function,
+                 const char* file,
+                 int line) {
+  recordError(errorCode(e), e.what(), function, file, line);
+}
+
+// A bare message comes either from a `catch (...)` clause, which is an
+// unknown error, or from a binding that rejects an argument without throwing.
+void recordError(const char* what,
+                 const char* function,
+                 const char* file,
+                 int line) {
+  const int code =
+      std::current_exception() ? kErrorUnknown : kErrorInvalidArgument;
+  recordError(code, what, function, file, line);
+}
+
+// `error` is either the caught std::exception or a message.
+#define RECORD_EXCEPTION(error) \
+  recordError(error, __func__, __FILE__, __LINE__)
+
+#define HANDLE_EXCEPTION(error) \
+  {                             \
+    RECORD_EXCEPTION(error);    \
+    return nullptr;             \
   }
 
 #if 0
-#include <mutex>
 static std::mutex g_op_mutex;
 #define LOCK_GUARD std::lock_guard<std::mutex> guard(g_op_mutex);
 #else
@@ -46,35 +174,80 @@ static std::mutex g_op_mutex;
 static std::atomic<size_t> g_bytes_used = 0;
 static std::atomic<bool> g_row_major = true;
 
-template <typename T>
-std::vector<T> arrayArg(const void* ptr, int len, bool reverse, int invert) {
-  std::vector<T> out;
-  out.reserve(len);
-  for (auto i = 0; i < len; ++i) {
-    const auto idx = reverse ? len - i - 1 : i;
-    auto v = reinterpret_cast<const int64_t*>(ptr)[idx];
-    if (invert && v < 0) {
+// Non-owning view of an int64 argument array, decoded on access: `reverse`
+// reads it back to front and a nonzero `invert` maps axes into Flashlight
+// order for a tensor of that rank. Arguments that are only read go through
+// this directly; `arrayArg` copies into the vectors Flashlight calls take.
+class ArgSpan {
+ public:
+  ArgSpan(const void* ptr, int64_t len, bool reverse = false, int invert = 0)
+      : values_(reinterpret_cast<const int64_t*>(ptr)),
+        len_(len),
+        reverse_(reverse),
+        invert_(invert) {}
+  int64_t size() const {
+    return len_;
+  }
+  int64_t operator[](int64_t i) const {
+    auto v = values_[reverse_ ? len_ - i - 1 : i];
+    if (invert_ && v < 0) {
       v = -v - 1;
-    } else if (invert) {
-      v = invert - v - 1;
+    } else if (invert_) {
+      v = invert_ - v - 1;
     }
-    out.emplace_back(v);
+    return v;
   }
-  return out;
-}
+
+ private:
+  const int64_t* values_;
+  int64_t len_;
+  bool reverse_;
+  int invert_;
+};
 
 template <typename T>
-std::vector<T> ptrArrayArg(const void* ptr, int len) {
+std::vector<T> arrayArg(const void* ptr, int len, bool reverse, int invert) {
+  const ArgSpan args(ptr, len, reverse, invert);
   std::vector<T> out;
   out.reserve(len);
   for (auto i = 0; i < len; ++i) {
-    auto ptrAsInt = reinterpret_cast<const int64_t*>(ptr)[i];
-    auto ptr = reinterpret_cast<T*>(ptrAsInt);
-    out.emplace_back(*ptr);
+    out.emplace_back(args[i]);
   }
   return out;
 }
 
+// Shape argument in Flashlight order, built around the decoded dims vector
+// rather than a copy of it.
+fl::Shape shapeArg(const void* ptr, int len, int invert = 0) {
+  return fl::Shape(arrayArg<fl::Dim>(ptr, len, g_row_major, invert));
+}
+
+// Non-owning view of an array of tensor handles, read in place rather than
+// copied into a vector of tensors.
+class TensorSpan {
+ public:
+  TensorSpan(const void* ptr, int64_t len)
+      : ptrs_(reinterpret_cast<const int64_t*>(ptr)), len_(len) {}
+  int64_t size() const {
+    return len_;
+  }
+  const fl::Tensor& operator[](int64_t i) const {
+    return *reinterpret_cast<const fl::Tensor*>(ptrs_[i]);
+  }
+  std::vector<fl::Tensor> toVector() const {
+    std::vector<fl::Tensor> out;
+    out.reserve(len_);
+    for (int64_t i = 0; i < len_; ++i) {
+      out.emplace_back((*this)[i]);
+    }
+    return out;
+  }
+
+ private:
+  const int64_t* ptrs_;
+  int64_t len_;
+};
+
 uint32_t axisArg(int32_t axis, bool reverse, int ndim) {
   if (!reverse) {
     return static_cast<uint32_t>(axis);
@@ -86,901 +259,7136 @@ uint32_t axisArg(int32_t axis, bool reverse, int ndim) {
   }
 }
 
-extern "C" {
-void fl_init() {
-  fl::init();
-}
+// Fixed-size worker pool for the native CPU kernels below. The calling thread
+// participates in every job, and nested calls from a worker run inline.
+class ThreadPool {
+ public:
+  static ThreadPool& get() {
+    static ThreadPool pool;
+    return pool;
+  }
 
-size_t fl_bytesUsed() {
-  return g_bytes_used;
-}
+  size_t size() const {
+    return workers_.size() + 1;
+  }
 
-void* fl_createTensor(void* shape_ptr, int64_t shape_len) {
-  try {
-    LOCK_GUARD
-    static_assert(sizeof(long long) == sizeof(int64_t));
-    auto shape = arrayArg<long long>(shape_ptr, shape_len, g_row_major, false);
-    auto* t = new fl::Tensor(fl::Shape(shape));
-    g_bytes_used += t->bytes();
-    return t;
-  } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
-  } catch (...) {
-    HANDLE_EXCEPTION("[unknown]");
+  void run(size_t num_tasks, const std::function<void(size_t)>& fn) {
+    if (num_tasks == 0) {
+      return;
+    }
+    if (num_tasks == 1 || workers_.empty() || t_in_worker) {
+      for (size_t i = 0; i < num_tasks; ++i) {
+        fn(i);
+      }
+      return;
+    }
+    std::lock_guard<std::mutex> job_guard(job_mutex_);
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      fn_ = &fn;
+      num_tasks_ = num_tasks;
+      next_task_ = 0;
+      pending_ = num_tasks;
+      error_ = nullptr;
+      ++generation_;
+    }
+    cv_.notify_all();
+    t_in_worker = true;
+    work();
+    t_in_worker = false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&] { return pending_ == 0; });
+    fn_ = nullptr;
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
   }
-}
 
-// TODO use DLM destructor
-void* fl_fromDLTensor(void* ptr) {
-  auto* dlmtensor = (DLManagedTensor*)ptr;
-  auto& dltensor = dlmtensor->dl_tensor;
-  auto shape =
-      arrayArg<long long>(dltensor.shape, dltensor.ndim, g_row_major, false);
-  auto dtype = dltensor.dtype;
-  // TODO utilize the device ID
-  auto location = (dltensor.device.device_type == kDLCPU)
-                      ? fl::MemoryLocation::Host
-                      : fl::MemoryLocation::Device;
-  bool error = false;
-  void* data = dltensor.data;
-  auto tensor = [&]() {
-    switch (dtype.code) {
-      case kDLInt:
-        if (dtype.bits == 32) {
-          return fl::Tensor::fromBuffer(fl::Shape(shape), (int32_t*)data,
-                                        location);
-        } else if (dtype.bits == 16) {
-          return fl::Tensor::fromBuffer(fl::Shape(shape), (int16_t*)data,
-                                        location);
-        } else if (dtype.bits == 64) {
-          return fl::Tensor::fromBuffer(fl::Shape(shape), (int64_t*)data,
-                                        location);
+ private:
+  ThreadPool() {
+    auto n = std::max(1u, std::thread::hardware_concurrency());
+    for (auto i = 1u; i < n; ++i) {
+      workers_.emplace_back([this] { loop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& w : workers_) {
+      w.join();
+    }
+  }
+
+  void loop() {
+    t_in_worker = true;
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) {
+          return;
         }
-      case kDLUInt:
-        if (dtype.bits == 32) {
-          return fl::Tensor::fromBuffer(fl::Shape(shape), (uint32_t*)data,
-                                        location);
-        } else if (dtype.bits == 16) {
-          return fl::Tensor::fromBuffer(fl::Shape(shape), (uint16_t*)data,
-                                        location);
-        } else if (dtype.bits == 64) {
-          return fl::Tensor::fromBuffer(fl::Shape(shape), (uint64_t*)data,
-                                        location);
+        seen = generation_;
+      }
+      work();
+    }
+  }
+
+  void work() {
+    while (true) {
+      size_t task;
+      const std::function<void(size_t)>* fn;
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (next_task_ >= num_tasks_) {
+          return;
         }
-      case kDLFloat:
-        if (dtype.bits == 32) {
-          return fl::Tensor::fromBuffer(fl::Shape(shape), (float*)data,
-                                        location);
-        } else if (dtype.bits == 64) {
-          return fl::Tensor::fromBuffer(fl::Shape(shape), (double*)data,
-                                        location);
+        task = next_task_++;
+        fn = fn_;
+      }
+      try {
+        (*fn)(task);
+      } catch (...) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (!error_) {
+          error_ = std::current_exception();
         }
-      case kDLBool:
-      default:
-        error = true;
-        return fl::Tensor(fl::Shape({}));
+      }
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (--pending_ == 0) {
+        done_cv_.notify_all();
+      }
     }
-  }();
-  if (error) {
-    HANDLE_EXCEPTION("Unsupported datatype in DLTensor");
   }
-  auto* t = new fl::Tensor(tensor);
-  g_bytes_used += t->bytes();
-  return t;
+
+  static thread_local bool t_in_worker;
+  std::vector<std::thread> workers_;
+  std::mutex job_mutex_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable done_cv_;
+  const std::function<void(size_t)>* fn_ = nullptr;
+  size_t num_tasks_ = 0;
+  size_t next_task_ = 0;
+  size_t pending_ = 0;
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+  std::exception_ptr error_;
+};
+
+thread_local bool ThreadPool::t_in_worker = false;
+
+// Splits [0, n) into chunks of at least `grain` elements and calls
+// fn(begin, end) for each chunk on the pool.
+template <typename F>
+void parallelFor(int64_t n, int64_t grain, F&& fn) {
+  if (n <= 0) {
+    return;
+  }
+  auto& pool = ThreadPool::get();
+  const int64_t max_chunks = static_cast<int64_t>(pool.size()) * 4;
+  const int64_t chunks =
+      std::max<int64_t>(1, std::min(max_chunks, n / std::max<int64_t>(1, grain)));
+  if (chunks == 1) {
+    fn(int64_t(0), n);
+    return;
+  }
+  const int64_t step = (n + chunks - 1) / chunks;
+  pool.run(static_cast<size_t>(chunks), [&](size_t c) {
+    const int64_t begin = static_cast<int64_t>(c) * step;
+    const int64_t end = std::min(n, begin + step);
+    if (begin < end) {
+      fn(begin, end);
+    }
+  });
 }
 
-void fl_deleteDLTensor(struct DLManagedTensor* self) {
-  auto* tensor = reinterpret_cast<fl::Tensor*>(self->manager_ctx);
-  g_bytes_used -= tensor->bytes();
-  tensor->unlock();
-  delete tensor;
-  delete self->dl_tensor.shape;
-  delete self;
+// Raw access to the storage of a host-resident tensor. The tensor stays locked
+// for the lifetime of the view. A null tensor gives a null view.
+template <typename T>
+class HostView {
+ public:
+  explicit HostView(const fl::Tensor& t) : HostView(&t) {}
+  explicit HostView(const fl::Tensor* t)
+      : tensor_(t), ptr_(t ? t->device<T>() : nullptr) {}
+  ~HostView() {
+    if (tensor_) {
+      tensor_->unlock();
+    }
+  }
+  T* data() const {
+    return ptr_;
+  }
+
+ private:
+  const fl::Tensor* tensor_;
+  T* ptr_;
+};
+
+bool isHostTensor(const fl::Tensor& t) {
+  return t.location() == fl::MemoryLocation::Host;
 }
 
-void* fl_toDLTensor(void* ptr) {
-  LOCK_GUARD
-  DLManagedTensor* dlmtensor = new DLManagedTensor();
-  DLTensor& dltensor = dlmtensor->dl_tensor;
-  const auto* tensor =
-      new fl::Tensor(reinterpret_cast<fl::Tensor*>(ptr)->copy());
-#define X(fl_prefix, dl_type, real_type, bits)   \
-  case fl::dtype::fl_prefix##bits: {             \
-    dltensor.data = tensor->device<real_type>(); \
-    dltensor.dtype = {kDL##dl_type, bits, 1};    \
-    break;                                       \
+// Handles that share storage with the constant cache. Tensor ops copy on
+// write, but the host kernels below write through raw pointers, so they detach
+// such handles first.
+static std::mutex g_shared_handles_mutex;
+static std::unordered_set<const fl::Tensor*> g_shared_handles;
+
+void markShared(const fl::Tensor* t) {
+  std::lock_guard<std::mutex> guard(g_shared_handles_mutex);
+  g_shared_handles.insert(t);
+}
+
+void releaseShared(const fl::Tensor* t) {
+  std::lock_guard<std::mutex> guard(g_shared_handles_mutex);
+  g_shared_handles.erase(t);
+}
+
+// Gives `t` its own storage before an in-place host write if it is shared.
+void detachShared(fl::Tensor* t) {
+  if (!t) {
+    return;
   }
-  switch (tensor->type()) {
-    X(f, Float, float, 32)
-    X(f, Float, double, 64)
-    X(f, Float, float, 16)
-    X(s, Int, int32_t, 32)
-    X(s, Int, int16_t, 16)
-    X(s, Int, int64_t, 64)
-    X(u, UInt, uint32_t, 32)
-    X(u, UInt, uint16_t, 16)
-    X(u, UInt, uint64_t, 64)
+  {
+    std::lock_guard<std::mutex> guard(g_shared_handles_mutex);
+    if (!g_shared_handles.erase(t)) {
+      return;
+    }
+  }
+  *t = t->copy();
+}
+
+// Maps a key onto an unsigned integer with the same ordering, so that LSD radix
+// sort handles signed and floating point keys. Descending order flips all bits,
+// which keeps equal keys in their original (stable) order.
+template <typename T>
+struct RadixKey {
+  using U = std::conditional_t<
+      sizeof(T) == 1,
+      uint8_t,
+      std::conditional_t<sizeof(T) == 2,
+                         uint16_t,
+                         std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>>;
+
+  static U encode(T v, bool descending) {
+    U bits;
+    std::memcpy(&bits, &v, sizeof(T));
+    constexpr U sign = U(1) << (sizeof(U) * 8 - 1);
+    if (std::is_floating_point<T>::value) {
+      bits = (bits & sign) ? U(~bits) : U(bits | sign);
+    } else if (std::is_signed<T>::value) {
+      bits ^= sign;
+    }
+    return descending ? U(~bits) : bits;
+  }
+};
+
+// Sorts one row of `n` keys with 8-bit LSD radix passes, producing the
+// permutation in `idx`. Passes where every key shares the same digit are
+// skipped. When `parallel` is set, histograms and scatters are split across the
+// pool.
+template <typename T>
+void radixSortRow(const T* values,
+                  int64_t n,
+                  bool descending,
+                  bool parallel,
+                  int64_t* idx) {
+  using U = typename RadixKey<T>::U;
+  constexpr int kBuckets = 256;
+  std::vector<U> keys(n), keys_tmp(n);
+  std::vector<int64_t> idx_tmp(n);
+  for (int64_t i = 0; i < n; ++i) {
+    keys[i] = RadixKey<T>::encode(values[i], descending);
+    idx[i] = i;
+  }
+  U* src_k = keys.data();
+  U* dst_k = keys_tmp.data();
+  int64_t* src_i = idx;
+  int64_t* dst_i = idx_tmp.data();
+
+  const int64_t chunks =
+      parallel ? std::max<int64_t>(
+                     1, std::min<int64_t>(ThreadPool::get().size(), n / 65536))
+               : 1;
+  const int64_t step = (n + chunks - 1) / chunks;
+  std::vector<int64_t> hist(chunks * kBuckets);
+
+  for (size_t pass = 0; pass < sizeof(U); ++pass) {
+    const int shift = pass * 8;
+    std::fill(hist.begin(), hist.end(), 0);
+    auto count = [&](size_t c) {
+      auto* h = hist.data() + c * kBuckets;
+      const int64_t end = std::min(n, int64_t(c) * step + step);
+      for (int64_t i = c * step; i < end; ++i) {
+        ++h[(src_k[i] >> shift) & 0xff];
+      }
+    };
+    ThreadPool::get().run(chunks, count);
+
+    bool trivial = false;
+    for (int b = 0; b < kBuckets; ++b) {
+      int64_t total = 0;
+      for (int64_t c = 0; c < chunks; ++c) {
+        total += hist[c * kBuckets + b];
+      }
+      if (total == n) {
+        trivial = true;
+        break;
+      }
+      if (total) {
+        break;
+      }
+    }
+    if (trivial) {
+      continue;
+    }
+
+    // Exclusive prefix in (bucket, chunk) order keeps the scatter stable.
+    int64_t offset = 0;
+    for (int b = 0; b < kBuckets; ++b) {
+      for (int64_t c = 0; c < chunks; ++c) {
+        auto cnt = hist[c * kBuckets + b];
+        hist[c * kBuckets + b] = offset;
+        offset += cnt;
+      }
+    }
+    auto scatter = [&](size_t c) {
+      auto* h = hist.data() + c * kBuckets;
+      const int64_t end = std::min(n, int64_t(c) * step + step);
+      for (int64_t i = c * step; i < end; ++i) {
+        auto pos = h[(src_k[i] >> shift) & 0xff]++;
+        dst_k[pos] = src_k[i];
+        dst_i[pos] = src_i[i];
+      }
+    };
+    ThreadPool::get().run(chunks, scatter);
+    std::swap(src_k, dst_k);
+    std::swap(src_i, dst_i);
+  }
+  if (src_i != idx) {
+    std::copy(src_i, src_i + n, idx);
+  }
+}
+
+// Sorts `input` along `axis` on the host, writing values and int64 indices.
+template <typename T>
+void hostSortWithIndices(const fl::Tensor& input,
+                         unsigned axis,
+                         bool descending,
+                         fl::Tensor& values,
+                         fl::Tensor& indices) {
+  const auto& shape = input.shape();
+  const int64_t len = shape[axis];
+  int64_t inner = 1;
+  for (unsigned i = 0; i < axis; ++i) {
+    inner *= shape[i];
+  }
+  const int64_t outer = len ? input.elements() / (len * inner) : 0;
+  const int64_t rows = inner * outer;
+
+  values = fl::Tensor(shape, input.type());
+  indices = fl::Tensor(shape, fl::dtype::s64);
+  HostView<T> in_view(input);
+  HostView<T> val_view(values);
+  HostView<int64_t> idx_view(indices);
+  const T* in = in_view.data();
+  T* val = val_view.data();
+  int64_t* idx = idx_view.data();
+
+  const bool parallel_rows = rows > 1;
+  auto sort_rows = [&](int64_t begin, int64_t end) {
+    std::vector<T> row(inner == 1 ? 0 : len);
+    std::vector<int64_t> perm(inner == 1 ? 0 : len);
+    for (int64_t r = begin; r < end; ++r) {
+      const int64_t base = (r / inner) * len * inner + (r % inner);
+      if (inner == 1) {
+        radixSortRow(in + base, len, descending, !parallel_rows, idx + base);
+        for (int64_t i = 0; i < len; ++i) {
+          val[base + i] = in[base + idx[base + i]];
+        }
+        continue;
+      }
+      for (int64_t i = 0; i < len; ++i) {
+        row[i] = in[base + i * inner];
+      }
+      radixSortRow(row.data(), len, descending, !parallel_rows, perm.data());
+      for (int64_t i = 0; i < len; ++i) {
+        val[base + i * inner] = row[perm[i]];
+        idx[base + i * inner] = perm[i];
+      }
+    }
+  };
+  parallelFor(rows, std::max<int64_t>(1, 16384 / std::max<int64_t>(1, len)),
+              sort_rows);
+}
+
+// Host radix sort for the supported key types; returns false to signal that
+// the caller should fall back to the backend sort.
+bool sortWithIndices(const fl::Tensor& tensor,
+                     unsigned axis,
+                     bool descending,
+                     fl::Tensor& values,
+                     fl::Tensor& indices) {
+  if (!isHostTensor(tensor) || tensor.elements() == 0) {
+    return false;
+  }
+  auto input = tensor.isContiguous() ? tensor : tensor.asContiguousTensor();
+  switch (input.type()) {
+    case fl::dtype::f32:
+      hostSortWithIndices<float>(input, axis, descending, values, indices);
+      return true;
+    case fl::dtype::f64:
+      hostSortWithIndices<double>(input, axis, descending, values, indices);
+      return true;
+    case fl::dtype::s16:
+      hostSortWithIndices<int16_t>(input, axis, descending, values, indices);
+      return true;
+    case fl::dtype::s32:
+      hostSortWithIndices<int32_t>(input, axis, descending, values, indices);
+      return true;
+    case fl::dtype::s64:
+      hostSortWithIndices<int64_t>(input, axis, descending, values, indices);
+      return true;
+    case fl::dtype::b8:
+    case fl::dtype::u8:
+      hostSortWithIndices<uint8_t>(input, axis, descending, values, indices);
+      return true;
+    case fl::dtype::u16:
+      hostSortWithIndices<uint16_t>(input, axis, descending, values, indices);
+      return true;
+    case fl::dtype::u32:
+      hostSortWithIndices<uint32_t>(input, axis, descending, values, indices);
+      return true;
+    case fl::dtype::u64:
+      hostSortWithIndices<uint64_t>(input, axis, descending, values, indices);
+      return true;
     default:
-      HANDLE_EXCEPTION("Unsupported datatype for DLTensor creation");
+      return false;
   }
-  const auto ndim = tensor->ndim();
-  dltensor.shape = new int64_t[ndim];
-  dltensor.ndim = ndim;
-  if (tensor->location() == fl::MemoryLocation::Host) {
-    dltensor.device.device_type = kDLCPU;
-  } else if (tensor->location() == fl::MemoryLocation::Device) {
-    dltensor.device.device_type = kDLCUDA;
+}
+
+// Column-major view of a tensor around one axis: `outer` slabs of `len` rows,
+// each row holding `inner` contiguous elements.
+struct AxisLayout {
+  int64_t len;
+  int64_t inner;
+  int64_t outer;
+};
+
+AxisLayout axisLayout(const fl::Shape& shape, unsigned axis) {
+  AxisLayout layout{shape[axis], 1, 1};
+  for (unsigned i = 0; i < axis; ++i) {
+    layout.inner *= shape[i];
   }
-  for (auto i = 0; i < ndim; ++i) {
-    const auto fl_i = g_row_major ? ndim - 1 - i : i;
-    dltensor.shape[i] = tensor->shape()[fl_i];
+  for (int i = axis + 1; i < shape.ndim(); ++i) {
+    layout.outer *= shape[i];
   }
-  dlmtensor->manager_ctx = (void*)tensor;
-  dlmtensor->deleter = fl_deleteDLTensor;
-  return dlmtensor;
+  return layout;
+}
+
+// Cephes-style exp without branches or libm calls so that the loops below
+// auto-vectorize. Inputs below the f32 range (including -inf) produce 0. NaN
+// fails every comparison, so it is clamped like -inf to keep the int
+// conversion defined and passed through at the end.
+inline float vexp(float x) {
+  const float xc = x > -87.3f ? std::min(x, 88.3f) : -87.3f;
+  const float n = std::floor(xc * 1.44269504088896341f + 0.5f);
+  const float r = xc - n * 0.693359375f + n * 2.12194440e-4f;
+  float p = 1.9875691500e-4f;
+  p = p * r + 1.3981999507e-3f;
+  p = p * r + 8.3334519073e-3f;
+  p = p * r + 4.1665795894e-2f;
+  p = p * r + 1.6666665459e-1f;
+  p = p * r + 5.0000001201e-1f;
+  const float y = p * r * r + r + 1.0f;
+  const int32_t bits = (static_cast<int32_t>(n) + 127) << 23;
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return x != x ? x : x < -87.3f ? 0.0f : y * scale;
+}
+
+inline double vexp(double x) {
+  return std::exp(x);
+}
+
+enum class SoftmaxMode { Softmax, LogSoftmax, LogSumExp };
+
+// Calls fn(base, row, width) for blocks of up to 256 columns of every slab.
+// `base` is the offset of the block's first element and `row` its offset in the
+// reduced (per-row) output.
+template <typename F>
+void forEachAxisBlock(const AxisLayout& l, F&& fn) {
+  constexpr int64_t kBlock = 256;
+  const int64_t blocks_per_slab = (l.inner + kBlock - 1) / kBlock;
+  const int64_t grain =
+      std::max<int64_t>(1, 32768 / std::max<int64_t>(1, l.len * kBlock));
+  parallelFor(l.outer * blocks_per_slab, grain, [&](int64_t begin, int64_t end) {
+    for (int64_t b = begin; b < end; ++b) {
+      const int64_t o = b / blocks_per_slab;
+      const int64_t i0 = (b % blocks_per_slab) * kBlock;
+      const int64_t width = std::min(kBlock, l.inner - i0);
+      fn(o * l.len * l.inner + i0, o * l.inner + i0, width);
+    }
+  });
+}
+
+// Softmax-family forward in two passes per row: a max pass and a fused
+// exp/accumulate pass. Softmax keeps the exponentials in `out` and rescales
+// them in place.
+template <typename T>
+void hostSoftmax(const T* x, T* out, const AxisLayout& l, SoftmaxMode mode) {
+  forEachAxisBlock(l, [&](int64_t base, int64_t row, int64_t width) {
+    T m[256];
+    T s[256];
+    std::fill(m, m + width, -std::numeric_limits<T>::infinity());
+    std::fill(s, s + width, T(0));
+    for (int64_t j = 0; j < l.len; ++j) {
+      const T* xr = x + base + j * l.inner;
+      for (int64_t i = 0; i < width; ++i) {
+        m[i] = std::max(m[i], xr[i]);
+      }
+    }
+    for (int64_t i = 0; i < width; ++i) {
+      // Rows that are entirely -inf would otherwise produce NaN.
+      if (m[i] == -std::numeric_limits<T>::infinity()) {
+        m[i] = 0;
+      }
+    }
+    for (int64_t j = 0; j < l.len; ++j) {
+      const T* xr = x + base + j * l.inner;
+      if (mode == SoftmaxMode::Softmax) {
+        T* yr = out + base + j * l.inner;
+        for (int64_t i = 0; i < width; ++i) {
+          yr[i] = vexp(xr[i] - m[i]);
+          s[i] += yr[i];
+        }
+      } else {
+        for (int64_t i = 0; i < width; ++i) {
+          s[i] += vexp(xr[i] - m[i]);
+        }
+      }
+    }
+    if (mode == SoftmaxMode::LogSumExp) {
+      for (int64_t i = 0; i < width; ++i) {
+        out[row + i] = m[i] + std::log(s[i]);
+      }
+      return;
+    }
+    for (int64_t i = 0; i < width; ++i) {
+      s[i] = mode == SoftmaxMode::Softmax ? T(1) / s[i] : m[i] + std::log(s[i]);
+    }
+    for (int64_t j = 0; j < l.len; ++j) {
+      T* yr = out + base + j * l.inner;
+      if (mode == SoftmaxMode::Softmax) {
+        for (int64_t i = 0; i < width; ++i) {
+          yr[i] *= s[i];
+        }
+      } else {
+        const T* xr = x + base + j * l.inner;
+        for (int64_t i = 0; i < width; ++i) {
+          yr[i] = xr[i] - s[i];
+        }
+      }
+    }
+  });
+}
+
+// Backward kernels. `y` is the forward output (softmax or log-softmax), or the
+// forward input for logsumexp, in which case `lse` holds the reduced result.
+template <typename T>
+void hostSoftmaxBackward(const T* g,
+                         const T* y,
+                         const T* lse,
+                         T* dx,
+                         const AxisLayout& l,
+                         SoftmaxMode mode) {
+  forEachAxisBlock(l, [&](int64_t base, int64_t row, int64_t width) {
+    if (mode == SoftmaxMode::LogSumExp) {
+      for (int64_t j = 0; j < l.len; ++j) {
+        const int64_t off = base + j * l.inner;
+        for (int64_t i = 0; i < width; ++i) {
+          dx[off + i] = g[row + i] * vexp(y[off + i] - lse[row + i]);
+        }
+      }
+      return;
+    }
+    T s[256];
+    std::fill(s, s + width, T(0));
+    for (int64_t j = 0; j < l.len; ++j) {
+      const int64_t off = base + j * l.inner;
+      for (int64_t i = 0; i < width; ++i) {
+        s[i] += mode == SoftmaxMode::Softmax ? g[off + i] * y[off + i]
+                                             : g[off + i];
+      }
+    }
+    for (int64_t j = 0; j < l.len; ++j) {
+      const int64_t off = base + j * l.inner;
+      if (mode == SoftmaxMode::Softmax) {
+        for (int64_t i = 0; i < width; ++i) {
+          dx[off + i] = y[off + i] * (g[off + i] - s[i]);
+        }
+      } else {
+        for (int64_t i = 0; i < width; ++i) {
+          dx[off + i] = g[off + i] - vexp(y[off + i]) * s[i];
+        }
+      }
+    }
+  });
+}
+
+bool isHostFloatTensor(const fl::Tensor& t) {
+  return isHostTensor(t) &&
+         (t.type() == fl::dtype::f32 || t.type() == fl::dtype::f64);
+}
+
+fl::Tensor contiguous(const fl::Tensor& t) {
+  return t.isContiguous() ? t : t.asContiguousTensor();
+}
+
+// Shape of a reduction over `axis`, with or without the reduced dimension.
+fl::Shape reducedShape(const fl::Shape& shape, unsigned axis, bool keep_dims) {
+  if (axis >= static_cast<unsigned>(shape.ndim())) {
+    throw std::invalid_argument("reduction axis " + std::to_string(axis) +
+                                " is out of range");
+  }
+  std::vector<fl::Dim> dims;
+  for (int i = 0; i < shape.ndim(); ++i) {
+    if (i != static_cast<int>(axis)) {
+      dims.emplace_back(shape[i]);
+    } else if (keep_dims) {
+      dims.emplace_back(1);
+    }
+  }
+  return fl::Shape(dims);
+}
+
+// Shape of a reduction over `axes`, or over every axis when `axes` is empty.
+fl::Shape reducedShape(const fl::Shape& shape,
+                       const std::vector<int>& axes,
+                       bool keep_dims) {
+  uint64_t reduced = axes.empty() ? ~uint64_t(0) : 0;
+  for (int axis : axes) {
+    if (axis < 0 || axis >= shape.ndim()) {
+      throw std::invalid_argument("reduction axis " + std::to_string(axis) +
+                                  " is out of range");
+    }
+    reduced |= uint64_t(1) << axis;
+  }
+  std::vector<fl::Dim> dims;
+  for (int i = 0; i < shape.ndim(); ++i) {
+    if (!(reduced >> i & 1)) {
+      dims.emplace_back(shape[i]);
+    } else if (keep_dims) {
+      dims.emplace_back(1);
+    }
+  }
+  return fl::Shape(dims);
+}
+
+// Flashlight indices from (start, end, stride) triples given in binding axis
+// order. -1 for both start and end selects the whole axis; with `shape`, a
+// lone -1 start or end is resolved against it.
+std::vector<fl::Index> indexArgs(const void* ptr,
+                                 int64_t len,
+                                 const fl::Shape* shape) {
+  if (len % 3 != 0) {
+    throw std::invalid_argument(
+        "index arguments must be (start, end, stride) triples");
+  }
+  const ArgSpan args(ptr, len);
+  const int64_t ndim = len / 3;
+  std::vector<fl::Index> indices;
+  indices.reserve(ndim);
+  for (int64_t i = 0; i < ndim; ++i) {
+    const int64_t k = 3 * (g_row_major ? ndim - 1 - i : i);
+    int64_t start = args[k];
+    int64_t end = args[k + 1];
+    if (start == -1 && end == -1) {
+      indices.emplace_back(fl::span);
+      continue;
+    }
+    if (shape) {
+      if (start == -1) {
+        start = 0;
+      }
+      if (end == -1) {
+        end = (*shape)[i];
+      }
+    }
+    if (start + 1 == end) {
+      indices.emplace_back(start);
+    } else {
+      indices.emplace_back(fl::range(start, end, args[k + 2]));
+    }
+  }
+  return indices;
+}
+
+fl::Tensor softmaxForward(const fl::Tensor& tensor,
+                          unsigned axis,
+                          SoftmaxMode mode,
+                          bool keep_dims) {
+  const auto& shape = tensor.shape();
+  if (!isHostFloatTensor(tensor) || tensor.elements() == 0) {
+    const std::vector<int> axes = {static_cast<int>(axis)};
+    auto m = fl::amax(tensor, axes, true);
+    auto shifted = tensor - m;
+    auto s = fl::sum(fl::exp(shifted), axes, true);
+    if (mode == SoftmaxMode::Softmax) {
+      return fl::exp(shifted) / s;
+    } else if (mode == SoftmaxMode::LogSoftmax) {
+      return shifted - fl::log(s);
+    }
+    return fl::reshape(m + fl::log(s), reducedShape(shape, axis, keep_dims));
+  }
+  auto input = contiguous(tensor);
+  auto out_shape = mode == SoftmaxMode::LogSumExp
+                       ? reducedShape(shape, axis, keep_dims)
+                       : shape;
+  fl::Tensor out(out_shape, input.type());
+  const auto layout = axisLayout(shape, axis);
+  if (input.type() == fl::dtype::f32) {
+    HostView<float> x(input);
+    HostView<float> y(out);
+    hostSoftmax(x.data(), y.data(), layout, mode);
+  } else {
+    HostView<double> x(input);
+    HostView<double> y(out);
+    hostSoftmax(x.data(), y.data(), layout, mode);
+  }
+  return out;
+}
+
+fl::Tensor softmaxBackward(const fl::Tensor& grad,
+                           const fl::Tensor& y,
+                           const fl::Tensor& lse,
+                           unsigned axis,
+                           SoftmaxMode mode) {
+  if (mode == SoftmaxMode::LogSumExp) {
+    const auto kept = reducedShape(y.shape(), axis, true);
+    const auto dropped = reducedShape(y.shape(), axis, false);
+    for (const auto* t : {&grad, &lse}) {
+      if (t->shape() != kept && t->shape() != dropped) {
+        throw std::invalid_argument(
+            "fl_logsumexpBackward expects grad and out shaped like the "
+            "fl_logsumexp result");
+      }
+    }
+  } else if (grad.shape() != y.shape()) {
+    throw std::invalid_argument(
+        "softmax backward expects grad shaped like the forward output");
+  }
+  const bool host = isHostFloatTensor(grad) && grad.type() == y.type() &&
+                    isHostTensor(y) &&
+                    (mode != SoftmaxMode::LogSumExp ||
+                     (lse.type() == y.type() && isHostTensor(lse))) &&
+                    y.elements() > 0;
+  if (!host) {
+    const std::vector<int> axes = {static_cast<int>(axis)};
+    if (mode == SoftmaxMode::Softmax) {
+      return y * (grad - fl::sum(grad * y, axes, true));
+    } else if (mode == SoftmaxMode::LogSoftmax) {
+      return grad - fl::exp(y) * fl::sum(grad, axes, true);
+    }
+    auto kept = reducedShape(y.shape(), axis, true);
+    return fl::reshape(grad, kept) * fl::exp(y - fl::reshape(lse, kept));
+  }
+  auto g = contiguous(grad);
+  auto in = contiguous(y);
+  auto r = mode == SoftmaxMode::LogSumExp ? contiguous(lse) : in;
+  fl::Tensor dx(in.shape(), in.type());
+  const auto layout = axisLayout(in.shape(), axis);
+  if (in.type() == fl::dtype::f32) {
+    HostView<float> gv(g), yv(in), rv(r), out(dx);
+    hostSoftmaxBackward(gv.data(), yv.data(), rv.data(), out.data(), layout,
+                        mode);
+  } else {
+    HostView<double> gv(g), yv(in), rv(r), out(dx);
+    hostSoftmaxBackward(gv.data(), yv.data(), rv.data(), out.data(), layout,
+                        mode);
+  }
+  return dx;
+}
+
+// Calls fn(T{}) with T matching a floating point dtype.
+template <typename F>
+void dispatchFloat(fl::dtype type, F&& fn) {
+  if (type == fl::dtype::f32) {
+    fn(float{});
+  } else if (type == fl::dtype::f64) {
+    fn(double{});
+  } else {
+    throw std::invalid_argument("expected a float32 or float64 tensor");
+  }
+}
+
+// Mean and inverse standard deviation of `n` elements in `blocks` runs of
+// `run` contiguous elements spaced `stride` apart. Accumulates in double around
+// the first element so one pass stays accurate for data with a large mean.
+template <typename T>
+void moments(const T* x,
+             int64_t blocks,
+             int64_t run,
+             int64_t stride,
+             double eps,
+             double& mean,
+             double& var,
+             double& invstd) {
+  const double shift = x[0];
+  double s = 0;
+  double ss = 0;
+  for (int64_t b = 0; b < blocks; ++b) {
+    const T* xb = x + b * stride;
+    for (int64_t i = 0; i < run; ++i) {
+      const double d = xb[i] - shift;
+      s += d;
+      ss += d * d;
+    }
+  }
+  const double n = static_cast<double>(blocks * run);
+  mean = shift + s / n;
+  var = std::max(0.0, ss / n - (s / n) * (s / n));
+  invstd = 1.0 / std::sqrt(var + eps);
+}
+
+// Layer norm over contiguous rows of `n` elements. Statistics and the affine
+// transform are computed per row while the row is cache resident.
+template <typename T>
+void hostLayerNorm(const T* x,
+                   const T* w,
+                   const T* b,
+                   T* y,
+                   T* mean,
+                   T* invstd,
+                   int64_t rows,
+                   int64_t n,
+                   double eps) {
+  parallelFor(rows, std::max<int64_t>(1, 16384 / n), [&](int64_t r0, int64_t r1) {
+    for (int64_t r = r0; r < r1; ++r) {
+      const T* xr = x + r * n;
+      T* yr = y + r * n;
+      double m, v, is;
+      moments(xr, 1, n, 0, eps, m, v, is);
+      mean[r] = m;
+      invstd[r] = is;
+      const T tm = m;
+      const T tis = is;
+      for (int64_t i = 0; i < n; ++i) {
+        const T xhat = (xr[i] - tm) * tis;
+        yr[i] = (w ? xhat * w[i] : xhat) + (b ? b[i] : T(0));
+      }
+    }
+  });
+}
+
+template <typename T>
+void hostLayerNormBackward(const T* dy,
+                           const T* x,
+                           const T* w,
+                           const T* mean,
+                           const T* invstd,
+                           T* dx,
+                           T* dw,
+                           T* db,
+                           int64_t rows,
+                           int64_t n) {
+  // Per-task partial sums for the parameter gradients, reduced at the end.
+  const int64_t tasks =
+      std::max<int64_t>(1, std::min<int64_t>(ThreadPool::get().size(), rows));
+  const int64_t step = (rows + tasks - 1) / tasks;
+  std::vector<double> partial(dw ? tasks * 2 * n : 0);
+  ThreadPool::get().run(tasks, [&](size_t t) {
+    double* pdw = dw ? partial.data() + t * 2 * n : nullptr;
+    double* pdb = dw ? pdw + n : nullptr;
+    const int64_t end = std::min<int64_t>(rows, (t + 1) * step);
+    for (int64_t r = t * step; r < end; ++r) {
+      const T* xr = x + r * n;
+      const T* gr = dy + r * n;
+      T* dxr = dx + r * n;
+      const T m = mean[r];
+      const T is = invstd[r];
+      double sg = 0;
+      double sgx = 0;
+      for (int64_t i = 0; i < n; ++i) {
+        const T xhat = (xr[i] - m) * is;
+        const T g = w ? gr[i] * w[i] : gr[i];
+        sg += g;
+        sgx += g * xhat;
+        if (pdw) {
+          pdw[i] += gr[i] * xhat;
+          pdb[i] += gr[i];
+        }
+      }
+      const T mg = sg / n;
+      const T mgx = sgx / n;
+      for (int64_t i = 0; i < n; ++i) {
+        const T xhat = (xr[i] - m) * is;
+        const T g = w ? gr[i] * w[i] : gr[i];
+        dxr[i] = is * (g - mg - xhat * mgx);
+      }
+    }
+  });
+  if (dw) {
+    for (int64_t i = 0; i < n; ++i) {
+      double sw = 0;
+      double sb = 0;
+      for (int64_t t = 0; t < tasks; ++t) {
+        sw += partial[t * 2 * n + i];
+        sb += partial[t * 2 * n + n + i];
+      }
+      dw[i] = sw;
+      db[i] = sb;
+    }
+  }
+}
+
+// Batch norm over the channel axis of `l`. In training mode the batch
+// statistics are computed in one pass per channel and folded into a single
+// scale/shift for the output pass; running statistics are updated in place.
+template <typename T>
+void hostBatchNorm(const T* x,
+                   const T* w,
+                   const T* b,
+                   T* y,
+                   T* mean,
+                   T* invstd,
+                   T* running_mean,
+                   T* running_var,
+                   const AxisLayout& l,
+                   bool train,
+                   double momentum,
+                   double eps) {
+  const int64_t count = l.inner * l.outer;
+  parallelFor(l.len, 1, [&](int64_t c0, int64_t c1) {
+    for (int64_t c = c0; c < c1; ++c) {
+      const T* xc = x + c * l.inner;
+      double m, v, is;
+      if (train) {
+        moments(xc, l.outer, l.inner, l.len * l.inner, eps, m, v, is);
+        if (running_mean) {
+          running_mean[c] = (1 - momentum) * running_mean[c] + momentum * m;
+        }
+        if (running_var) {
+          const double unbiased = count > 1 ? v * count / (count - 1) : v;
+          running_var[c] =
+              (1 - momentum) * running_var[c] + momentum * unbiased;
+        }
+      } else {
+        m = running_mean[c];
+        is = 1.0 / std::sqrt(static_cast<double>(running_var[c]) + eps);
+      }
+      mean[c] = m;
+      invstd[c] = is;
+      const T scale = w ? w[c] * is : is;
+      const T shift = (b ? b[c] : T(0)) - m * scale;
+      for (int64_t o = 0; o < l.outer; ++o) {
+        const int64_t off = o * l.len * l.inner + c * l.inner;
+        for (int64_t i = 0; i < l.inner; ++i) {
+          y[off + i] = x[off + i] * scale + shift;
+        }
+      }
+    }
+  });
+}
+
+template <typename T>
+void hostBatchNormBackward(const T* dy,
+                           const T* x,
+                           const T* w,
+                           const T* mean,
+                           const T* invstd,
+                           T* dx,
+                           T* dw,
+                           T* db,
+                           const AxisLayout& l,
+                           bool train) {
+  const double count = static_cast<double>(l.inner * l.outer);
+  parallelFor(l.len, 1, [&](int64_t c0, int64_t c1) {
+    for (int64_t c = c0; c < c1; ++c) {
+      const T m = mean[c];
+      const T is = invstd[c];
+      double sg = 0;
+      double sgx = 0;
+      for (int64_t o = 0; o < l.outer; ++o) {
+        const int64_t off = o * l.len * l.inner + c * l.inner;
+        for (int64_t i = 0; i < l.inner; ++i) {
+          sg += dy[off + i];
+          sgx += dy[off + i] * (x[off + i] - m) * is;
+        }
+      }
+      if (dw) {
+        dw[c] = sgx;
+        db[c] = sg;
+      }
+      const T scale = w ? w[c] * is : is;
+      const T mg = train ? sg / count : 0;
+      const T mgx = train ? sgx / count : 0;
+      for (int64_t o = 0; o < l.outer; ++o) {
+        const int64_t off = o * l.len * l.inner + c * l.inner;
+        for (int64_t i = 0; i < l.inner; ++i) {
+          const T xhat = (x[off + i] - m) * is;
+          dx[off + i] = scale * (dy[off + i] - mg - xhat * mgx);
+        }
+      }
+    }
+  });
+}
+
+// Shape with every dimension set to 1 except `axis`, for broadcasting
+// per-channel parameters.
+fl::Shape channelShape(const fl::Shape& shape, unsigned axis) {
+  std::vector<fl::Dim> dims(shape.ndim(), 1);
+  dims[axis] = shape[axis];
+  return fl::Shape(dims);
+}
+
+// Throws unless `t` is absent or holds `elements` elements. The host kernels
+// index parameters and statistics by raw pointer, so sizes are checked first.
+void requireElements(const fl::Tensor* t, int64_t elements, const char* what) {
+  if (t && static_cast<int64_t>(t->elements()) != elements) {
+    throw std::invalid_argument(std::string(what) + " has " +
+                                std::to_string(t->elements()) +
+                                " elements, expected " +
+                                std::to_string(elements));
+  }
+}
+
+void requireSameShape(const fl::Tensor& t,
+                      const fl::Tensor& input,
+                      const char* what) {
+  if (t.shape() != input.shape()) {
+    throw std::invalid_argument(std::string(what) +
+                                " must have the shape of the input");
+  }
+}
+
+bool isHostOrAbsent(const fl::Tensor* t) {
+  return !t || isHostTensor(*t);
+}
+
+// Layer norm normalizes the innermost `norm_ndim` Flashlight dimensions, which
+// are the trailing dimensions in row-major order. Statistics have the shape of
+// the remaining dimensions.
+struct LayerNormShape {
+  std::vector<int> norm_axes;
+  std::vector<int> row_axes;
+  fl::Shape param_shape;
+  fl::Shape stat_shape;
+  fl::Shape keep_shape;
+  int64_t n;
+  int64_t rows;
+  bool contiguous;
+};
+
+LayerNormShape layerNormShape(const fl::Shape& shape, int norm_ndim) {
+  const int ndim = shape.ndim();
+  if (norm_ndim <= 0 || norm_ndim > ndim) {
+    throw std::invalid_argument("invalid number of normalized dimensions");
+  }
+  LayerNormShape s;
+  const int first = g_row_major ? 0 : ndim - norm_ndim;
+  std::vector<fl::Dim> param_dims, stat_dims, keep_dims;
+  s.n = 1;
+  for (int i = 0; i < ndim; ++i) {
+    if (i >= first && i < first + norm_ndim) {
+      s.norm_axes.emplace_back(i);
+      s.n *= shape[i];
+      param_dims.emplace_back(shape[i]);
+      keep_dims.emplace_back(1);
+    } else {
+      s.row_axes.emplace_back(i);
+      stat_dims.emplace_back(shape[i]);
+      keep_dims.emplace_back(shape[i]);
+    }
+  }
+  if (stat_dims.empty()) {
+    stat_dims.emplace_back(1);
+  }
+  s.param_shape = fl::Shape(param_dims);
+  s.stat_shape = fl::Shape(stat_dims);
+  s.keep_shape = fl::Shape(keep_dims);
+  s.rows = s.n ? shape.elements() / s.n : 0;
+  s.contiguous = first == 0;
+  return s;
+}
+
+// Broadcastable view of a layer norm parameter against the normalized input.
+fl::Tensor layerNormParam(const fl::Tensor& p, const fl::Shape& shape, int ndim) {
+  std::vector<fl::Dim> dims(ndim, 1);
+  const int first = g_row_major ? 0 : ndim - shape.ndim();
+  for (int i = 0; i < shape.ndim(); ++i) {
+    dims[first + i] = shape[i];
+  }
+  return fl::reshape(p, fl::Shape(dims));
+}
+
+void layerNormForward(const fl::Tensor& input,
+                      const fl::Tensor* weight,
+                      const fl::Tensor* bias,
+                      int norm_ndim,
+                      double eps,
+                      fl::Tensor& y,
+                      fl::Tensor& mean,
+                      fl::Tensor& invstd) {
+  const auto s = layerNormShape(input.shape(), norm_ndim);
+  requireElements(weight, s.n, "layer norm weight");
+  requireElements(bias, s.n, "layer norm bias");
+  const bool host = isHostFloatTensor(input) && s.contiguous && s.n > 0 &&
+                    (!weight || weight->type() == input.type()) &&
+                    (!bias || bias->type() == input.type()) &&
+                    isHostOrAbsent(weight) && isHostOrAbsent(bias);
+  if (!host) {
+    auto m = fl::mean(input, s.norm_axes, true);
+    auto xc = input - m;
+    auto is = 1 / fl::sqrt(fl::mean(xc * xc, s.norm_axes, true) + eps);
+    y = xc * is;
+    if (weight) {
+      y = y * layerNormParam(*weight, s.param_shape, input.ndim());
+    }
+    if (bias) {
+      y = y + layerNormParam(*bias, s.param_shape, input.ndim());
+    }
+    mean = fl::reshape(m, s.stat_shape);
+    invstd = fl::reshape(is, s.stat_shape);
+    return;
+  }
+  auto x = contiguous(input);
+  auto w = weight ? contiguous(*weight) : fl::Tensor();
+  auto b = bias ? contiguous(*bias) : fl::Tensor();
+  y = fl::Tensor(x.shape(), x.type());
+  mean = fl::Tensor(s.stat_shape, x.type());
+  invstd = fl::Tensor(s.stat_shape, x.type());
+  dispatchFloat(x.type(), [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> xv(x), yv(y), mv(mean), iv(invstd);
+    HostView<T> wv(weight ? &w : nullptr), bv(bias ? &b : nullptr);
+    hostLayerNorm(xv.data(), wv.data(), bv.data(), yv.data(), mv.data(),
+                  iv.data(), s.rows, s.n, eps);
+  });
+}
+
+void layerNormBackward(const fl::Tensor& grad,
+                       const fl::Tensor& input,
+                       const fl::Tensor* weight,
+                       const fl::Tensor& mean,
+                       const fl::Tensor& invstd,
+                       int norm_ndim,
+                       fl::Tensor& dx,
+                       fl::Tensor& dw,
+                       fl::Tensor& db) {
+  const auto s = layerNormShape(input.shape(), norm_ndim);
+  requireSameShape(grad, input, "layer norm gradient");
+  requireElements(weight, s.n, "layer norm weight");
+  requireElements(&mean, s.rows, "layer norm mean");
+  requireElements(&invstd, s.rows, "layer norm invstd");
+  const auto type = input.type();
+  const bool host = isHostFloatTensor(input) && s.contiguous && s.n > 0 &&
+                    grad.type() == type && mean.type() == type &&
+                    invstd.type() == type && isHostTensor(grad) &&
+                    isHostTensor(mean) && isHostTensor(invstd) &&
+                    (!weight || weight->type() == type) &&
+                    isHostOrAbsent(weight);
+  if (!host) {
+    auto m = fl::reshape(mean, s.keep_shape);
+    auto is = fl::reshape(invstd, s.keep_shape);
+    auto xhat = (input - m) * is;
+    auto g = grad;
+    if (weight) {
+      g = g * layerNormParam(*weight, s.param_shape, input.ndim());
+    }
+    dx = is *
+        (g - fl::mean(g, s.norm_axes, true) -
+         xhat * fl::mean(g * xhat, s.norm_axes, true));
+    if (weight) {
+      auto gx = grad * xhat;
+      dw = s.row_axes.empty() ? gx : fl::sum(gx, s.row_axes);
+      db = s.row_axes.empty() ? grad : fl::sum(grad, s.row_axes);
+      dw = fl::reshape(dw, s.param_shape);
+      db = fl::reshape(db, s.param_shape);
+    }
+    return;
+  }
+  auto x = contiguous(input);
+  auto g = contiguous(grad);
+  auto m = contiguous(mean);
+  auto is = contiguous(invstd);
+  auto w = weight ? contiguous(*weight) : fl::Tensor();
+  dx = fl::Tensor(x.shape(), type);
+  if (weight) {
+    dw = fl::Tensor(s.param_shape, type);
+    db = fl::Tensor(s.param_shape, type);
+  }
+  dispatchFloat(type, [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> xv(x), gv(g), mv(m), iv(is), dxv(dx);
+    HostView<T> wv(weight ? &w : nullptr);
+    HostView<T> dwv(weight ? &dw : nullptr), dbv(weight ? &db : nullptr);
+    hostLayerNormBackward(gv.data(), xv.data(), wv.data(), mv.data(),
+                          iv.data(), dxv.data(), dwv.data(), dbv.data(),
+                          s.rows, s.n);
+  });
+}
+
+void batchNormForward(const fl::Tensor& input,
+                      const fl::Tensor* weight,
+                      const fl::Tensor* bias,
+                      fl::Tensor* running_mean,
+                      fl::Tensor* running_var,
+                      unsigned axis,
+                      bool train,
+                      double momentum,
+                      double eps,
+                      fl::Tensor& y,
+                      fl::Tensor& mean,
+                      fl::Tensor& invstd) {
+  if (!train && (!running_mean || !running_var)) {
+    throw std::invalid_argument("evaluation mode requires running statistics");
+  }
+  if (static_cast<int>(axis) >= input.ndim()) {
+    throw std::invalid_argument("batch norm axis out of range");
+  }
+  const int64_t channels = input.shape()[axis];
+  requireElements(weight, channels, "batch norm weight");
+  requireElements(bias, channels, "batch norm bias");
+  requireElements(running_mean, channels, "batch norm running mean");
+  requireElements(running_var, channels, "batch norm running variance");
+  const auto type = input.type();
+  auto same = [&](const fl::Tensor* t) {
+    return !t || (t->type() == type && isHostTensor(*t) && t->isContiguous());
+  };
+  const bool host = isHostFloatTensor(input) && input.elements() > 0 &&
+                    same(weight) && same(bias) && same(running_mean) &&
+                    same(running_var);
+  if (!host) {
+    const auto cshape = channelShape(input.shape(), axis);
+    const fl::Shape flat({input.shape()[axis]});
+    std::vector<int> axes;
+    for (int i = 0; i < input.ndim(); ++i) {
+      if (i != static_cast<int>(axis)) {
+        axes.emplace_back(i);
+      }
+    }
+    fl::Tensor m, is;
+    if (train) {
+      m = fl::mean(input, axes, true);
+      auto xc = input - m;
+      auto v = fl::mean(xc * xc, axes, true);
+      is = 1 / fl::sqrt(v + eps);
+      const double count = input.elements() / input.shape()[axis];
+      if (running_mean) {
+        *running_mean =
+            (1 - momentum) * *running_mean + momentum * fl::reshape(m, flat);
+      }
+      if (running_var) {
+        auto unbiased = count > 1 ? v * (count / (count - 1)) : v;
+        *running_var = (1 - momentum) * *running_var +
+            momentum * fl::reshape(unbiased, flat);
+      }
+    } else {
+      m = fl::reshape(*running_mean, cshape);
+      is = 1 / fl::sqrt(fl::reshape(*running_var, cshape) + eps);
+    }
+    y = (input - m) * is;
+    if (weight) {
+      y = y * fl::reshape(*weight, cshape);
+    }
+    if (bias) {
+      y = y + fl::reshape(*bias, cshape);
+    }
+    mean = fl::reshape(m, flat);
+    invstd = fl::reshape(is, flat);
+    return;
+  }
+  auto x = contiguous(input);
+  const auto layout = axisLayout(x.shape(), axis);
+  y = fl::Tensor(x.shape(), type);
+  mean = fl::Tensor(fl::Shape({layout.len}), type);
+  invstd = fl::Tensor(fl::Shape({layout.len}), type);
+  if (train) {
+    detachShared(running_mean);
+    detachShared(running_var);
+  }
+  dispatchFloat(type, [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> xv(x), yv(y), mv(mean), iv(invstd);
+    HostView<T> wv(weight), bv(bias), rmv(running_mean), rvv(running_var);
+    hostBatchNorm(xv.data(), wv.data(), bv.data(), yv.data(), mv.data(),
+                  iv.data(), rmv.data(), rvv.data(), layout, train, momentum,
+                  eps);
+  });
+}
+
+void batchNormBackward(const fl::Tensor& grad,
+                       const fl::Tensor& input,
+                       const fl::Tensor* weight,
+                       const fl::Tensor& mean,
+                       const fl::Tensor& invstd,
+                       unsigned axis,
+                       bool train,
+                       fl::Tensor& dx,
+                       fl::Tensor& dw,
+                       fl::Tensor& db) {
+  if (static_cast<int>(axis) >= input.ndim()) {
+    throw std::invalid_argument("batch norm axis out of range");
+  }
+  const int64_t channels = input.shape()[axis];
+  requireSameShape(grad, input, "batch norm gradient");
+  requireElements(weight, channels, "batch norm weight");
+  requireElements(&mean, channels, "batch norm mean");
+  requireElements(&invstd, channels, "batch norm invstd");
+  const auto type = input.type();
+  const bool host = isHostFloatTensor(input) && input.elements() > 0 &&
+                    grad.type() == type && isHostTensor(grad) &&
+                    mean.type() == type && invstd.type() == type &&
+                    isHostTensor(mean) && isHostTensor(invstd) &&
+                    (!weight || weight->type() == type) &&
+                    isHostOrAbsent(weight);
+  if (!host) {
+    const auto cshape = channelShape(input.shape(), axis);
+    std::vector<int> axes;
+    for (int i = 0; i < input.ndim(); ++i) {
+      if (i != static_cast<int>(axis)) {
+        axes.emplace_back(i);
+      }
+    }
+    auto m = fl::reshape(mean, cshape);
+    auto is = fl::reshape(invstd, cshape);
+    auto xhat = (input - m) * is;
+    auto scale = weight ? fl::reshape(*weight, cshape) * is : is;
+    if (train) {
+      dx = scale *
+          (grad - fl::mean(grad, axes, true) -
+           xhat * fl::mean(grad * xhat, axes, true));
+    } else {
+      dx = scale * grad;
+    }
+    if (weight) {
+      dw = fl::reshape(fl::sum(grad * xhat, axes), weight->shape());
+      db = fl::reshape(fl::sum(grad, axes), weight->shape());
+    }
+    return;
+  }
+  auto x = contiguous(input);
+  auto g = contiguous(grad);
+  auto m = contiguous(mean);
+  auto is = contiguous(invstd);
+  auto w = weight ? contiguous(*weight) : fl::Tensor();
+  const auto layout = axisLayout(x.shape(), axis);
+  dx = fl::Tensor(x.shape(), type);
+  if (weight) {
+    dw = fl::Tensor(weight->shape(), type);
+    db = fl::Tensor(weight->shape(), type);
+  }
+  dispatchFloat(type, [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> xv(x), gv(g), mv(m), iv(is), dxv(dx);
+    HostView<T> wv(weight ? &w : nullptr);
+    HostView<T> dwv(weight ? &dw : nullptr), dbv(weight ? &db : nullptr);
+    hostBatchNormBackward(gv.data(), xv.data(), wv.data(), mv.data(),
+                          iv.data(), dxv.data(), dwv.data(), dbv.data(), layout,
+                          train);
+  });
+}
+
+enum class Activation { None = 0, Relu = 1, Gelu = 2, Sigmoid = 3 };
+
+template <typename T>
+inline T activate(T v, Activation act) {
+  switch (act) {
+    case Activation::Relu:
+      return v > T(0) ? v : T(0);
+    case Activation::Gelu:
+      return T(0.5) * v * (T(1) + std::erf(v * T(0.70710678118654752)));
+    case Activation::Sigmoid:
+      return T(1) / (T(1) + std::exp(-v));
+    default:
+      return v;
+  }
+}
+
+// Bias and activation epilogue applied in place in one pass over a freshly
+// computed product whose innermost dimension has `n` elements.
+template <typename T>
+void hostBiasActivation(T* out, const T* bias, int64_t n, int64_t cols,
+                        Activation act) {
+  parallelFor(cols, std::max<int64_t>(1, 16384 / n), [&](int64_t c0, int64_t c1) {
+    for (int64_t c = c0; c < c1; ++c) {
+      T* col = out + c * n;
+      if (bias) {
+        for (int64_t i = 0; i < n; ++i) {
+          col[i] += bias[i];
+        }
+      }
+      if (act == Activation::Relu) {
+        for (int64_t i = 0; i < n; ++i) {
+          col[i] = col[i] > T(0) ? col[i] : T(0);
+        }
+      } else if (act != Activation::None) {
+        for (int64_t i = 0; i < n; ++i) {
+          col[i] = activate(col[i], act);
+        }
+      }
+    }
+  });
+}
+
+fl::Tensor applyActivation(const fl::Tensor& t, Activation act) {
+  switch (act) {
+    case Activation::Relu:
+      return fl::maximum(t, 0.0);
+    case Activation::Gelu:
+      return 0.5 * t * (1 + fl::erf(t * 0.70710678118654752));
+    case Activation::Sigmoid:
+      return fl::sigmoid(t);
+    default:
+      return t;
+  }
+}
+
+// Row-major `op(x) * op(w) + bias` followed by an activation. Transposes are
+// passed to GEMM as flags rather than materialized. Flashlight exposes no GEMM
+// epilogue, so host results get bias and activation in one in-place pass.
+fl::Tensor linear(const fl::Tensor& x,
+                  const fl::Tensor& w,
+                  const fl::Tensor* bias,
+                  bool trans_x,
+                  bool trans_w,
+                  Activation act) {
+  const auto prop = [](bool trans) {
+    return trans ? fl::MatrixProperty::Transpose : fl::MatrixProperty::None;
+  };
+  auto out = g_row_major ? fl::matmul(w, x, prop(trans_w), prop(trans_x))
+                         : fl::matmul(x, w, prop(trans_x), prop(trans_w));
+  // In column-major order the bias runs along the strided dimension.
+  const int bias_axis = g_row_major ? 0 : 1;
+  const bool host = isHostFloatTensor(out) && out.elements() > 0 &&
+                    (!bias || (g_row_major && bias->type() == out.type() &&
+                               isHostTensor(*bias) &&
+                               bias->elements() == out.dim(0)));
+  if (!host) {
+    if (bias) {
+      std::vector<fl::Dim> dims(out.ndim(), 1);
+      dims[bias_axis] = out.dim(bias_axis);
+      out = out + fl::reshape(*bias, fl::Shape(dims));
+    }
+    return applyActivation(out, act);
+  }
+  auto b = bias ? contiguous(*bias) : fl::Tensor();
+  dispatchFloat(out.type(), [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> ov(out);
+    HostView<T> bv(bias ? &b : nullptr);
+    const int64_t n = out.dim(0);
+    hostBiasActivation(ov.data(), bv.data(), n, out.elements() / n, act);
+  });
+  return out;
+}
+
+// Column-major batched product out[b] = lhs[b] * rhs[b] with lhs P x Q and
+// rhs Q x R. Batch offsets come from per-batch strides, where a zero stride
+// broadcasts that operand. The inner loop runs down contiguous columns.
+template <typename T>
+void hostBmm(const T* lhs,
+             const T* rhs,
+             T* out,
+             int64_t P,
+             int64_t Q,
+             int64_t R,
+             const std::vector<int64_t>& lhs_offsets,
+             const std::vector<int64_t>& rhs_offsets) {
+  const int64_t batches = lhs_offsets.size();
+  parallelFor(batches * R, std::max<int64_t>(1, 16384 / (P * Q + 1)),
+              [&](int64_t begin, int64_t end) {
+                for (int64_t t = begin; t < end; ++t) {
+                  const int64_t b = t / R;
+                  const int64_t r = t % R;
+                  const T* l = lhs + lhs_offsets[b];
+                  const T* rc = rhs + rhs_offsets[b] + r * Q;
+                  T* oc = out + (b * R + r) * P;
+                  std::fill(oc, oc + P, T(0));
+                  for (int64_t q = 0; q < Q; ++q) {
+                    const T s = rc[q];
+                    const T* lc = l + q * P;
+                    for (int64_t p = 0; p < P; ++p) {
+                      oc[p] += lc[p] * s;
+                    }
+                  }
+                }
+              });
+}
+
+// Batched matmul with NumPy-style broadcasting of the leading (row-major)
+// batch dimensions, consistent with `fl_matmul` for the matrix dimensions.
+fl::Tensor bmm(const fl::Tensor& a, const fl::Tensor& b) {
+  const auto& lhs = g_row_major ? b : a;
+  const auto& rhs = g_row_major ? a : b;
+  if (lhs.ndim() < 2 || rhs.ndim() < 2) {
+    throw std::invalid_argument("fl_bmm expects at least 2 dimensions");
+  }
+  const int batch_ndim = std::max(lhs.ndim(), rhs.ndim()) - 2;
+  std::vector<fl::Dim> lb(batch_ndim, 1), rb(batch_ndim, 1), ob(batch_ndim);
+  for (int i = 2; i < lhs.ndim(); ++i) {
+    lb[i - 2] = lhs.dim(i);
+  }
+  for (int i = 2; i < rhs.ndim(); ++i) {
+    rb[i - 2] = rhs.dim(i);
+  }
+  int64_t lhs_batches = 1;
+  int64_t rhs_batches = 1;
+  int64_t batches = 1;
+  for (int i = 0; i < batch_ndim; ++i) {
+    if (lb[i] != rb[i] && lb[i] != 1 && rb[i] != 1) {
+      throw std::invalid_argument("fl_bmm batch dimensions do not broadcast");
+    }
+    ob[i] = std::max(lb[i], rb[i]);
+    lhs_batches *= lb[i];
+    rhs_batches *= rb[i];
+    batches *= ob[i];
+  }
+  const auto P = lhs.dim(0);
+  const auto Q = lhs.dim(1);
+  const auto R = rhs.dim(1);
+  if (rhs.dim(0) != Q) {
+    throw std::invalid_argument("fl_bmm inner dimensions do not match");
+  }
+  std::vector<fl::Dim> out_dims = {P, R};
+  out_dims.insert(out_dims.end(), ob.begin(), ob.end());
+
+  if (lb == rb) {
+    // Same batch shape: the backend's strided-batch GEMM.
+    return fl::matmul(lhs, rhs);
+  }
+  if (lhs_batches == 1) {
+    // Batches of the right operand are extra columns of one large GEMM.
+    auto flat = fl::matmul(fl::reshape(lhs, fl::Shape({P, Q})),
+                           fl::reshape(rhs, fl::Shape({Q, R * rhs_batches})));
+    return fl::reshape(flat, fl::Shape(out_dims));
+  }
+  if (isHostFloatTensor(lhs) && lhs.type() == rhs.type() && isHostTensor(rhs)) {
+    std::vector<int64_t> lhs_offsets(batches), rhs_offsets(batches);
+    for (int64_t bi = 0; bi < batches; ++bi) {
+      int64_t rem = bi;
+      int64_t lo = 0, ro = 0, ls = 1, rs = 1;
+      for (int i = 0; i < batch_ndim; ++i) {
+        const int64_t idx = rem % ob[i];
+        rem /= ob[i];
+        lo += (lb[i] == 1 ? 0 : idx) * ls;
+        ro += (rb[i] == 1 ? 0 : idx) * rs;
+        ls *= lb[i];
+        rs *= rb[i];
+      }
+      lhs_offsets[bi] = lo * P * Q;
+      rhs_offsets[bi] = ro * Q * R;
+    }
+    auto l = contiguous(lhs);
+    auto r = contiguous(rhs);
+    fl::Tensor out(fl::Shape(out_dims), l.type());
+    dispatchFloat(l.type(), [&](auto tag) {
+      using T = decltype(tag);
+      HostView<T> lv(l), rv(r), ov(out);
+      hostBmm(lv.data(), rv.data(), ov.data(), P, Q, R, lhs_offsets,
+              rhs_offsets);
+    });
+    return out;
+  }
+  std::vector<fl::Dim> lt = {1, 1}, rt = {1, 1};
+  for (int i = 0; i < batch_ndim; ++i) {
+    lt.emplace_back(ob[i] / lb[i]);
+    rt.emplace_back(ob[i] / rb[i]);
+  }
+  std::vector<fl::Dim> lshape = {P, Q}, rshape = {Q, R};
+  lshape.insert(lshape.end(), lb.begin(), lb.end());
+  rshape.insert(rshape.end(), rb.begin(), rb.end());
+  return fl::matmul(
+      fl::tile(fl::reshape(lhs, fl::Shape(lshape)), fl::Shape(lt)),
+      fl::tile(fl::reshape(rhs, fl::Shape(rshape)), fl::Shape(rt)));
+}
+
+// Quantized int8 values are stored in b8 tensors, the same one-byte carrier
+// that `fl_tensorFromInt8Buffer` produces, and reinterpreted as signed here.
+inline int8_t quantize(float v, float inv_scale) {
+  const float q = std::nearbyint(v * inv_scale);
+  return static_cast<int8_t>(std::min(127.0f, std::max(-127.0f, q)));
+}
+
+// b8 host memory is mapped through `char`, the element type Flashlight
+// instantiates for it.
+inline int8_t* asS8(char* p) {
+  return reinterpret_cast<int8_t*>(p);
+}
+
+// Symmetric per-channel quantization along the axis of `l`.
+void hostQuantizePerChannel(const float* w,
+                            int8_t* q,
+                            float* scales,
+                            const AxisLayout& l) {
+  parallelFor(l.len, 1, [&](int64_t c0, int64_t c1) {
+    for (int64_t c = c0; c < c1; ++c) {
+      float amax = 0;
+      for (int64_t o = 0; o < l.outer; ++o) {
+        const float* wc = w + o * l.len * l.inner + c * l.inner;
+        for (int64_t i = 0; i < l.inner; ++i) {
+          amax = std::max(amax, std::fabs(wc[i]));
+        }
+      }
+      const float scale = amax > 0 ? amax / 127.0f : 1.0f;
+      const float inv_scale = 1.0f / scale;
+      scales[c] = scale;
+      for (int64_t o = 0; o < l.outer; ++o) {
+        const int64_t off = o * l.len * l.inner + c * l.inner;
+        for (int64_t i = 0; i < l.inner; ++i) {
+          q[off + i] = quantize(w[off + i], inv_scale);
+        }
+      }
+    }
+  });
+}
+
+// s8 x s8 -> s32 dot product; widening multiply-adds that the compiler
+// vectorizes.
+inline int32_t dotS8(const int8_t* a, const int8_t* b, int64_t n) {
+  int32_t acc = 0;
+  for (int64_t i = 0; i < n; ++i) {
+    acc += static_cast<int16_t>(a[i]) * static_cast<int16_t>(b[i]);
+  }
+  return acc;
+}
+
+// out[n, m] = x_scales[m] * w_scales[n] * dot(xq[:, m], wq[:, n]) + bias[n],
+// with K contiguous in both operands. Each weight row is streamed once and
+// used against every input row. With `out_scale` > 0 the result is
+// requantized to int8, otherwise it is written as float.
+void hostQLinear(const int8_t* xq,
+                 const float* x_scales,
+                 const int8_t* wq,
+                 const float* w_scales,
+                 const float* bias,
+                 int64_t M,
+                 int64_t N,
+                 int64_t K,
+                 float out_scale,
+                 float* out,
+                 int8_t* out_q) {
+  const float inv_out_scale = out_scale > 0 ? 1.0f / out_scale : 0.0f;
+  parallelFor(N, std::max<int64_t>(1, 65536 / (K * M + 1)),
+              [&](int64_t n0, int64_t n1) {
+                for (int64_t n = n0; n < n1; ++n) {
+                  const int8_t* wn = wq + n * K;
+                  const float ws = w_scales[n];
+                  const float b = bias ? bias[n] : 0.0f;
+                  for (int64_t m = 0; m < M; ++m) {
+                    const float v =
+                        dotS8(xq + m * K, wn, K) * (x_scales[m] * ws) + b;
+                    if (out_q) {
+                      out_q[n + m * N] = quantize(v, inv_out_scale);
+                    } else {
+                      out[n + m * N] = v;
+                    }
+                  }
+                }
+              });
+}
+
+void requireHost(const fl::Tensor& t, fl::dtype type, const char* what) {
+  if (!isHostTensor(t) || t.type() != type) {
+    throw std::invalid_argument(std::string(what) +
+                                " must be a host tensor of the expected dtype");
+  }
+}
+
+fl::Tensor quantizePerChannel(const fl::Tensor& w,
+                              unsigned axis,
+                              fl::Tensor& scales) {
+  requireHost(w, fl::dtype::f32, "weights");
+  auto in = contiguous(w);
+  const auto layout = axisLayout(in.shape(), axis);
+  fl::Tensor q(in.shape(), fl::dtype::b8);
+  scales = fl::Tensor(fl::Shape({layout.len}), fl::dtype::f32);
+  HostView<float> wv(in), sv(scales);
+  HostView<char> qv(q);
+  hostQuantizePerChannel(wv.data(), asS8(qv.data()), sv.data(), layout);
+  return q;
+}
+
+// `x` is f32 (quantized per row on the fly) or int8 with scale `x_scale`;
+// `qweight` holds one int8 row of K values per output channel.
+fl::Tensor qlinear(const fl::Tensor& x,
+                   float x_scale,
+                   const fl::Tensor& qweight,
+                   const fl::Tensor& scales,
+                   const fl::Tensor* bias,
+                   float out_scale) {
+  requireHost(qweight, fl::dtype::b8, "quantized weights");
+  requireHost(scales, fl::dtype::f32, "scales");
+  if (x.ndim() < 1 || qweight.ndim() != 2 || qweight.elements() == 0) {
+    throw std::invalid_argument(
+        "fl_qlinear expects an input and non-empty [N, K] quantized weights");
+  }
+  const int64_t K = x.dim(0);
+  const int64_t N = qweight.dim(1);
+  if (qweight.dim(0) != K || scales.elements() != N ||
+      (bias && bias->elements() != N)) {
+    throw std::invalid_argument("fl_qlinear operand shapes do not match");
+  }
+  const int64_t M = x.elements() / K;
+  if (bias) {
+    requireHost(*bias, fl::dtype::f32, "bias");
+  }
+  auto dims = x.shape().get();
+  dims[0] = N;
+  fl::Tensor out(fl::Shape(dims),
+                 out_scale > 0 ? fl::dtype::b8 : fl::dtype::f32);
+
+  auto xin = contiguous(x);
+  std::vector<float> x_scales(M, x_scale);
+  std::vector<int8_t> xq;
+  const int8_t* xq_ptr = nullptr;
+  std::unique_ptr<HostView<char>> xq_view;
+  if (xin.type() == fl::dtype::f32) {
+    requireHost(xin, fl::dtype::f32, "input");
+    xq.resize(M * K);
+    HostView<float> xv(xin);
+    const float* xf = xv.data();
+    parallelFor(M, std::max<int64_t>(1, 16384 / (K + 1)), [&](int64_t m0, int64_t m1) {
+      for (int64_t m = m0; m < m1; ++m) {
+        float amax = 0;
+        for (int64_t k = 0; k < K; ++k) {
+          amax = std::max(amax, std::fabs(xf[m * K + k]));
+        }
+        x_scales[m] = amax > 0 ? amax / 127.0f : 1.0f;
+        const float inv_scale = 1.0f / x_scales[m];
+        for (int64_t k = 0; k < K; ++k) {
+          xq[m * K + k] = quantize(xf[m * K + k], inv_scale);
+        }
+      }
+    });
+    xq_ptr = xq.data();
+  } else {
+    requireHost(xin, fl::dtype::b8, "input");
+    xq_view = std::make_unique<HostView<char>>(xin);
+    xq_ptr = asS8(xq_view->data());
+  }
+
+  auto wq = contiguous(qweight);
+  auto ws = contiguous(scales);
+  auto b = bias ? contiguous(*bias) : fl::Tensor();
+  HostView<char> wv(wq);
+  HostView<float> sv(ws);
+  HostView<float> bv(bias ? &b : nullptr);
+  if (out_scale > 0) {
+    HostView<char> ov(out);
+    hostQLinear(xq_ptr, x_scales.data(), asS8(wv.data()), sv.data(),
+                bv.data(), M, N, K, out_scale, nullptr, asS8(ov.data()));
+  } else {
+    HostView<float> ov(out);
+    hostQLinear(xq_ptr, x_scales.data(), asS8(wv.data()), sv.data(),
+                bv.data(), M, N, K, out_scale, ov.data(), nullptr);
+  }
+  return out;
+}
+
+// Batch, sequence and head sizes of q [D, Lq, B...], k [D, Lk, B...] and
+// v [Dv, Lk, B...] in Flashlight order, i.e. row-major [..., L, D].
+struct AttentionShape {
+  int64_t batches;
+  int64_t lq;
+  int64_t lk;
+  int64_t d;
+  int64_t dv;
+  int64_t mask_stride; // 0 when one [Lq, Lk] mask is shared by every batch
+};
+
+constexpr int64_t kAttentionBlockQ = 32;
+constexpr int64_t kAttentionBlockK = 64;
+
+template <typename T>
+inline T dotN(const T* a, const T* b, int64_t n) {
+  T acc = 0;
+  for (int64_t i = 0; i < n; ++i) {
+    acc += a[i] * b[i];
+  }
+  return acc;
+}
+
+// Scaled, masked score of query i against key j, or -inf if it is masked out.
+// The causal mask is top-left aligned: query i attends to keys 0..i.
+template <typename T>
+inline T attentionScore(const T* q,
+                        const T* k,
+                        const T* mask,
+                        bool causal,
+                        T scale,
+                        const AttentionShape& s,
+                        int64_t b,
+                        int64_t i,
+                        int64_t j) {
+  if (causal && j > i) {
+    return -std::numeric_limits<T>::infinity();
+  }
+  T v = dotN(q + (b * s.lq + i) * s.d, k + (b * s.lk + j) * s.d, s.d) * scale;
+  if (mask) {
+    v += mask[b * s.mask_stride + i * s.lk + j];
+  }
+  return v;
+}
+
+// Streaming-softmax attention: each task owns a block of query rows and walks
+// the keys in blocks, rescaling its running max, denominator and output
+// accumulator as it goes, so no [Lq, Lk] score matrix is formed. Writes the
+// per-row logsumexp for the backward pass; fully masked rows produce zeros.
+template <typename T>
+void hostAttention(const T* q,
+                   const T* k,
+                   const T* v,
+                   const T* mask,
+                   bool causal,
+                   T scale,
+                   const AttentionShape& s,
+                   T* out,
+                   T* lse) {
+  const T neg_inf = -std::numeric_limits<T>::infinity();
+  const int64_t q_blocks = (s.lq + kAttentionBlockQ - 1) / kAttentionBlockQ;
+  parallelFor(s.batches * q_blocks, 1, [&](int64_t begin, int64_t end) {
+    std::vector<T> scores(kAttentionBlockK);
+    std::vector<T> acc(kAttentionBlockQ * s.dv);
+    std::vector<T> m(kAttentionBlockQ), l(kAttentionBlockQ);
+    for (int64_t task = begin; task < end; ++task) {
+      const int64_t b = task / q_blocks;
+      const int64_t q0 = (task % q_blocks) * kAttentionBlockQ;
+      const int64_t q1 = std::min(s.lq, q0 + kAttentionBlockQ);
+      const int64_t k_end = causal ? std::min(s.lk, q1) : s.lk;
+      std::fill(acc.begin(), acc.end(), T(0));
+      std::fill(m.begin(), m.end(), neg_inf);
+      std::fill(l.begin(), l.end(), T(0));
+      for (int64_t k0 = 0; k0 < k_end; k0 += kAttentionBlockK) {
+        const int64_t k1 = std::min(k_end, k0 + kAttentionBlockK);
+        for (int64_t i = q0; i < q1; ++i) {
+          const int64_t r = i - q0;
+          T block_max = neg_inf;
+          for (int64_t j = k0; j < k1; ++j) {
+            const T sc = attentionScore(q, k, mask, causal, scale, s, b, i, j);
+            scores[j - k0] = sc;
+            block_max = std::max(block_max, sc);
+          }
+          const T m_new = std::max(m[r], block_max);
+          if (m_new == neg_inf) {
+            continue;
+          }
+          T* a = acc.data() + r * s.dv;
+          const T correction = vexp(m[r] - m_new);
+          l[r] *= correction;
+          for (int64_t e = 0; e < s.dv; ++e) {
+            a[e] *= correction;
+          }
+          for (int64_t j = k0; j < k1; ++j) {
+            const T p = vexp(scores[j - k0] - m_new);
+            l[r] += p;
+            const T* vj = v + (b * s.lk + j) * s.dv;
+            for (int64_t e = 0; e < s.dv; ++e) {
+              a[e] += p * vj[e];
+            }
+          }
+          m[r] = m_new;
+        }
+      }
+      for (int64_t i = q0; i < q1; ++i) {
+        const int64_t r = i - q0;
+        const T inv = l[r] > 0 ? T(1) / l[r] : T(0);
+        const T* a = acc.data() + r * s.dv;
+        T* o = out + (b * s.lq + i) * s.dv;
+        for (int64_t e = 0; e < s.dv; ++e) {
+          o[e] = a[e] * inv;
+        }
+        lse[b * s.lq + i] = l[r] > 0 ? m[r] + std::log(l[r]) : neg_inf;
+      }
+    }
+  });
+}
+
+// Recomputes the attention probabilities from `lse` rather than storing them.
+// Key blocks accumulate dk and dv in one pass and query blocks accumulate dq in
+// a second, so every output row has a single writer and no atomics are needed.
+template <typename T>
+void hostAttentionBackward(const T* dout,
+                           const T* q,
+                           const T* k,
+                           const T* v,
+                           const T* mask,
+                           const T* out,
+                           const T* lse,
+                           bool causal,
+                           T scale,
+                           const AttentionShape& s,
+                           T* dq,
+                           T* dk,
+                           T* dv) {
+  const T neg_inf = -std::numeric_limits<T>::infinity();
+  std::vector<T> delta(s.batches * s.lq);
+  parallelFor(s.batches * s.lq, 256, [&](int64_t begin, int64_t end) {
+    for (int64_t r = begin; r < end; ++r) {
+      delta[r] = dotN(dout + r * s.dv, out + r * s.dv, s.dv);
+    }
+  });
+  // Gradient of the score of query i against key j, given the probability.
+  auto scoreGrad = [&](int64_t b, int64_t i, int64_t j, T& p) {
+    const T l = lse[b * s.lq + i];
+    const T sc = attentionScore(q, k, mask, causal, scale, s, b, i, j);
+    p = l == neg_inf || sc == neg_inf ? T(0) : vexp(sc - l);
+    const T dp =
+        dotN(dout + (b * s.lq + i) * s.dv, v + (b * s.lk + j) * s.dv, s.dv);
+    return p * (dp - delta[b * s.lq + i]);
+  };
+
+  const int64_t k_blocks = (s.lk + kAttentionBlockK - 1) / kAttentionBlockK;
+  parallelFor(s.batches * k_blocks, 1, [&](int64_t begin, int64_t end) {
+    for (int64_t task = begin; task < end; ++task) {
+      const int64_t b = task / k_blocks;
+      const int64_t k0 = (task % k_blocks) * kAttentionBlockK;
+      const int64_t k1 = std::min(s.lk, k0 + kAttentionBlockK);
+      std::fill(dk + (b * s.lk + k0) * s.d, dk + (b * s.lk + k1) * s.d, T(0));
+      std::fill(
+          dv + (b * s.lk + k0) * s.dv, dv + (b * s.lk + k1) * s.dv, T(0));
+      for (int64_t i = causal ? k0 : 0; i < s.lq; ++i) {
+        const T* doi = dout + (b * s.lq + i) * s.dv;
+        const T* qi = q + (b * s.lq + i) * s.d;
+        for (int64_t j = k0; j < (causal ? std::min(k1, i + 1) : k1); ++j) {
+          T p;
+          const T ds = scoreGrad(b, i, j, p) * scale;
+          T* dvj = dv + (b * s.lk + j) * s.dv;
+          for (int64_t e = 0; e < s.dv; ++e) {
+            dvj[e] += p * doi[e];
+          }
+          T* dkj = dk + (b * s.lk + j) * s.d;
+          for (int64_t e = 0; e < s.d; ++e) {
+            dkj[e] += ds * qi[e];
+          }
+        }
+      }
+    }
+  });
+
+  const int64_t q_blocks = (s.lq + kAttentionBlockQ - 1) / kAttentionBlockQ;
+  parallelFor(s.batches * q_blocks, 1, [&](int64_t begin, int64_t end) {
+    for (int64_t task = begin; task < end; ++task) {
+      const int64_t b = task / q_blocks;
+      const int64_t q0 = (task % q_blocks) * kAttentionBlockQ;
+      const int64_t q1 = std::min(s.lq, q0 + kAttentionBlockQ);
+      for (int64_t k0 = 0; k0 < s.lk; k0 += kAttentionBlockK) {
+        const int64_t k1 = std::min(s.lk, k0 + kAttentionBlockK);
+        for (int64_t i = q0; i < q1; ++i) {
+          T* dqi = dq + (b * s.lq + i) * s.d;
+          if (k0 == 0) {
+            std::fill(dqi, dqi + s.d, T(0));
+          }
+          for (int64_t j = k0; j < (causal ? std::min(k1, i + 1) : k1); ++j) {
+            T p;
+            const T ds = scoreGrad(b, i, j, p) * scale;
+            const T* kj = k + (b * s.lk + j) * s.d;
+            for (int64_t e = 0; e < s.d; ++e) {
+              dqi[e] += ds * kj[e];
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+AttentionShape attentionShape(const fl::Tensor& q,
+                              const fl::Tensor& k,
+                              const fl::Tensor& v,
+                              const fl::Tensor* mask) {
+  if (q.ndim() < 2 || k.ndim() != q.ndim() || v.ndim() != q.ndim()) {
+    throw std::invalid_argument(
+        "fl_attention expects q, k and v with the same rank of at least 2");
+  }
+  AttentionShape s;
+  s.d = q.dim(0);
+  s.lq = q.dim(1);
+  s.lk = k.dim(1);
+  s.dv = v.dim(0);
+  s.batches = 1;
+  for (int i = 2; i < q.ndim(); ++i) {
+    if (k.dim(i) != q.dim(i) || v.dim(i) != q.dim(i)) {
+      throw std::invalid_argument("fl_attention batch dimensions do not match");
+    }
+    s.batches *= q.dim(i);
+  }
+  if (k.dim(0) != s.d || v.dim(1) != s.lk) {
+    throw std::invalid_argument("fl_attention head dimensions do not match");
+  }
+  s.mask_stride = 0;
+  if (mask) {
+    if (mask->elements() == s.batches * s.lq * s.lk) {
+      s.mask_stride = s.lq * s.lk;
+    } else if (mask->elements() != s.lq * s.lk) {
+      throw std::invalid_argument(
+          "fl_attention mask must be [Lq, Lk] or match the batch of q");
+    }
+  }
+  return s;
+}
+
+// Additive mask in the dtype of `like`. Boolean (b8) masks keep the positions
+// that are set and mask out the rest.
+fl::Tensor attentionMask(const fl::Tensor& mask,
+                         const fl::Tensor& like,
+                         const AttentionShape& s) {
+  std::vector<fl::Dim> dims = {s.lk, s.lq};
+  if (s.mask_stride) {
+    for (int i = 2; i < like.ndim(); ++i) {
+      dims.emplace_back(like.dim(i));
+    }
+  }
+  auto m = fl::reshape(mask, fl::Shape(dims));
+  if (m.type() == fl::dtype::b8) {
+    return fl::where(m, fl::full(m.shape(), 0, like.type()),
+                     -std::numeric_limits<double>::infinity());
+  }
+  return m.astype(like.type());
+}
+
+bool isHostAttention(const fl::Tensor& q,
+                     const fl::Tensor& k,
+                     const fl::Tensor& v,
+                     const fl::Tensor* mask) {
+  return isHostFloatTensor(q) && k.type() == q.type() && isHostTensor(k) &&
+         v.type() == q.type() && isHostTensor(v) &&
+         (!mask || isHostTensor(*mask));
+}
+
+// Causal mask over [Lk, Lq] scores for the materializing fallback path.
+fl::Tensor causalMask(const AttentionShape& s, fl::dtype type) {
+  const fl::Shape shape({s.lk, s.lq});
+  auto keys = fl::iota(fl::Shape({s.lk, 1}), fl::Shape({1, s.lq}));
+  auto queries = fl::iota(fl::Shape({1, s.lq}), fl::Shape({s.lk, 1}));
+  return fl::where(keys > queries,
+                   fl::full(shape, -std::numeric_limits<double>::infinity(),
+                            type),
+                   0.0);
+}
+
+// Per-query logsumexp of [Lk, Lq, B...] scores for the fallback path, keeping
+// dims. Fully masked queries give -inf, as on the host path, rather than the
+// NaN of subtracting an -inf max.
+fl::Tensor attentionLse(const fl::Tensor& scores) {
+  auto m = fl::amax(scores, {0}, true);
+  auto shift = fl::where(m > -std::numeric_limits<double>::infinity(), m, 0.0);
+  return shift + fl::log(fl::sum(fl::exp(scores - shift), {0}, true));
+}
+
+// Attention probabilities from scores and their logsumexp. Fully masked
+// queries (lse = -inf) get all-zero probabilities, so their output and
+// gradients are zero on both paths.
+fl::Tensor attentionProbs(const fl::Tensor& scores, const fl::Tensor& lse) {
+  auto shift =
+      fl::where(lse > -std::numeric_limits<double>::infinity(), lse, 0.0);
+  return fl::exp(scores - shift);
+}
+
+// Scaled dot-product attention softmax(q^T k / sqrt(D) + mask) v over
+// Flashlight-order q [D, Lq, B...], k [D, Lk, B...] and v [Dv, Lk, B...].
+// `lse` receives the per-query logsumexp, shaped [Lq, B...]. A query whose
+// keys are all masked out gets a zero output row and an lse of -inf.
+void attentionForward(const fl::Tensor& q,
+                      const fl::Tensor& k,
+                      const fl::Tensor& v,
+                      const fl::Tensor* mask,
+                      bool causal,
+                      fl::Tensor& out,
+                      fl::Tensor& lse) {
+  const auto s = attentionShape(q, k, v, mask);
+  const double scale = 1.0 / std::sqrt(static_cast<double>(s.d));
+  auto out_dims = q.shape().get();
+  out_dims[0] = s.dv;
+  const auto lse_shape = reducedShape(q.shape(), 0, false);
+  if (!isHostAttention(q, k, v, mask)) {
+    auto scores = fl::matmul(k, q, fl::MatrixProperty::Transpose) * scale;
+    if (mask) {
+      scores = scores + attentionMask(*mask, q, s);
+    }
+    if (causal) {
+      scores = scores + causalMask(s, scores.type());
+    }
+    lse = attentionLse(scores);
+    out = fl::matmul(v, attentionProbs(scores, lse));
+    lse = fl::reshape(lse, lse_shape);
+    return;
+  }
+  auto qc = contiguous(q);
+  auto kc = contiguous(k);
+  auto vc = contiguous(v);
+  auto mc = mask ? contiguous(attentionMask(*mask, q, s)) : fl::Tensor();
+  out = fl::Tensor(fl::Shape(out_dims), q.type());
+  lse = fl::Tensor(lse_shape, q.type());
+  dispatchFloat(q.type(), [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> qv(qc), kv(kc), vv(vc), ov(out), lv(lse);
+    HostView<T> mv(mask ? &mc : nullptr);
+    hostAttention(qv.data(), kv.data(), vv.data(), mv.data(), causal,
+                  static_cast<T>(scale), s, ov.data(), lv.data());
+  });
+}
+
+void attentionBackward(const fl::Tensor& grad,
+                       const fl::Tensor& q,
+                       const fl::Tensor& k,
+                       const fl::Tensor& v,
+                       const fl::Tensor* mask,
+                       const fl::Tensor& out,
+                       const fl::Tensor& lse,
+                       bool causal,
+                       fl::Tensor& dq,
+                       fl::Tensor& dk,
+                       fl::Tensor& dv) {
+  const auto s = attentionShape(q, k, v, mask);
+  const double scale = 1.0 / std::sqrt(static_cast<double>(s.d));
+  auto out_dims = q.shape().get();
+  out_dims[0] = s.dv;
+  const fl::Shape out_shape(out_dims);
+  if (out.shape() != out_shape || grad.shape() != out_shape ||
+      lse.shape() != reducedShape(q.shape(), 0, false)) {
+    throw std::invalid_argument(
+        "fl_attentionBackward expects grad and out shaped [Dv, Lq, B...] and "
+        "lse shaped [Lq, B...] as returned by fl_attention");
+  }
+  const bool host = isHostAttention(q, k, v, mask) &&
+                    grad.type() == q.type() && isHostTensor(grad) &&
+                    out.type() == q.type() && isHostTensor(out) &&
+                    lse.type() == q.type() && isHostTensor(lse);
+  if (!host) {
+    auto scores = fl::matmul(k, q, fl::MatrixProperty::Transpose) * scale;
+    if (mask) {
+      scores = scores + attentionMask(*mask, q, s);
+    }
+    if (causal) {
+      scores = scores + causalMask(s, scores.type());
+    }
+    auto l = fl::reshape(lse, reducedShape(q.shape(), 0, true));
+    auto p = attentionProbs(scores, l);
+    dv = fl::matmul(grad, p, fl::MatrixProperty::None,
+                    fl::MatrixProperty::Transpose);
+    auto dp = fl::matmul(v, grad, fl::MatrixProperty::Transpose);
+    auto ds = p * (dp - fl::sum(grad * out, {0}, true)) * scale;
+    dq = fl::matmul(k, ds);
+    dk = fl::matmul(q, ds, fl::MatrixProperty::None,
+                    fl::MatrixProperty::Transpose);
+    return;
+  }
+  auto gc = contiguous(grad);
+  auto qc = contiguous(q);
+  auto kc = contiguous(k);
+  auto vc = contiguous(v);
+  auto oc = contiguous(out);
+  auto lc = contiguous(lse);
+  auto mc = mask ? contiguous(attentionMask(*mask, q, s)) : fl::Tensor();
+  dq = fl::Tensor(q.shape(), q.type());
+  dk = fl::Tensor(k.shape(), q.type());
+  dv = fl::Tensor(v.shape(), q.type());
+  dispatchFloat(q.type(), [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> gv(gc), qv(qc), kv(kc), vv(vc), ov(oc), lv(lc);
+    HostView<T> mv(mask ? &mc : nullptr);
+    HostView<T> dqv(dq), dkv(dk), dvv(dv);
+    hostAttentionBackward(gv.data(), qv.data(), kv.data(), vv.data(),
+                          mv.data(), ov.data(), lv.data(), causal,
+                          static_cast<T>(scale), s, dqv.data(), dkv.data(),
+                          dvv.data());
+  });
+}
+
+// Embedding ids read back to host as int64. With `vocab` >= 0 they are range
+// checked against the table.
+std::vector<int64_t> embeddingIds(const fl::Tensor& ids, int64_t vocab) {
+  auto as_s64 = ids.type() == fl::dtype::s64 ? ids : ids.astype(fl::dtype::s64);
+  std::vector<int64_t> out(ids.elements());
+  if (!out.empty()) {
+    as_s64.host(out.data());
+  }
+  for (auto id : out) {
+    if (id < 0 || (vocab >= 0 && id >= vocab)) {
+      throw std::out_of_range("embedding id " + std::to_string(id) +
+                              " is out of range");
+    }
+  }
+  return out;
+}
+
+// Distinct ids in ascending order. The positions (into the flattened ids) that
+// reference unique[u] are positions[offsets[u]..offsets[u + 1]), in their
+// original order.
+struct IdSegments {
+  std::vector<int64_t> unique;
+  std::vector<int64_t> positions;
+  std::vector<int64_t> offsets;
+};
+
+IdSegments segmentIds(const std::vector<int64_t>& ids) {
+  const int64_t n = ids.size();
+  IdSegments s;
+  s.positions.resize(n);
+  radixSortRow(ids.data(), n, false, n >= 65536, s.positions.data());
+  for (int64_t i = 0; i < n; ++i) {
+    const int64_t id = ids[s.positions[i]];
+    if (s.unique.empty() || s.unique.back() != id) {
+      s.unique.emplace_back(id);
+      s.offsets.emplace_back(i);
+    }
+  }
+  s.offsets.emplace_back(n);
+  return s;
+}
+
+fl::Tensor idsTensor(const std::vector<int64_t>& ids) {
+  return fl::Tensor::fromBuffer(fl::Shape({static_cast<fl::Dim>(ids.size())}),
+                                ids.data(), fl::MemoryLocation::Host);
+}
+
+// Sums the columns of `rows` [dim, n] per segment into [dim, unique]. Host
+// float tensors add rows in position order. Elsewhere the columns are gathered
+// in segment order and each segment is the difference of f64 prefix sums at
+// its ends, so work and memory stay O(dim * n) however many ids are distinct.
+fl::Tensor segmentSum(const fl::Tensor& rows, const IdSegments& s) {
+  const int64_t dim = rows.dim(0);
+  const int64_t n = s.positions.size();
+  const int64_t u = s.unique.size();
+  if (!isHostFloatTensor(rows)) {
+    if (u == 0) {
+      return fl::Tensor(fl::Shape({dim, 0}), rows.type());
+    }
+    auto sorted = fl::reshape(rows, fl::Shape({dim, n}))(
+        fl::span, idsTensor(s.positions));
+    auto prefix = fl::concatenate(
+        {fl::full(fl::Shape({dim, 1}), 0.0, fl::dtype::f64),
+         fl::cumsum(sorted.astype(fl::dtype::f64), 1)},
+        1);
+    const std::vector<int64_t> first(s.offsets.begin(), s.offsets.end() - 1);
+    const std::vector<int64_t> last(s.offsets.begin() + 1, s.offsets.end());
+    return (prefix(fl::span, idsTensor(last)) -
+            prefix(fl::span, idsTensor(first)))
+        .astype(rows.type());
+  }
+  auto in = contiguous(rows);
+  fl::Tensor out(fl::Shape({dim, u}), in.type());
+  dispatchFloat(in.type(), [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> iv(in), ov(out);
+    const T* src = iv.data();
+    T* dst = ov.data();
+    parallelFor(u, std::max<int64_t>(1, 4096 / (dim + 1)),
+                [&](int64_t k0, int64_t k1) {
+                  for (int64_t k = k0; k < k1; ++k) {
+                    T* o = dst + k * dim;
+                    std::fill(o, o + dim, T(0));
+                    for (int64_t i = s.offsets[k]; i < s.offsets[k + 1]; ++i) {
+                      const T* r = src + s.positions[i] * dim;
+                      for (int64_t e = 0; e < dim; ++e) {
+                        o[e] += r[e];
+                      }
+                    }
+                  }
+                });
+  });
+  return out;
+}
+
+// Gathers rows of a row-major [vocab, dim] table (Flashlight [dim, vocab]) for
+// every id, giving [..., dim]. Host tables copy each row with one memcpy.
+fl::Tensor embedding(const fl::Tensor& table, const fl::Tensor& ids) {
+  if (table.ndim() != 2) {
+    throw std::invalid_argument("fl_embedding expects a 2D table");
+  }
+  const int64_t dim = table.dim(0);
+  const auto idv = embeddingIds(ids, table.dim(1));
+  std::vector<fl::Dim> dims = {dim};
+  for (int i = 0; i < ids.ndim(); ++i) {
+    dims.emplace_back(ids.dim(i));
+  }
+  if (!isHostTensor(table)) {
+    return fl::reshape(table(fl::span, idsTensor(idv)), fl::Shape(dims));
+  }
+  auto t = contiguous(table);
+  fl::Tensor out(fl::Shape(dims), t.type());
+  const size_t row_bytes = dim * fl::getTypeSize(t.type());
+  HostView<char> tv(t), ov(out);
+  const char* src = tv.data();
+  char* dst = ov.data();
+  parallelFor(idv.size(), std::max<int64_t>(1, 65536 / (row_bytes + 1)),
+              [&](int64_t begin, int64_t end) {
+                for (int64_t i = begin; i < end; ++i) {
+                  std::memcpy(dst + i * row_bytes, src + idv[i] * row_bytes,
+                              row_bytes);
+                }
+              });
+  return out;
+}
+
+// Sparse embedding gradient: the distinct ids (int64, ascending) and their
+// summed gradient rows [dim, unique].
+fl::Tensor embeddingBackward(const fl::Tensor& grad,
+                             const fl::Tensor& ids,
+                             fl::Tensor& rows) {
+  const int64_t n = ids.elements();
+  const int64_t dim = n ? grad.elements() / n : 0;
+  if (grad.dim(0) != dim || dim * n != grad.elements()) {
+    throw std::invalid_argument(
+        "fl_embeddingBackward gradient does not match the ids");
+  }
+  const auto segments = segmentIds(embeddingIds(ids, -1));
+  rows = segmentSum(fl::reshape(grad, fl::Shape({dim, n})), segments);
+  return idsTensor(segments.unique);
+}
+
+// table[ids[i]] += alpha * rows[i] in place, touching only the referenced rows.
+// Repeated ids accumulate.
+void embeddingUpdate(fl::Tensor& table,
+                     const fl::Tensor& ids,
+                     const fl::Tensor& rows,
+                     double alpha) {
+  if (table.ndim() != 2) {
+    throw std::invalid_argument("fl_embeddingUpdate expects a 2D table");
+  }
+  const int64_t dim = table.dim(0);
+  const int64_t n = ids.elements();
+  if (rows.elements() != dim * n || (n && rows.dim(0) != dim)) {
+    throw std::invalid_argument("fl_embeddingUpdate rows do not match the ids");
+  }
+  const auto segments = segmentIds(embeddingIds(ids, table.dim(1)));
+  const auto flat_rows = fl::reshape(rows, fl::Shape({dim, n}));
+  const bool host = isHostFloatTensor(table) && table.isContiguous() &&
+                    rows.type() == table.type() && isHostTensor(rows);
+  if (!host) {
+    auto summed = segmentSum(flat_rows, segments) * alpha;
+    table(fl::span, idsTensor(segments.unique)) += summed.astype(table.type());
+    return;
+  }
+  auto r = contiguous(flat_rows);
+  detachShared(&table);
+  dispatchFloat(table.type(), [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> tv(table), rv(r);
+    T* dst = tv.data();
+    const T* src = rv.data();
+    const T a = static_cast<T>(alpha);
+    const int64_t u = segments.unique.size();
+    parallelFor(u, std::max<int64_t>(1, 4096 / (dim + 1)),
+                [&](int64_t k0, int64_t k1) {
+                  for (int64_t k = k0; k < k1; ++k) {
+                    T* o = dst + segments.unique[k] * dim;
+                    for (int64_t i = segments.offsets[k];
+                         i < segments.offsets[k + 1];
+                         ++i) {
+                      const T* x = src + segments.positions[i] * dim;
+                      for (int64_t e = 0; e < dim; ++e) {
+                        o[e] += a * x[e];
+                      }
+                    }
+                  }
+                });
+  });
+}
+
+// One parameter's tensors for a fused optimizer update, e.g. {param, grad, m,
+// v}. Optional state may be null. All entries have the parameter's shape.
+using TensorGroup = std::vector<fl::Tensor*>;
+
+bool isHostGroup(const TensorGroup& group, fl::dtype type) {
+  for (auto* t : group) {
+    if (t && (t->type() != type || !isHostTensor(*t) || !t->isContiguous())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Applies an in-place elementwise update to every group in one call. Host
+// groups of each float dtype are cut into fixed-size chunks that are spread
+// over the pool together, and kernel(ptrs, n) runs on one chunk with `ptrs`
+// pointing at its first element in each tensor. The remaining groups go
+// through fallback(group), which uses tensor ops. The kernel and fallback may
+// return a double partial (e.g. a sum of squares); partials are added in chunk
+// order, so the returned total does not depend on the thread count.
+template <typename Kernel, typename Fallback>
+double multiTensorApply(const std::vector<TensorGroup>& groups,
+                        Kernel&& kernel,
+                        Fallback&& fallback) {
+  constexpr int64_t kChunk = 1 << 16;
+  for (const auto& group : groups) {
+    if (group.empty() || !group[0]) {
+      throw std::invalid_argument("null parameter handle in tensor list");
+    }
+    for (auto* t : group) {
+      if (t && t->elements() != group[0]->elements()) {
+        throw std::invalid_argument(
+            "optimizer state does not match its parameter's shape");
+      }
+    }
+  }
+  for (const auto& group : groups) {
+    for (auto* t : group) {
+      detachShared(t);
+    }
+  }
+  struct Chunk {
+    size_t group;
+    int64_t offset;
+    int64_t size;
+  };
+  std::vector<bool> done(groups.size(), false);
+  double total = 0;
+  for (auto type : {fl::dtype::f32, fl::dtype::f64}) {
+    dispatchFloat(type, [&](auto tag) {
+      using T = decltype(tag);
+      std::vector<std::unique_ptr<HostView<T>>> views;
+      std::vector<std::vector<T*>> ptrs;
+      std::vector<Chunk> chunks;
+      for (size_t i = 0; i < groups.size(); ++i) {
+        if (!isHostGroup(groups[i], type)) {
+          continue;
+        }
+        std::vector<T*> group_ptrs;
+        for (auto* t : groups[i]) {
+          views.emplace_back(std::make_unique<HostView<T>>(t));
+          group_ptrs.emplace_back(views.back()->data());
+        }
+        const int64_t n = groups[i][0]->elements();
+        for (int64_t off = 0; off < n; off += kChunk) {
+          chunks.push_back({ptrs.size(), off, std::min(kChunk, n - off)});
+        }
+        ptrs.emplace_back(std::move(group_ptrs));
+        done[i] = true;
+      }
+      std::vector<double> partials(chunks.size(), 0);
+      parallelFor(chunks.size(), 1, [&](int64_t begin, int64_t end) {
+        std::vector<T*> local;
+        for (int64_t c = begin; c < end; ++c) {
+          local = ptrs[chunks[c].group];
+          for (auto& p : local) {
+            p = p ? p + chunks[c].offset : nullptr;
+          }
+          using R = decltype(kernel(local.data(), 0));
+          if constexpr (std::is_void<R>::value) {
+            kernel(local.data(), chunks[c].size);
+          } else {
+            partials[c] = kernel(local.data(), chunks[c].size);
+          }
+        }
+      });
+      for (auto partial : partials) {
+        total += partial;
+      }
+    });
+  }
+  for (size_t i = 0; i < groups.size(); ++i) {
+    if (done[i]) {
+      continue;
+    }
+    if constexpr (std::is_void<decltype(fallback(groups[i]))>::value) {
+      fallback(groups[i]);
+    } else {
+      total += fallback(groups[i]);
+    }
+  }
+  return total;
+}
+
+struct AdamOptions {
+  double lr;
+  double beta1;
+  double beta2;
+  double eps;
+  double weight_decay;
+  double step; // 1-based step count used for bias correction
+  bool decoupled; // AdamW-style weight decay
+};
+
+// Adam/AdamW over {param, grad, m, v} groups. Weight decay is added to the
+// gradient for Adam and applied to the parameter directly for AdamW.
+void adamStep(const std::vector<TensorGroup>& groups, const AdamOptions& o) {
+  if (!(o.lr >= 0) || !std::isfinite(o.lr) || !(o.beta1 >= 0 && o.beta1 < 1) ||
+      !(o.beta2 >= 0 && o.beta2 < 1) || !(o.eps >= 0) ||
+      !std::isfinite(o.eps) || !(o.weight_decay >= 0) ||
+      !std::isfinite(o.weight_decay) || !(o.step >= 1) ||
+      !std::isfinite(o.step)) {
+    throw std::invalid_argument(
+        "fl_adamStep expects lr, eps and weight_decay >= 0, betas in [0, 1) "
+        "and step >= 1");
+  }
+  for (const auto& group : groups) {
+    if (group.size() != 4 || !group[1] || !group[2] || !group[3]) {
+      throw std::invalid_argument(
+          "fl_adamStep expects a parameter, gradient and both moments");
+    }
+  }
+  const double step_size = o.lr / (1 - std::pow(o.beta1, o.step));
+  const double inv_sqrt_bc2 = 1 / std::sqrt(1 - std::pow(o.beta2, o.step));
+  const double l2 = o.decoupled ? 0 : o.weight_decay;
+  const double decay = o.decoupled ? 1 - o.lr * o.weight_decay : 1;
+  multiTensorApply(
+      groups,
+      [&](auto* const* ptrs, int64_t n) {
+        using T =
+            std::remove_pointer_t<std::remove_reference_t<decltype(*ptrs)>>;
+        T* p = ptrs[0];
+        const T* g = ptrs[1];
+        T* m = ptrs[2];
+        T* v = ptrs[3];
+        const T b1 = o.beta1, b2 = o.beta2, eps = o.eps;
+        const T tl2 = l2, tdecay = decay, tstep = step_size;
+        const T tbc2 = inv_sqrt_bc2;
+        for (int64_t i = 0; i < n; ++i) {
+          const T gi = g[i] + tl2 * p[i];
+          const T mi = b1 * m[i] + (1 - b1) * gi;
+          const T vi = b2 * v[i] + (1 - b2) * gi * gi;
+          m[i] = mi;
+          v[i] = vi;
+          p[i] = p[i] * tdecay - tstep * mi / (std::sqrt(vi) * tbc2 + eps);
+        }
+      },
+      [&](const TensorGroup& group) {
+        auto& p = *group[0];
+        auto& m = *group[2];
+        auto& v = *group[3];
+        auto g = l2 ? *group[1] + p * l2 : *group[1];
+        m = m * o.beta1 + g * (1 - o.beta1);
+        v = v * o.beta2 + g * g * (1 - o.beta2);
+        p = p * decay - m * step_size / (fl::sqrt(v) * inv_sqrt_bc2 + o.eps);
+      });
+}
+
+struct SgdOptions {
+  double lr;
+  double momentum;
+  double dampening;
+  double weight_decay;
+  bool nesterov;
+};
+
+// SGD over {param, grad, momentum buffer} groups. The buffer may be null when
+// momentum is 0; buffers start from zero.
+void sgdStep(const std::vector<TensorGroup>& groups, const SgdOptions& o) {
+  multiTensorApply(
+      groups,
+      [&](auto* const* ptrs, int64_t n) {
+        using T =
+            std::remove_pointer_t<std::remove_reference_t<decltype(*ptrs)>>;
+        T* p = ptrs[0];
+        const T* g = ptrs[1];
+        T* buf = ptrs[2];
+        const T lr = o.lr, wd = o.weight_decay, mu = o.momentum;
+        const T damp = 1 - o.dampening;
+        if (!buf) {
+          for (int64_t i = 0; i < n; ++i) {
+            p[i] -= lr * (g[i] + wd * p[i]);
+          }
+          return;
+        }
+        const T nesterov = o.nesterov ? 1 : 0;
+        for (int64_t i = 0; i < n; ++i) {
+          const T gi = g[i] + wd * p[i];
+          const T bi = mu * buf[i] + damp * gi;
+          buf[i] = bi;
+          p[i] -= lr * (nesterov * (gi + mu * bi) + (1 - nesterov) * bi);
+        }
+      },
+      [&](const TensorGroup& group) {
+        auto& p = *group[0];
+        auto g = o.weight_decay ? *group[1] + p * o.weight_decay : *group[1];
+        if (group[2]) {
+          auto& buf = *group[2];
+          buf = buf * o.momentum + g * (1 - o.dampening);
+          g = o.nesterov ? g + buf * o.momentum : buf;
+        }
+        p = p - g * o.lr;
+      });
+}
+
+// Scales gradient groups in place so their combined L2 norm is at most
+// `max_norm` and returns the norm before clipping. Non-finite norms leave the
+// gradients untouched.
+double clipByGlobalNorm(const std::vector<TensorGroup>& grads,
+                        double max_norm) {
+  const double norm = std::sqrt(multiTensorApply(
+      grads,
+      [](auto* const* ptrs, int64_t n) {
+        const auto* g = ptrs[0];
+        double acc = 0;
+        for (int64_t i = 0; i < n; ++i) {
+          acc += static_cast<double>(g[i]) * g[i];
+        }
+        return acc;
+      },
+      [](const TensorGroup& group) {
+        auto g = group[0]->astype(fl::dtype::f64);
+        return fl::sum(g * g).asScalar<double>();
+      }));
+  if (!std::isfinite(norm) || norm <= max_norm) {
+    return norm;
+  }
+  const double scale = max_norm / (norm + 1e-6);
+  multiTensorApply(
+      grads,
+      [&](auto* const* ptrs, int64_t n) {
+        using T =
+            std::remove_pointer_t<std::remove_reference_t<decltype(*ptrs)>>;
+        T* g = ptrs[0];
+        const T s = scale;
+        for (int64_t i = 0; i < n; ++i) {
+          g[i] *= s;
+        }
+      },
+      [&](const TensorGroup& group) { *group[0] = *group[0] * scale; });
+  return norm;
+}
+
+// Zips pointer arrays of tensor handles (as taken by `fl_concatenate`) into
+// per-parameter groups. A null array leaves that slot empty in every group.
+std::vector<TensorGroup> tensorGroups(
+    const std::vector<const void*>& arrays,
+    int64_t len) {
+  std::vector<TensorGroup> groups(len, TensorGroup(arrays.size(), nullptr));
+  for (size_t a = 0; a < arrays.size(); ++a) {
+    if (!arrays[a]) {
+      continue;
+    }
+    const auto* handles = reinterpret_cast<const int64_t*>(arrays[a]);
+    for (int64_t i = 0; i < len; ++i) {
+      groups[i][a] = reinterpret_cast<fl::Tensor*>(handles[i]);
+    }
+  }
+  for (const auto& group : groups) {
+    for (size_t a = 0; a < arrays.size(); ++a) {
+      if (arrays[a] && !group[a]) {
+        throw std::invalid_argument("null tensor handle in tensor list");
+      }
+    }
+  }
+  return groups;
+}
+
+// Philox4x32-10 counter-based generator. Element i of a fill draws from block
+// `offset + i / per_block`, so values depend only on the seed and the position
+// and not on how the work is split across threads.
+struct Philox {
+  static void block(uint64_t seed, uint64_t counter, uint32_t out[4]) {
+    uint32_t c0 = static_cast<uint32_t>(counter);
+    uint32_t c1 = static_cast<uint32_t>(counter >> 32);
+    uint32_t c2 = 0;
+    uint32_t c3 = 0;
+    uint32_t k0 = static_cast<uint32_t>(seed);
+    uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+    for (int round = 0; round < 10; ++round) {
+      const uint64_t p0 = uint64_t(0xD2511F53) * c0;
+      const uint64_t p1 = uint64_t(0xCD9E8D57) * c2;
+      const uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+      const uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+      c1 = static_cast<uint32_t>(p1);
+      c3 = static_cast<uint32_t>(p0);
+      c0 = n0;
+      c2 = n2;
+      k0 += 0x9E3779B9;
+      k1 += 0xBB67AE85;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+  }
+};
+
+// Seeded generator handle. Each fill reserves the blocks it uses, so fills
+// from one generator never overlap even when issued concurrently.
+struct Rng {
+  explicit Rng(uint64_t s) : seed(s), offset(0) {}
+  uint64_t seed;
+  std::atomic<uint64_t> offset;
+};
+
+// Uniform [0, 1) from the 24 (float) or 53 (double) high bits.
+inline float unitUniform(const uint32_t* lanes, float) {
+  return (lanes[0] >> 8) * (1.0f / 16777216.0f);
+}
+
+inline double unitUniform(const uint32_t* lanes, double) {
+  const uint64_t bits = (uint64_t(lanes[0]) << 32) | lanes[1];
+  return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Fills `n` values with uniform [0, 1) or, when `normal` is set, standard
+// normal draws (Box-Muller over pairs of uniforms within a block).
+template <typename T>
+void hostRandom(Rng& rng, T* out, int64_t n, bool normal) {
+  constexpr int64_t kLanes = sizeof(T) / sizeof(uint32_t);
+  constexpr int64_t kPerBlock = 4 / kLanes;
+  const int64_t blocks = (n + kPerBlock - 1) / kPerBlock;
+  const uint64_t first = rng.offset.fetch_add(blocks);
+  parallelFor(blocks, 4096, [&](int64_t begin, int64_t end) {
+    uint32_t lanes[4];
+    T u[kPerBlock];
+    for (int64_t b = begin; b < end; ++b) {
+      Philox::block(rng.seed, first + b, lanes);
+      for (int64_t j = 0; j < kPerBlock; ++j) {
+        u[j] = unitUniform(lanes + j * kLanes, T{});
+      }
+      if (normal) {
+        for (int64_t j = 0; j < kPerBlock; j += 2) {
+          const T r = std::sqrt(T(-2) * std::log(T(1) - u[j]));
+          const T theta = T(6.283185307179586) * u[j + 1];
+          u[j] = r * std::cos(theta);
+          u[j + 1] = r * std::sin(theta);
+        }
+      }
+      const int64_t base = b * kPerBlock;
+      for (int64_t j = 0; j < kPerBlock && base + j < n; ++j) {
+        out[base + j] = u[j];
+      }
+    }
+  });
+}
+
+// Fills `t` in place, keeping its shape, dtype and storage. Contiguous host
+// float tensors are written directly; others are generated in float32 on host
+// and assigned through a flat index.
+void randomInto(Rng& rng, fl::Tensor& t, bool normal) {
+  detachShared(&t);
+  if (isHostFloatTensor(t) && t.isContiguous()) {
+    dispatchFloat(t.type(), [&](auto tag) {
+      using T = decltype(tag);
+      HostView<T> view(t);
+      hostRandom(rng, view.data(), t.elements(), normal);
+    });
+    return;
+  }
+  const int64_t n = t.elements();
+  if (n == 0) {
+    return;
+  }
+  std::vector<float> values(n);
+  hostRandom(rng, values.data(), n, normal);
+  t.flat(fl::span) = fl::Tensor::fromBuffer(fl::Shape({n}), values.data(),
+                                            fl::MemoryLocation::Host)
+                         .astype(t.type());
+}
+
+// Dropout over `n` elements, eight at a time so that every mask byte has one
+// writer. Element i keeps when its Philox lane is at least `threshold` (p *
+// 2^32), which sets bit i % 8 of bits[i / 8]. `x` and `y` may be null to only
+// draw the mask.
+template <typename T>
+void hostDropout(Rng& rng,
+                 const T* x,
+                 T* y,
+                 uint8_t* bits,
+                 int64_t n,
+                 double p) {
+  const uint64_t threshold = static_cast<uint64_t>(p * 4294967296.0);
+  const T scale = p < 1 ? static_cast<T>(1 / (1 - p)) : T(0);
+  const int64_t groups = (n + 7) / 8;
+  const uint64_t first = rng.offset.fetch_add(2 * groups);
+  parallelFor(groups, 2048, [&](int64_t begin, int64_t end) {
+    uint32_t lanes[8];
+    for (int64_t g = begin; g < end; ++g) {
+      Philox::block(rng.seed, first + 2 * g, lanes);
+      Philox::block(rng.seed, first + 2 * g + 1, lanes + 4);
+      const int64_t base = g * 8;
+      const int64_t count = std::min<int64_t>(8, n - base);
+      uint8_t byte = 0;
+      for (int64_t j = 0; j < count; ++j) {
+        const bool keep = lanes[j] >= threshold;
+        byte |= static_cast<uint8_t>(keep) << j;
+        if (x) {
+          y[base + j] = keep ? x[base + j] * scale : T(0);
+        }
+      }
+      bits[g] = byte;
+    }
+  });
+}
+
+// y = x * mask * scale for a bit-packed mask.
+template <typename T>
+void hostApplyBitMask(const T* x,
+                      const uint8_t* bits,
+                      T* y,
+                      int64_t n,
+                      T scale) {
+  parallelFor(n, 16384, [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; ++i) {
+      y[i] = (bits[i >> 3] >> (i & 7)) & 1 ? x[i] * scale : T(0);
+    }
+  });
+}
+
+// Expands a bit-packed mask to a 0/1 tensor of `type` for the non-host paths.
+fl::Tensor unpackBitMask(const std::vector<uint8_t>& bits,
+                         const fl::Shape& shape,
+                         fl::dtype type) {
+  std::vector<float> mask(shape.elements());
+  for (size_t i = 0; i < mask.size(); ++i) {
+    mask[i] = (bits[i >> 3] >> (i & 7)) & 1;
+  }
+  return fl::Tensor::fromBuffer(shape, mask.data(), fl::MemoryLocation::Host)
+      .astype(type);
+}
+
+fl::Shape bitMaskShape(int64_t n) {
+  return fl::Shape({(n + 7) / 8});
+}
+
+// Zeroes each element of `x` with probability `p` and scales the survivors by
+// 1 / (1 - p), drawing the mask from `rng` inside the same pass. The mask is
+// written bit-packed to `mask` as u8 [ceil(n / 8)].
+fl::Tensor dropout(const fl::Tensor& x, double p, Rng& rng, fl::Tensor& mask) {
+  if (p < 0 || p > 1) {
+    throw std::invalid_argument("dropout probability must be in [0, 1]");
+  }
+  const int64_t n = x.elements();
+  const auto mask_shape = bitMaskShape(n);
+  if (!isHostFloatTensor(x)) {
+    // Bits are drawn on the host and uploaded; `mask` may live on a device.
+    std::vector<uint8_t> bits(mask_shape.elements());
+    hostDropout<float>(rng, nullptr, nullptr, bits.data(), n, p);
+    mask = fl::Tensor::fromBuffer(
+        mask_shape, bits.data(), fl::MemoryLocation::Host);
+    const double scale = p < 1 ? 1 / (1 - p) : 0;
+    return x * unpackBitMask(bits, x.shape(), x.type()) * scale;
+  }
+  auto in = contiguous(x);
+  fl::Tensor out(in.shape(), in.type());
+  mask = fl::Tensor(mask_shape, fl::dtype::u8);
+  std::vector<uint8_t> staged;
+  std::unique_ptr<HostView<uint8_t>> mv;
+  uint8_t* bits;
+  if (isHostTensor(mask)) {
+    mv = std::make_unique<HostView<uint8_t>>(mask);
+    bits = mv->data();
+  } else {
+    staged.resize(mask_shape.elements());
+    bits = staged.data();
+  }
+  dispatchFloat(in.type(), [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> iv(in), ov(out);
+    hostDropout(rng, iv.data(), ov.data(), bits, n, p);
+  });
+  if (!mv) {
+    mask = fl::Tensor::fromBuffer(
+        mask_shape, staged.data(), fl::MemoryLocation::Host);
+  }
+  return out;
+}
+
+fl::Tensor dropoutBackward(const fl::Tensor& grad,
+                           const fl::Tensor& mask,
+                           double p) {
+  const int64_t n = grad.elements();
+  if (mask.elements() != (n + 7) / 8 || mask.type() != fl::dtype::u8) {
+    throw std::invalid_argument(
+        "fl_dropoutBackward expects the bit mask of fl_dropout");
+  }
+  const double scale = p < 1 ? 1 / (1 - p) : 0;
+  if (!isHostFloatTensor(grad) || !isHostTensor(mask)) {
+    std::vector<uint8_t> bits(mask.elements());
+    if (!bits.empty()) {
+      mask.host(bits.data());
+    }
+    return grad * unpackBitMask(bits, grad.shape(), grad.type()) * scale;
+  }
+  auto g = contiguous(grad);
+  auto m = contiguous(mask);
+  fl::Tensor out(g.shape(), g.type());
+  dispatchFloat(g.type(), [&](auto tag) {
+    using T = decltype(tag);
+    HostView<T> gv(g), ov(out);
+    HostView<uint8_t> mv(m);
+    hostApplyBitMask(gv.data(), mv.data(), ov.data(), n, static_cast<T>(scale));
+  });
+  return out;
+}
+
+// Opt-in memoization of constant creation ops (fl_full, fl_identity,
+// fl_arange, fl_iota), keyed by op, shape, dtype and values. Hits hand out new
+// handles sharing the cached storage; the least recently used entries are
+// evicted once the cached bytes exceed the cap.
+class ConstantCache {
+ public:
+  static ConstantCache& get() {
+    static ConstantCache cache;
+    return cache;
+  }
+
+  void configure(bool enabled, int64_t max_bytes) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    enabled_ = enabled;
+    max_bytes_ = enabled ? max_bytes : 0;
+    evict();
+  }
+
+  // Returns the cached tensor for `key`, creating it with make() on a miss.
+  // `shared` reports whether the result shares storage with the cache.
+  template <typename F>
+  fl::Tensor lookup(const std::string& key, bool& shared, F&& make) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    shared = false;
+    if (!enabled_) {
+      lock.unlock();
+      return make();
+    }
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      ++hits_;
+      entries_.splice(entries_.begin(), entries_, it->second);
+      shared = true;
+      return it->second->second;
+    }
+    ++misses_;
+    lock.unlock();
+    auto t = make();
+    lock.lock();
+    if (!enabled_ || static_cast<int64_t>(t.bytes()) > max_bytes_ ||
+        index_.count(key)) {
+      return t;
+    }
+    entries_.emplace_front(key, t);
+    index_[key] = entries_.begin();
+    bytes_ += t.bytes();
+    evict();
+    shared = true;
+    return t;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    entries_.clear();
+    index_.clear();
+    bytes_ = 0;
+  }
+
+  // {hits, misses, cached bytes, entries}
+  void stats(int64_t* out) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    out[0] = hits_;
+    out[1] = misses_;
+    out[2] = bytes_;
+    out[3] = entries_.size();
+  }
+
+ private:
+  using Entry = std::pair<std::string, fl::Tensor>;
+
+  void evict() {
+    while (!entries_.empty() && bytes_ > max_bytes_) {
+      bytes_ -= entries_.back().second.bytes();
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+  std::mutex mutex_;
+  bool enabled_ = false;
+  int64_t max_bytes_ = 0;
+  int64_t bytes_ = 0;
+  int64_t hits_ = 0;
+  int64_t misses_ = 0;
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+std::string constantKey(const char* op,
+                        fl::dtype type,
+                        const std::vector<long long>& dims,
+                        const std::vector<double>& values) {
+  std::ostringstream key;
+  key.precision(17);
+  key << op << ':' << static_cast<int>(type) << ':';
+  for (auto d : dims) {
+    key << d << ',';
+  }
+  key << ':';
+  for (auto v : values) {
+    key << v << ',';
+  }
+  return key.str();
+}
+
+// Creates a constant through the cache. Handles that share cached storage are
+// registered so in-place host writes detach them first.
+template <typename F>
+fl::Tensor* constantHandle(const std::string& key, F&& make) {
+  bool shared = false;
+  auto t = ConstantCache::get().lookup(key, shared, std::forward<F>(make));
+  g_bytes_used += t.bytes();
+  auto* handle = new fl::Tensor(t);
+  if (shared) {
+    markShared(handle);
+  }
+  return handle;
+}
+
+// Copies every input into its slice of `out` along `axis`, where input i spans
+// lens[i] (1 when stacking) and otherwise matches `out`. Tasks are (input,
+// outer slice) pairs, so large and many-input cases both spread over the pool.
+void hostConcatInto(const TensorSpan& inputs,
+                    const std::vector<int64_t>& lens,
+                    unsigned axis,
+                    fl::Tensor& out) {
+  const int64_t n = inputs.size();
+  const auto layout = axisLayout(out.shape(), axis);
+  const int64_t elem = fl::getTypeSize(out.type());
+  std::vector<int64_t> offsets(n + 1, 0);
+  for (int64_t i = 0; i < n; ++i) {
+    offsets[i + 1] = offsets[i] + lens[i];
+  }
+  std::vector<std::unique_ptr<HostView<char>>> views;
+  views.reserve(n);
+  for (int64_t i = 0; i < n; ++i) {
+    views.emplace_back(std::make_unique<HostView<char>>(inputs[i]));
+  }
+  HostView<char> ov(out);
+  char* dst = ov.data();
+  const int64_t slice_bytes = layout.inner * elem;
+  const int64_t avg_bytes =
+      out.bytes() / std::max<int64_t>(1, n * layout.outer);
+  parallelFor(n * layout.outer, std::max<int64_t>(1, 65536 / (avg_bytes + 1)),
+              [&](int64_t begin, int64_t end) {
+                for (int64_t t = begin; t < end; ++t) {
+                  const int64_t i = t / layout.outer;
+                  const int64_t o = t % layout.outer;
+                  const int64_t bytes = lens[i] * slice_bytes;
+                  std::memcpy(
+                      dst + (o * layout.len + offsets[i]) * slice_bytes,
+                      views[i]->data() + o * bytes,
+                      bytes);
+                }
+              });
+}
+
+// Whether every input can be copied directly: same dtype, contiguous on host
+// and, apart from `axis` when concatenating, the same shape as the first.
+bool isHostConcat(const TensorSpan& inputs, unsigned axis, bool stacking) {
+  const auto& first = inputs[0];
+  if (!isHostTensor(first) ||
+      (!stacking && static_cast<int>(axis) >= first.ndim())) {
+    return false;
+  }
+  for (int64_t i = 0; i < inputs.size(); ++i) {
+    const auto& t = inputs[i];
+    if (t.type() != first.type() || !isHostTensor(t) || !t.isContiguous() ||
+        t.ndim() != first.ndim()) {
+      return false;
+    }
+    for (int d = 0; d < t.ndim(); ++d) {
+      if ((stacking || d != static_cast<int>(axis)) &&
+          t.dim(d) != first.dim(d)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+fl::Tensor concatenate(const TensorSpan& inputs, unsigned axis) {
+  if (inputs.size() == 0) {
+    throw std::invalid_argument("fl_concatenate expects at least one tensor");
+  }
+  if (!isHostConcat(inputs, axis, false)) {
+    return fl::concatenate(inputs.toVector(), axis);
+  }
+  auto dims = inputs[0].shape().get();
+  std::vector<int64_t> lens(inputs.size());
+  dims[axis] = 0;
+  for (int64_t i = 0; i < inputs.size(); ++i) {
+    lens[i] = inputs[i].dim(axis);
+    dims[axis] += lens[i];
+  }
+  fl::Tensor out(fl::Shape(dims), inputs[0].type());
+  hostConcatInto(inputs, lens, axis, out);
+  return out;
+}
+
+// Stacks same-shape inputs along a new dimension inserted at `axis`.
+fl::Tensor stack(const TensorSpan& inputs, unsigned axis) {
+  if (inputs.size() == 0) {
+    throw std::invalid_argument("fl_stack expects at least one tensor");
+  }
+  auto dims = inputs[0].shape().get();
+  if (axis > dims.size()) {
+    throw std::invalid_argument("fl_stack axis is out of range");
+  }
+  auto item_dims = dims;
+  item_dims.insert(item_dims.begin() + axis, 1);
+  dims.insert(dims.begin() + axis, inputs.size());
+  if (!isHostConcat(inputs, axis, true)) {
+    std::vector<fl::Tensor> items;
+    items.reserve(inputs.size());
+    for (int64_t i = 0; i < inputs.size(); ++i) {
+      items.emplace_back(fl::reshape(inputs[i], fl::Shape(item_dims)));
+    }
+    return fl::concatenate(items, axis);
+  }
+  fl::Tensor out(fl::Shape(dims), inputs[0].type());
+  hostConcatInto(inputs, std::vector<int64_t>(inputs.size(), 1), axis, out);
+  return out;
+}
+
+// Minimal JSON reader for checkpoint headers: objects, arrays, strings,
+// integers and literals, which is all a safetensors-style header contains.
+class JsonReader {
+ public:
+  JsonReader(const char* begin, const char* end) : p_(begin), end_(end) {}
+
+  bool consume(char c) {
+    skipSpace();
+    if (p_ < end_ && *p_ == c) {
+      ++p_;
+      return true;
+    }
+    return false;
+  }
+
+  void expect(char c) {
+    if (!consume(c)) {
+      throw std::runtime_error(std::string("malformed checkpoint header: "
+                                           "expected '") +
+                               c + "'");
+    }
+  }
+
+  std::string string() {
+    expect('"');
+    std::string out;
+    while (p_ < end_ && *p_ != '"') {
+      char c = *p_++;
+      if (c == '\\' && p_ < end_) {
+        c = *p_++;
+        if (c == 'n') {
+          c = '\n';
+        } else if (c == 't') {
+          c = '\t';
+        } else if (c == 'u') {
+          // Names are written with \u escapes only for control characters.
+          if (end_ - p_ < 4) {
+            break;
+          }
+          c = static_cast<char>(std::stoi(std::string(p_, 4), nullptr, 16));
+          p_ += 4;
+        }
+      }
+      out += c;
+    }
+    expect('"');
+    return out;
+  }
+
+  int64_t integer() {
+    skipSpace();
+    char* num_end = nullptr;
+    const long long v = std::strtoll(p_, &num_end, 10);
+    if (num_end == p_) {
+      throw std::runtime_error("malformed checkpoint header: expected number");
+    }
+    p_ = num_end;
+    return v;
+  }
+
+  std::vector<int64_t> integers() {
+    std::vector<int64_t> out;
+    expect('[');
+    if (!consume(']')) {
+      do {
+        out.emplace_back(integer());
+      } while (consume(','));
+      expect(']');
+    }
+    return out;
+  }
+
+  void skipValue() {
+    skipSpace();
+    if (p_ >= end_) {
+      throw std::runtime_error("truncated checkpoint header");
+    }
+    if (*p_ == '"') {
+      string();
+    } else if (*p_ == '{' || *p_ == '[') {
+      const char close = *p_ == '{' ? '}' : ']';
+      const bool object = *p_ == '{';
+      ++p_;
+      if (consume(close)) {
+        return;
+      }
+      do {
+        if (object) {
+          string();
+          expect(':');
+        }
+        skipValue();
+      } while (consume(','));
+      expect(close);
+    } else {
+      while (p_ < end_ && *p_ != ',' && *p_ != '}' && *p_ != ']') {
+        ++p_;
+      }
+    }
+  }
+
+ private:
+  void skipSpace() {
+    while (p_ < end_ && std::isspace(static_cast<unsigned char>(*p_))) {
+      ++p_;
+    }
+  }
+
+  const char* p_;
+  const char* end_;
+};
+
+std::string jsonEscape(const std::string& s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+// Safetensors dtype names.
+const char* checkpointDtypeName(fl::dtype type) {
+  switch (type) {
+    case fl::dtype::f16:
+      return "F16";
+    case fl::dtype::f32:
+      return "F32";
+    case fl::dtype::f64:
+      return "F64";
+    case fl::dtype::b8:
+      return "BOOL";
+    case fl::dtype::s16:
+      return "I16";
+    case fl::dtype::s32:
+      return "I32";
+    case fl::dtype::s64:
+      return "I64";
+    case fl::dtype::u8:
+      return "U8";
+    case fl::dtype::u16:
+      return "U16";
+    case fl::dtype::u32:
+      return "U32";
+    case fl::dtype::u64:
+      return "U64";
+  }
+  throw std::invalid_argument("unsupported checkpoint dtype");
+}
+
+// I8 maps to b8, the one-byte carrier used for int8 data.
+fl::dtype checkpointDtype(const std::string& name) {
+  static const std::unordered_map<std::string, fl::dtype> types = {
+      {"F16", fl::dtype::f16}, {"F32", fl::dtype::f32},
+      {"F64", fl::dtype::f64}, {"BOOL", fl::dtype::b8},
+      {"I8", fl::dtype::b8},   {"I16", fl::dtype::s16},
+      {"I32", fl::dtype::s32}, {"I64", fl::dtype::s64},
+      {"U8", fl::dtype::u8},   {"U16", fl::dtype::u16},
+      {"U32", fl::dtype::u32}, {"U64", fl::dtype::u64}};
+  auto it = types.find(name);
+  if (it == types.end()) {
+    throw std::runtime_error("unsupported checkpoint dtype " + name);
+  }
+  return it->second;
+}
+
+// Tensor from raw bytes in Flashlight (column-major) order. Host tensors are
+// filled with a parallel copy; other backends upload through `fromBuffer`.
+fl::Tensor tensorFromBytes(const fl::Shape& shape,
+                           fl::dtype type,
+                           const char* data) {
+  fl::Tensor out(shape, type);
+  if (isHostTensor(out)) {
+    HostView<char> view(out);
+    char* dst = view.data();
+    constexpr int64_t kBlock = 1 << 20;
+    const int64_t bytes = out.bytes();
+    parallelFor((bytes + kBlock - 1) / kBlock, 1, [&](int64_t b0, int64_t b1) {
+      const int64_t begin = b0 * kBlock;
+      const int64_t end = std::min(bytes, b1 * kBlock);
+      std::memcpy(dst + begin, data + begin, end - begin);
+    });
+    return out;
+  }
+  const auto loc = fl::MemoryLocation::Host;
+  switch (type) {
+    case fl::dtype::f32:
+      return fl::Tensor::fromBuffer(shape, (const float*)data, loc);
+    case fl::dtype::f64:
+      return fl::Tensor::fromBuffer(shape, (const double*)data, loc);
+    case fl::dtype::b8:
+      return fl::Tensor::fromBuffer(shape, (const char*)data, loc);
+    case fl::dtype::s16:
+      return fl::Tensor::fromBuffer(shape, (const int16_t*)data, loc);
+    case fl::dtype::s32:
+      return fl::Tensor::fromBuffer(shape, (const int32_t*)data, loc);
+    case fl::dtype::s64:
+      return fl::Tensor::fromBuffer(shape, (const int64_t*)data, loc);
+    case fl::dtype::u8:
+      return fl::Tensor::fromBuffer(shape, (const uint8_t*)data, loc);
+    case fl::dtype::u16:
+      return fl::Tensor::fromBuffer(shape, (const uint16_t*)data, loc);
+    case fl::dtype::u32:
+      return fl::Tensor::fromBuffer(shape, (const uint32_t*)data, loc);
+    case fl::dtype::u64:
+      return fl::Tensor::fromBuffer(shape, (const uint64_t*)data, loc);
+    default:
+      throw std::invalid_argument("unsupported dtype for a device upload");
+  }
+}
+
+// Splits `len` bytes of NUL-separated names.
+std::vector<std::string> nulSeparated(const void* ptr, int64_t len) {
+  const char* cstr = reinterpret_cast<const char*>(ptr);
+  std::vector<std::string> out;
+  for (int64_t i = 0; i < len; ++i) {
+    const int64_t start = i;
+    while (i < len && cstr[i] != '\0') {
+      ++i;
+    }
+    out.emplace_back(cstr + start, i - start);
+  }
+  return out;
+}
+
+// Reflected CRC-32 with polynomial `Poly`, slicing-by-8. `combine` joins the
+// CRCs of adjacent blocks so large tensors can be checksummed in parallel
+// chunks.
+template <uint32_t Poly>
+class ReflectedCrc32 {
+ public:
+  static uint32_t extend(uint32_t crc, const char* data, size_t n) {
+    const auto& t = tables();
+    const auto* p = reinterpret_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (; n >= 8; n -= 8, p += 8) {
+      uint64_t v;
+      std::memcpy(&v, p, 8);
+      v ^= crc;
+      crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^
+          t[4][(v >> 24) & 0xff] ^ t[3][(v >> 32) & 0xff] ^
+          t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+    }
+    for (; n > 0; --n, ++p) {
+      crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+  }
+
+  // CRC of A followed by B, given crc(A), crc(B) and the length of B.
+  static uint32_t combine(uint32_t crc1, uint32_t crc2, int64_t len2) {
+    if (len2 <= 0) {
+      return crc1;
+    }
+    uint32_t even[32];
+    uint32_t odd[32];
+    odd[0] = kPoly;
+    for (int n = 1; n < 32; ++n) {
+      odd[n] = 1u << (n - 1);
+    }
+    square(even, odd);
+    square(odd, even);
+    do {
+      square(even, odd);
+      if (len2 & 1) {
+        crc1 = times(even, crc1);
+      }
+      len2 >>= 1;
+      if (!len2) {
+        break;
+      }
+      square(odd, even);
+      if (len2 & 1) {
+        crc1 = times(odd, crc1);
+      }
+      len2 >>= 1;
+    } while (len2);
+    return crc1 ^ crc2;
+  }
+
+ private:
+  static constexpr uint32_t kPoly = Poly;
+
+  using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+  static const Tables& tables() {
+    static const Tables t = [] {
+      Tables t;
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+          c = c & 1 ? (c >> 1) ^ kPoly : c >> 1;
+        }
+        t[0][i] = c;
+      }
+      for (int k = 1; k < 8; ++k) {
+        for (int i = 0; i < 256; ++i) {
+          t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+      }
+      return t;
+    }();
+    return t;
+  }
+
+  static uint32_t times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    for (int i = 0; vec; vec >>= 1, ++i) {
+      if (vec & 1) {
+        sum ^= mat[i];
+      }
+    }
+    return sum;
+  }
+
+  static void square(uint32_t* out, const uint32_t* mat) {
+    for (int n = 0; n < 32; ++n) {
+      out[n] = times(mat, mat[n]);
+    }
+  }
+};
+
+using Crc32c = ReflectedCrc32<0x82F63B78>; // Castagnoli, for checkpoints
+using Crc32 = ReflectedCrc32<0xEDB88320>; // IEEE, for zip archives
+
+// A byte range of one tensor, the unit of parallel checkpoint I/O.
+struct IoChunk {
+  size_t tensor;
+  int64_t offset;
+  int64_t size;
+};
+
+std::vector<IoChunk> ioChunks(const std::vector<int64_t>& sizes) {
+  constexpr int64_t kChunk = 4 << 20;
+  std::vector<IoChunk> chunks;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    for (int64_t off = 0; off < sizes[i]; off += kChunk) {
+      chunks.push_back({i, off, std::min(kChunk, sizes[i] - off)});
+    }
+  }
+  return chunks;
+}
+
+// Per-tensor CRC32C from per-chunk CRCs, combined in chunk order.
+std::vector<uint32_t> combineChunkCrcs(size_t num_tensors,
+                                       const std::vector<IoChunk>& chunks,
+                                       const std::vector<uint32_t>& crcs) {
+  std::vector<uint32_t> out(num_tensors, 0);
+  for (size_t c = 0; c < chunks.size(); ++c) {
+    auto& crc = out[chunks[c].tensor];
+    crc = Crc32c::combine(crc, crcs[c], chunks[c].size);
+  }
+  return out;
+}
+
+// Header and data offsets of a checkpoint: an 8-byte little-endian header
+// length, a JSON header of {name: {dtype, shape, data_offsets[, crc32c]}} and
+// the raw data. Shapes are row-major (reversed Flashlight dims), so the bytes
+// read like safetensors. The header is padded so that data begins on a 64-byte
+// boundary, and each tensor's offset is rounded up to 64 bytes so mapped
+// tensors stay aligned. CRCs are fixed-width hex, so the header length does not
+// depend on them.
+struct CheckpointLayout {
+  std::string header;
+  std::vector<int64_t> offsets;
+  int64_t data_start;
+  int64_t total_size;
+};
+
+// `Tensors` is a TensorSpan or a vector of tensors.
+template <typename Tensors>
+CheckpointLayout checkpointLayout(const std::vector<std::string>& names,
+                                  const Tensors& tensors,
+                                  const std::vector<uint32_t>* crcs) {
+  constexpr int64_t kAlign = 64;
+  const int64_t n = tensors.size();
+  if (static_cast<int64_t>(names.size()) != n) {
+    throw std::invalid_argument("expected one name per tensor");
+  }
+  CheckpointLayout layout;
+  std::ostringstream header;
+  header << '{';
+  layout.offsets.resize(n);
+  int64_t offset = 0;
+  for (int64_t i = 0; i < n; ++i) {
+    const auto& t = tensors[i];
+    offset = (offset + kAlign - 1) / kAlign * kAlign;
+    layout.offsets[i] = offset;
+    header << (i ? "," : "") << '"' << jsonEscape(names[i]) << "\":{\"dtype\":\""
+           << checkpointDtypeName(t.type()) << "\",\"shape\":[";
+    for (int d = t.ndim() - 1; d >= 0; --d) {
+      header << t.dim(d) << (d ? "," : "");
+    }
+    header << "],\"data_offsets\":[" << offset << ','
+           << offset + static_cast<int64_t>(t.bytes()) << ']';
+    if (crcs) {
+      char hex[9];
+      std::snprintf(hex, sizeof(hex), "%08x", (*crcs)[i]);
+      header << ",\"crc32c\":\"" << hex << '"';
+    }
+    header << '}';
+    offset += t.bytes();
+  }
+  header << '}';
+  layout.header = header.str();
+  layout.header.append(
+      (kAlign - (8 + layout.header.size()) % kAlign) % kAlign, ' ');
+  layout.data_start = 8 + layout.header.size();
+  layout.total_size = layout.data_start + offset;
+  return layout;
+}
+
+std::string checkpointPrefix(const CheckpointLayout& layout) {
+  std::string out(8, '\0');
+  for (int b = 0; b < 8; ++b) {
+    out[b] = static_cast<char>(uint64_t(layout.header.size()) >> (8 * b));
+  }
+  return out + layout.header;
+}
+
+void saveCheckpoint(const std::string& filename,
+                    const std::vector<std::string>& names,
+                    const TensorSpan& tensors) {
+  const auto layout = checkpointLayout(names, tensors, nullptr);
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("cannot open " + filename + " for writing");
+  }
+  const auto prefix = checkpointPrefix(layout);
+  out.write(prefix.data(), prefix.size());
+  int64_t written = 0;
+  std::vector<char> staging;
+  for (int64_t i = 0; i < tensors.size(); ++i) {
+    const auto& t = tensors[i];
+    const std::string pad(layout.offsets[i] - written, '\0');
+    out.write(pad.data(), pad.size());
+    if (isHostTensor(t) && t.isContiguous()) {
+      HostView<char> view(t);
+      out.write(view.data(), t.bytes());
+    } else {
+      staging.resize(t.bytes());
+      if (!staging.empty()) {
+        contiguous(t).host(staging.data());
+      }
+      out.write(staging.data(), staging.size());
+    }
+    written = layout.offsets[i] + t.bytes();
+  }
+  if (!out) {
+    throw std::runtime_error("failed to write " + filename);
+  }
+}
+
+void pwriteAll(int fd, const char* data, int64_t size, int64_t offset) {
+  while (size > 0) {
+    const auto n = ::pwrite(fd, data, size, offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("write failed: ") +
+                               std::strerror(errno));
+    }
+    data += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+// Tensor bytes ready to be written without further tensor ops: host data is
+// read in place through a view, device or strided tensors are staged copies.
+// `tensors` holds handles that share storage with the caller's tensors, so the
+// bytes stay valid (copy-on-write) after the caller moves on.
+struct BundleSnapshot {
+  std::vector<std::string> names;
+  std::vector<fl::Tensor> tensors;
+  std::vector<std::unique_ptr<HostView<char>>> views;
+  std::vector<std::vector<char>> staged;
+  std::vector<const char*> data;
+  std::vector<int64_t> sizes;
+
+  int64_t bytes() const {
+    int64_t total = 0;
+    for (auto size : sizes) {
+      total += size;
+    }
+    return total;
+  }
+};
+
+// Tensor ops happen here, on the calling thread.
+BundleSnapshot snapshotBundle(std::vector<std::string> names,
+                              const TensorSpan& tensors) {
+  const int64_t n = tensors.size();
+  if (static_cast<int64_t>(names.size()) != n) {
+    throw std::invalid_argument("expected one name per tensor");
+  }
+  BundleSnapshot s;
+  s.names = std::move(names);
+  s.tensors = tensors.toVector();
+  s.views.resize(n);
+  s.staged.resize(n);
+  s.data.resize(n);
+  s.sizes.resize(n);
+  for (int64_t i = 0; i < n; ++i) {
+    const auto& t = s.tensors[i];
+    s.sizes[i] = t.bytes();
+    if (isHostTensor(t) && t.isContiguous()) {
+      s.views[i] = std::make_unique<HostView<char>>(t);
+      s.data[i] = s.views[i]->data();
+    } else {
+      s.staged[i].resize(s.sizes[i]);
+      if (s.sizes[i]) {
+        contiguous(t).host(s.staged[i].data());
+      }
+      s.data[i] = s.staged[i].data();
+    }
+  }
+  return s;
+}
+
+// Syncs the directory holding `filename` so a rename into it is durable.
+void syncParentDirectory(const std::string& filename) {
+  const auto slash = filename.rfind('/');
+  const auto dir = slash == std::string::npos ? std::string(".")
+      : slash == 0                             ? std::string("/")
+                                               : filename.substr(0, slash);
+  const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    throw std::runtime_error("cannot open directory " + dir);
+  }
+  const int rc = ::fsync(fd);
+  ::close(fd);
+  if (rc != 0) {
+    throw std::runtime_error("cannot sync directory " + dir);
+  }
+}
+
+// Checkpoint with a CRC32C per tensor, written with chunked pwrites to a
+// unique temporary file next to `filename` that is synced once, renamed over
+// it, and followed by a sync of the directory. Chunks go through the thread
+// pool when `parallel` is set.
+void writeBundle(const std::string& filename,
+                 const BundleSnapshot& s,
+                 bool parallel) {
+  const size_t n = s.tensors.size();
+  const std::vector<uint32_t> placeholder_crcs(n, 0);
+  auto layout = checkpointLayout(s.names, s.tensors, &placeholder_crcs);
+  std::string tmp = filename + ".XXXXXX";
+  const int fd = ::mkstemp(&tmp[0]);
+  if (fd < 0) {
+    throw std::runtime_error("cannot create a temporary file for " + filename);
+  }
+  try {
+    if (::fchmod(fd, 0644) != 0 || ::ftruncate(fd, layout.total_size) != 0) {
+      throw std::runtime_error("cannot resize " + tmp);
+    }
+    const auto chunks = ioChunks(s.sizes);
+    std::vector<uint32_t> chunk_crcs(chunks.size());
+    auto write_chunks = [&](int64_t begin, int64_t end) {
+      for (int64_t c = begin; c < end; ++c) {
+        const auto& chunk = chunks[c];
+        const char* src = s.data[chunk.tensor] + chunk.offset;
+        chunk_crcs[c] = Crc32c::extend(0, src, chunk.size);
+        pwriteAll(fd, src, chunk.size,
+                  layout.data_start + layout.offsets[chunk.tensor] +
+                      chunk.offset);
+      }
+    };
+    if (parallel) {
+      parallelFor(chunks.size(), 1, write_chunks);
+    } else {
+      write_chunks(0, chunks.size());
+    }
+    const auto crcs = combineChunkCrcs(n, chunks, chunk_crcs);
+    layout = checkpointLayout(s.names, s.tensors, &crcs);
+    const auto prefix = checkpointPrefix(layout);
+    pwriteAll(fd, prefix.data(), prefix.size(), 0);
+    if (::fsync(fd) != 0) {
+      throw std::runtime_error("cannot sync " + tmp);
+    }
+  } catch (...) {
+    ::close(fd);
+    ::unlink(tmp.c_str());
+    throw;
+  }
+  ::close(fd);
+  if (::rename(tmp.c_str(), filename.c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    throw std::runtime_error("cannot rename " + tmp + " to " + filename);
+  }
+  syncParentDirectory(filename);
+}
+
+void saveBundle(const std::string& filename,
+                const std::vector<std::string>& names,
+                const TensorSpan& tensors) {
+  writeBundle(filename, snapshotBundle(names, tensors), true);
+}
+
+// Completion state of one background save.
+struct SaveJob {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  std::exception_ptr error;
+};
+
+// Writes bundle snapshots on one background thread, in submission order.
+// `submit` blocks while queued and in-progress snapshots hold more than the
+// byte limit, so a slow disk throttles the producer instead of letting
+// snapshots pile up; a snapshot larger than the limit waits for an idle
+// writer. A limit of 0 disables throttling. Pending saves are finished at exit.
+class AsyncSaver {
+ public:
+  static AsyncSaver& get() {
+    static AsyncSaver saver;
+    return saver;
+  }
+
+  void setLimit(int64_t bytes) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      limit_ = bytes;
+    }
+    space_cv_.notify_all();
+  }
+
+  std::shared_ptr<SaveJob> submit(std::string filename,
+                                  BundleSnapshot snapshot) {
+    auto job = std::make_shared<SaveJob>();
+    const int64_t bytes = snapshot.bytes();
+    std::unique_lock<std::mutex> lock(mutex_);
+    space_cv_.wait(lock, [&] {
+      return limit_ <= 0 || in_flight_ == 0 || in_flight_ + bytes <= limit_;
+    });
+    in_flight_ += bytes;
+    queue_.push_back({std::move(filename), std::move(snapshot), bytes, job});
+    if (!worker_.joinable()) {
+      worker_ = std::thread([this] { loop(); });
+    }
+    cv_.notify_one();
+    return job;
+  }
+
+ private:
+  struct Task {
+    std::string filename;
+    BundleSnapshot snapshot;
+    int64_t bytes;
+    std::shared_ptr<SaveJob> job;
+  };
+
+  AsyncSaver() = default;
+
+  ~AsyncSaver() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+      worker_.join();
+    }
+  }
+
+  void loop() {
+    while (true) {
+      Task task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          return;
+        }
+        task = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      std::exception_ptr error;
+      try {
+        writeBundle(task.filename, task.snapshot, false);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      // Drop the views and shared storage before admitting more snapshots.
+      task.snapshot = BundleSnapshot();
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        in_flight_ -= task.bytes;
+      }
+      space_cv_.notify_all();
+      {
+        std::lock_guard<std::mutex> guard(task.job->mutex);
+        task.job->done = true;
+        task.job->error = std::move(error);
+      }
+      task.job->cv.notify_all();
+    }
+  }
+
+  std::thread worker_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable space_cv_;
+  std::list<Task> queue_;
+  int64_t in_flight_ = 0;
+  int64_t limit_ = int64_t(1) << 31;
+  bool stop_ = false;
+};
+
+// A whole file mapped read-only.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename) {
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("cannot open " + filename);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("cannot stat " + filename);
+    }
+    size_ = st.st_size;
+    if (size_ == 0) {
+      ::close(fd);
+      return;
+    }
+    void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      throw std::runtime_error("cannot map " + filename);
+    }
+    data_ = static_cast<const char*>(addr);
+  }
+
+  ~MappedFile() {
+    if (data_) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Unsigned little-endian integer of `bytes` bytes at `p`.
+uint64_t littleEndian(const char* p, int bytes) {
+  uint64_t v = 0;
+  for (int b = 0; b < bytes; ++b) {
+    v |= uint64_t(static_cast<uint8_t>(p[b])) << (8 * b);
+  }
+  return v;
+}
+
+// Bytes held by a tensor with `dims` and `item`-byte elements, or -1 if a
+// dimension is negative or the size does not fit in int64_t.
+template <typename Dims>
+int64_t checkedBytes(const Dims& dims, int64_t item) {
+  int64_t bytes = item;
+  for (auto d : dims) {
+    if (d < 0 || (d > 0 && bytes > std::numeric_limits<int64_t>::max() / d)) {
+      return -1;
+    }
+    bytes *= d;
+  }
+  return bytes;
+}
+
+// A checkpoint file mapped read-only. Opening parses only the header, so its
+// cost does not grow with the data size; tensors are copied out of the
+// mapping on first access, unless `preload` already read them all.
+class MappedCheckpoint {
+ public:
+  struct Entry {
+    fl::dtype type;
+    std::vector<fl::Dim> dims; // Flashlight order
+    int64_t begin;
+    int64_t end;
+    bool has_crc;
+    uint32_t crc;
+  };
+
+  explicit MappedCheckpoint(const std::string& filename)
+      : file_(filename), base_(file_.data()), size_(file_.size()) {
+    if (size_ < 8) {
+      throw std::runtime_error(filename + " is not a checkpoint");
+    }
+    parseHeader();
+  }
+
+  const std::vector<std::string>& names() const {
+    return names_;
+  }
+
+  // `shared` is set when the result shares storage with a preloaded tensor.
+  fl::Tensor load(const std::string& name, bool& shared) const {
+    auto loaded = loaded_.find(name);
+    shared = loaded != loaded_.end();
+    if (shared) {
+      return loaded->second;
+    }
+    auto it = entries_.find(name);
+    if (it == entries_.end()) {
+      throw std::out_of_range("no tensor named " + name + " in checkpoint");
+    }
+    const auto& e = it->second;
+    return tensorFromBytes(fl::Shape(e.dims), e.type, data_ + e.begin);
+  }
+
+  // Reads every tensor with parallel chunked copies out of the mapping,
+  // verifying CRC32C checksums on the way when the header has them.
+  void preload() {
+    const size_t n = names_.size();
+    std::vector<const Entry*> entries(n);
+    std::vector<int64_t> sizes(n);
+    std::vector<fl::Tensor> tensors(n);
+    std::vector<std::unique_ptr<HostView<char>>> views(n);
+    for (size_t i = 0; i < n; ++i) {
+      entries[i] = &entries_.at(names_[i]);
+      sizes[i] = entries[i]->end - entries[i]->begin;
+      tensors[i] = fl::Tensor(fl::Shape(entries[i]->dims), entries[i]->type);
+      if (isHostTensor(tensors[i])) {
+        views[i] = std::make_unique<HostView<char>>(tensors[i]);
+      }
+    }
+    if (size_ > 8) {
+      ::madvise(const_cast<char*>(base_), size_, MADV_WILLNEED);
+    }
+    const auto chunks = ioChunks(sizes);
+    std::vector<uint32_t> chunk_crcs(chunks.size());
+    parallelFor(chunks.size(), 1, [&](int64_t begin, int64_t end) {
+      for (int64_t c = begin; c < end; ++c) {
+        const auto& chunk = chunks[c];
+        const auto* e = entries[chunk.tensor];
+        const char* src = data_ + e->begin + chunk.offset;
+        if (e->has_crc) {
+          chunk_crcs[c] = Crc32c::extend(0, src, chunk.size);
+        }
+        if (views[chunk.tensor]) {
+          std::memcpy(
+              views[chunk.tensor]->data() + chunk.offset, src, chunk.size);
+        }
+      }
+    });
+    const auto crcs = combineChunkCrcs(n, chunks, chunk_crcs);
+    views.clear();
+    for (size_t i = 0; i < n; ++i) {
+      const auto* e = entries[i];
+      if (e->has_crc && crcs[i] != e->crc) {
+        throw std::runtime_error("checksum mismatch for " + names_[i]);
+      }
+      if (!isHostTensor(tensors[i])) {
+        tensors[i] = tensorFromBytes(fl::Shape(e->dims), e->type,
+                                     data_ + e->begin);
+      }
+      loaded_[names_[i]] = tensors[i];
+    }
+  }
+
+ private:
+  void parseHeader() {
+    const uint64_t header_len = littleEndian(base_, 8);
+    if (header_len > size_ - 8) {
+      throw std::runtime_error("checkpoint header is truncated");
+    }
+    data_ = base_ + 8 + header_len;
+    const int64_t data_size = size_ - 8 - header_len;
+    JsonReader r(base_ + 8, data_);
+    r.expect('{');
+    if (r.consume('}')) {
+      return;
+    }
+    do {
+      auto name = r.string();
+      r.expect(':');
+      if (name == "__metadata__") {
+        r.skipValue();
+        continue;
+      }
+      if (entries_.count(name)) {
+        throw std::runtime_error("duplicate tensor " + name + " in checkpoint");
+      }
+      Entry e{fl::dtype::f32, {}, -1, -1, false, 0};
+      bool has_dtype = false;
+      bool has_shape = false;
+      r.expect('{');
+      if (!r.consume('}')) {
+        do {
+          auto key = r.string();
+          r.expect(':');
+          if (key == "dtype") {
+            e.type = checkpointDtype(r.string());
+            has_dtype = true;
+          } else if (key == "shape") {
+            auto shape = r.integers();
+            e.dims.assign(shape.rbegin(), shape.rend());
+            has_shape = true;
+          } else if (key == "data_offsets") {
+            auto offsets = r.integers();
+            if (offsets.size() != 2) {
+              throw std::runtime_error("malformed data_offsets for " + name);
+            }
+            e.begin = offsets[0];
+            e.end = offsets[1];
+          } else if (key == "crc32c") {
+            const auto hex = r.string();
+            if (hex.empty() || hex.size() > 8 ||
+                hex.find_first_not_of("0123456789abcdefABCDEF") !=
+                    std::string::npos) {
+              throw std::runtime_error("malformed crc32c for " + name);
+            }
+            e.crc = std::stoul(hex, nullptr, 16);
+            e.has_crc = true;
+          } else {
+            r.skipValue();
+          }
+        } while (r.consume(','));
+        r.expect('}');
+      }
+      if (!has_dtype || !has_shape) {
+        throw std::runtime_error("missing dtype or shape for " + name);
+      }
+      const int64_t bytes = checkedBytes(
+          e.dims, static_cast<int64_t>(fl::getTypeSize(e.type)));
+      if (bytes < 0) {
+        throw std::runtime_error("invalid shape for " + name);
+      }
+      if (e.begin < 0 || e.begin > e.end || e.end > data_size ||
+          e.end - e.begin != bytes) {
+        throw std::runtime_error("invalid data offsets for " + name);
+      }
+      names_.emplace_back(name);
+      entries_.emplace(std::move(name), std::move(e));
+    } while (r.consume(','));
+    r.expect('}');
+  }
+
+  MappedFile file_;
+  const char* base_;
+  size_t size_;
+  const char* data_ = nullptr;
+  std::vector<std::string> names_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::unordered_map<std::string, fl::Tensor> loaded_;
+};
+
+// NumPy type string for `type`, e.g. "<f4". b8 is stored as bool.
+std::string npyDescr(fl::dtype type) {
+  switch (type) {
+    case fl::dtype::f16:
+      return "<f2";
+    case fl::dtype::f32:
+      return "<f4";
+    case fl::dtype::f64:
+      return "<f8";
+    case fl::dtype::b8:
+      return "|b1";
+    case fl::dtype::s16:
+      return "<i2";
+    case fl::dtype::s32:
+      return "<i4";
+    case fl::dtype::s64:
+      return "<i8";
+    case fl::dtype::u8:
+      return "|u1";
+    case fl::dtype::u16:
+      return "<u2";
+    case fl::dtype::u32:
+      return "<u4";
+    case fl::dtype::u64:
+      return "<u8";
+  }
+  throw std::invalid_argument("unsupported npy dtype");
+}
+
+// Little-endian (or byte-sized) NumPy types only; i1 maps to b8, the int8
+// carrier.
+fl::dtype npyDtype(const std::string& descr) {
+  static const std::unordered_map<std::string, fl::dtype> types = {
+      {"f2", fl::dtype::f16}, {"f4", fl::dtype::f32}, {"f8", fl::dtype::f64},
+      {"b1", fl::dtype::b8},  {"i1", fl::dtype::b8},  {"i2", fl::dtype::s16},
+      {"i4", fl::dtype::s32}, {"i8", fl::dtype::s64}, {"u1", fl::dtype::u8},
+      {"u2", fl::dtype::u16}, {"u4", fl::dtype::u32}, {"u8", fl::dtype::u64}};
+  auto it = descr.size() == 3 ? types.find(descr.substr(1)) : types.end();
+  const bool little = descr[0] == '<' || descr[0] == '=' || descr[0] == '|';
+  if (it == types.end() || (!little && fl::getTypeSize(it->second) > 1)) {
+    throw std::runtime_error("unsupported npy dtype " + descr);
+  }
+  return it->second;
+}
+
+// Type, Flashlight dims and data range of one .npy array. C-order arrays get
+// reversed dims and Fortran-order arrays keep theirs, so the bytes are used
+// as they are; an array whose order differs from the g_row_major setting reads
+// as its transpose rather than being copied into the other order.
+struct NpyArray {
+  fl::dtype type;
+  std::vector<fl::Dim> dims;
+  int64_t offset;
+  int64_t bytes;
+};
+
+// Position just past `key`'s colon in a .npy header dict, or npos.
+size_t npyKey(const std::string& header, const std::string& key) {
+  for (char quote : {'\'', '"'}) {
+    auto pos = header.find(quote + key + quote);
+    if (pos != std::string::npos) {
+      pos = header.find(':', pos + key.size() + 2);
+      return pos == std::string::npos ? pos : pos + 1;
+    }
+  }
+  return std::string::npos;
+}
+
+NpyArray parseNpy(const char* data, int64_t size) {
+  if (size < 10 || std::memcmp(data, "\x93NUMPY", 6) != 0) {
+    throw std::runtime_error("not a .npy file");
+  }
+  const int len_bytes = data[6] == 1 ? 2 : 4;
+  const int64_t header_start = 8 + len_bytes;
+  if (size < header_start) {
+    throw std::runtime_error(".npy header is truncated");
+  }
+  const int64_t header_len = littleEndian(data + 8, len_bytes);
+  if (header_start + header_len > size) {
+    throw std::runtime_error(".npy header is truncated");
+  }
+  const std::string header(data + header_start, header_len);
+  const auto descr_pos = npyKey(header, "descr");
+  const auto order_pos = npyKey(header, "fortran_order");
+  const auto shape_pos = npyKey(header, "shape");
+  if (descr_pos == std::string::npos || order_pos == std::string::npos ||
+      shape_pos == std::string::npos) {
+    throw std::runtime_error("malformed .npy header");
+  }
+  const auto descr_begin = header.find_first_of("'\"", descr_pos);
+  if (descr_begin == std::string::npos) {
+    throw std::runtime_error("malformed .npy dtype");
+  }
+  const auto descr_end = header.find(header[descr_begin], descr_begin + 1);
+  if (descr_end == std::string::npos) {
+    throw std::runtime_error("malformed .npy dtype");
+  }
+  NpyArray a;
+  a.type = npyDtype(
+      header.substr(descr_begin + 1, descr_end - descr_begin - 1));
+  const auto order = header.find_first_not_of(' ', order_pos);
+  const bool fortran = header.compare(order, 4, "True") == 0;
+  std::vector<fl::Dim> shape;
+  auto pos = header.find('(', shape_pos);
+  const auto shape_end = header.find(')', pos);
+  if (pos == std::string::npos || shape_end == std::string::npos) {
+    throw std::runtime_error("malformed .npy shape");
+  }
+  for (++pos; pos < shape_end; ++pos) {
+    if (std::isdigit(static_cast<unsigned char>(header[pos]))) {
+      size_t used = 0;
+      shape.push_back(std::stoll(header.substr(pos), &used));
+      pos += used - 1;
+    } else if (header[pos] != ',' && header[pos] != ' ') {
+      throw std::runtime_error("malformed .npy shape");
+    }
+  }
+  if (fortran) {
+    a.dims = shape;
+  } else {
+    a.dims.assign(shape.rbegin(), shape.rend());
+  }
+  a.offset = header_start + header_len;
+  a.bytes = checkedBytes(shape, static_cast<int64_t>(fl::getTypeSize(a.type)));
+  if (a.bytes < 0) {
+    throw std::runtime_error("malformed .npy shape");
+  }
+  if (a.bytes > size - a.offset) {
+    throw std::runtime_error(".npy data is truncated");
+  }
+  return a;
+}
+
+fl::Tensor npyTensor(const char* data, int64_t size) {
+  const auto a = parseNpy(data, size);
+  return tensorFromBytes(fl::Shape(a.dims), a.type, data + a.offset);
+}
+
+// Magic, version and header dict for `t`, padded so the data starts on a
+// 64-byte boundary. The order follows g_row_major, so the file reads back
+// with the same shape in NumPy.
+std::string npyPrefix(const fl::Tensor& t) {
+  std::ostringstream dict;
+  dict << "{'descr': '" << npyDescr(t.type()) << "', 'fortran_order': "
+       << (g_row_major ? "False" : "True") << ", 'shape': (";
+  for (int i = 0; i < t.ndim(); ++i) {
+    dict << t.dim(g_row_major ? t.ndim() - 1 - i : i)
+         << (i + 1 < t.ndim() || t.ndim() == 1 ? "," : "")
+         << (i + 1 < t.ndim() ? " " : "");
+  }
+  dict << "), }";
+  auto header = dict.str();
+  const int len_bytes = header.size() + 64 < 65536 ? 2 : 4;
+  const size_t unpadded = 8 + len_bytes + header.size() + 1;
+  header.append((64 - unpadded % 64) % 64, ' ');
+  header += '\n';
+  std::string out("\x93NUMPY", 6);
+  out += static_cast<char>(len_bytes == 2 ? 1 : 2);
+  out += '\0';
+  for (int b = 0; b < len_bytes; ++b) {
+    out += static_cast<char>(uint64_t(header.size()) >> (8 * b));
+  }
+  return out + header;
+}
+
+void saveNpy(const std::string& filename, const fl::Tensor& t) {
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("cannot open " + filename + " for writing");
+  }
+  const auto prefix = npyPrefix(t);
+  out.write(prefix.data(), prefix.size());
+  if (isHostTensor(t) && t.isContiguous()) {
+    HostView<char> view(t);
+    out.write(view.data(), t.bytes());
+  } else {
+    std::vector<char> staging(t.bytes());
+    if (!staging.empty()) {
+      contiguous(t).host(staging.data());
+    }
+    out.write(staging.data(), staging.size());
+  }
+  if (!out) {
+    throw std::runtime_error("failed to write " + filename);
+  }
+}
+
+// An uncompressed (stored) .npz archive mapped read-only. Opening reads the
+// zip central directory and each array's .npy header; data is copied out of
+// the mapping when a tensor is requested. Names drop the ".npy" suffix.
+class NpzArchive {
+ public:
+  explicit NpzArchive(const std::string& filename) : file_(filename) {
+    parseDirectory();
+  }
+
+  const std::vector<std::string>& names() const {
+    return names_;
+  }
+
+  fl::Tensor load(const std::string& name) const {
+    auto it = entries_.find(name);
+    if (it == entries_.end()) {
+      throw std::out_of_range("no array named " + name + " in archive");
+    }
+    const auto& a = it->second;
+    return tensorFromBytes(fl::Shape(a.dims), a.type, file_.data() + a.offset);
+  }
+
+ private:
+  void parseDirectory() {
+    const char* base = file_.data();
+    const int64_t size = file_.size();
+    // End of central directory record, followed by a comment of <= 64 KB.
+    int64_t eocd = size - 22;
+    for (; eocd >= 0 && eocd >= size - 22 - 65535; --eocd) {
+      if (littleEndian(base + eocd, 4) == 0x06054b50) {
+        break;
+      }
+    }
+    if (eocd < 0 || eocd < size - 22 - 65535) {
+      throw std::runtime_error("not a zip archive");
+    }
+    uint64_t count = littleEndian(base + eocd + 10, 2);
+    uint64_t dir = littleEndian(base + eocd + 16, 4);
+    if (eocd >= 20 && littleEndian(base + eocd - 20, 4) == 0x07064b50) {
+      const uint64_t eocd64 = littleEndian(base + eocd - 12, 8);
+      if (eocd64 + 56 > uint64_t(size) ||
+          littleEndian(base + eocd64, 4) != 0x06064b50) {
+        throw std::runtime_error("malformed zip64 directory");
+      }
+      count = littleEndian(base + eocd64 + 32, 8);
+      dir = littleEndian(base + eocd64 + 48, 8);
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+      if (dir > uint64_t(size) || uint64_t(size) - dir < 46 ||
+          littleEndian(base + dir, 4) != 0x02014b50) {
+        throw std::runtime_error("malformed zip directory");
+      }
+      const char* e = base + dir;
+      const auto method = littleEndian(e + 10, 2);
+      uint64_t stored_size = littleEndian(e + 20, 4);
+      const auto name_len = littleEndian(e + 28, 2);
+      const auto extra_len = littleEndian(e + 30, 2);
+      const auto comment_len = littleEndian(e + 32, 2);
+      uint64_t local = littleEndian(e + 42, 4);
+      if (46 + name_len + extra_len > uint64_t(size) - dir) {
+        throw std::runtime_error("malformed zip directory");
+      }
+      std::string name(e + 46, name_len);
+      const uint64_t original_size = littleEndian(e + 24, 4);
+      // Zip64 extra field: 64-bit values for the fields saturated above.
+      const char* extra = e + 46 + name_len;
+      for (uint64_t x = 0; x + 4 <= extra_len;) {
+        const auto id = littleEndian(extra + x, 2);
+        const auto len = littleEndian(extra + x + 2, 2);
+        if (x + 4 + len > extra_len) {
+          throw std::runtime_error("malformed zip extra field for " + name);
+        }
+        if (id == 0x0001) {
+          uint64_t field = x + 4;
+          if (original_size == 0xffffffff) {
+            field += 8;
+          }
+          if (stored_size == 0xffffffff && field + 8 <= x + 4 + len) {
+            stored_size = littleEndian(extra + field, 8);
+            field += 8;
+          }
+          if (local == 0xffffffff && field + 8 <= x + 4 + len) {
+            local = littleEndian(extra + field, 8);
+          }
+        }
+        x += 4 + len;
+      }
+      dir += 46 + name_len + extra_len + comment_len;
+      if (method != 0) {
+        throw std::runtime_error(
+            name + " is compressed; only stored .npz archives are supported");
+      }
+      if (local > uint64_t(size) || uint64_t(size) - local < 30 ||
+          littleEndian(base + local, 4) != 0x04034b50) {
+        throw std::runtime_error("malformed zip entry " + name);
+      }
+      const uint64_t begin = local + 30 + littleEndian(base + local + 26, 2) +
+          littleEndian(base + local + 28, 2);
+      if (begin > uint64_t(size) || stored_size > uint64_t(size) - begin) {
+        throw std::runtime_error("zip entry " + name + " is truncated");
+      }
+      auto a = parseNpy(base + begin, stored_size);
+      a.offset += begin;
+      if (name.size() > 4 && name.compare(name.size() - 4, 4, ".npy") == 0) {
+        name.resize(name.size() - 4);
+      }
+      names_.push_back(name);
+      entries_.emplace(std::move(name), std::move(a));
+    }
+  }
+
+  MappedFile file_;
+  std::vector<std::string> names_;
+  std::unordered_map<std::string, NpyArray> entries_;
+};
+
+// Stored zip of one .npy per tensor, readable by `numpy.load`.
+void saveNpz(const std::string& filename,
+             const std::vector<std::string>& names,
+             const TensorSpan& tensors) {
+  const auto s = snapshotBundle(names, tensors);
+  if (s.names.size() >= 0xffff) {
+    throw std::runtime_error(".npz archives are limited to 65534 arrays");
+  }
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("cannot open " + filename + " for writing");
+  }
+  auto le = [](std::string& buf, uint64_t v, int bytes) {
+    for (int b = 0; b < bytes; ++b) {
+      buf += static_cast<char>(v >> (8 * b));
+    }
+  };
+  // Fixed 1980-01-01 timestamp so archives are reproducible.
+  auto fields = [&](std::string& buf, uint32_t crc, uint64_t size,
+                    const std::string& name) {
+    le(buf, 20, 2); // version needed
+    le(buf, 0, 2); // flags
+    le(buf, 0, 2); // stored
+    le(buf, 0, 2); // time
+    le(buf, 0x21, 2); // date
+    le(buf, crc, 4);
+    le(buf, size, 4);
+    le(buf, size, 4);
+    le(buf, name.size(), 2);
+    le(buf, 0, 2); // extra length
+  };
+  std::string directory;
+  uint64_t offset = 0;
+  for (size_t i = 0; i < s.names.size(); ++i) {
+    const auto name = s.names[i] + ".npy";
+    const auto prefix = npyPrefix(s.tensors[i]);
+    const uint64_t size = prefix.size() + s.sizes[i];
+    if (offset + size + 30 + name.size() >= 0xffffffff) {
+      throw std::runtime_error(".npz archives over 4 GiB are not supported");
+    }
+    const uint32_t crc = Crc32::extend(
+        Crc32::extend(0, prefix.data(), prefix.size()), s.data[i], s.sizes[i]);
+    std::string local;
+    le(local, 0x04034b50, 4);
+    fields(local, crc, size, name);
+    local += name;
+    out.write(local.data(), local.size());
+    out.write(prefix.data(), prefix.size());
+    out.write(s.data[i], s.sizes[i]);
+    le(directory, 0x02014b50, 4);
+    le(directory, 20, 2); // version made by
+    fields(directory, crc, size, name);
+    le(directory, 0, 2); // comment length
+    le(directory, 0, 2); // disk
+    le(directory, 0, 2); // internal attributes
+    le(directory, 0, 4); // external attributes
+    le(directory, offset, 4);
+    directory += name;
+    offset += local.size() + size;
+  }
+  std::string end;
+  le(end, 0x06054b50, 4);
+  le(end, 0, 4); // disk numbers
+  le(end, s.names.size(), 2);
+  le(end, s.names.size(), 2);
+  le(end, directory.size(), 4);
+  le(end, offset, 4);
+  le(end, 0, 2); // comment length
+  out.write(directory.data(), directory.size());
+  out.write(end.data(), end.size());
+  if (!out) {
+    throw std::runtime_error("failed to write " + filename);
+  }
+}
+
+// Arrow format strings of the fixed-width primitive types. b8 travels as int8
+// ("c"); Arrow booleans ("b") are bit-packed and get unpacked on import.
+const char* arrowFormat(fl::dtype type) {
+  switch (type) {
+    case fl::dtype::f16:
+      return "e";
+    case fl::dtype::f32:
+      return "f";
+    case fl::dtype::f64:
+      return "g";
+    case fl::dtype::b8:
+      return "c";
+    case fl::dtype::s16:
+      return "s";
+    case fl::dtype::s32:
+      return "i";
+    case fl::dtype::s64:
+      return "l";
+    case fl::dtype::u8:
+      return "C";
+    case fl::dtype::u16:
+      return "S";
+    case fl::dtype::u32:
+      return "I";
+    case fl::dtype::u64:
+      return "L";
+  }
+  throw std::invalid_argument("unsupported dtype for Arrow export");
+}
+
+fl::dtype arrowDtype(const std::string& format) {
+  static const std::unordered_map<std::string, fl::dtype> types = {
+      {"e", fl::dtype::f16}, {"f", fl::dtype::f32}, {"g", fl::dtype::f64},
+      {"b", fl::dtype::b8},  {"c", fl::dtype::b8},  {"s", fl::dtype::s16},
+      {"i", fl::dtype::s32}, {"l", fl::dtype::s64}, {"C", fl::dtype::u8},
+      {"S", fl::dtype::u16}, {"I", fl::dtype::u32}, {"L", fl::dtype::u64}};
+  auto it = types.find(format);
+  if (it == types.end()) {
+    throw std::invalid_argument(
+        "only fixed-width primitive Arrow arrays are supported, got format " +
+        format);
+  }
+  return it->second;
+}
+
+// Expands `n` bits of an Arrow bitmap, starting at bit `offset`, to 0/1 bytes.
+std::vector<char> unpackArrowBits(const void* bitmap, int64_t offset, int64_t n) {
+  const auto* bits = static_cast<const uint8_t*>(bitmap);
+  std::vector<char> out(n);
+  parallelFor(n, 65536, [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; ++i) {
+      const int64_t b = offset + i;
+      out[i] = (bits[b >> 3] >> (b & 7)) & 1;
+    }
+  });
+  return out;
+}
+
+// 1-D tensor from a primitive Arrow array. When the array has nulls,
+// `has_mask` is set and `mask` receives the validity bitmap as b8 (1 = valid).
+fl::Tensor fromArrow(const ArrowArray& array,
+                     const ArrowSchema& schema,
+                     fl::Tensor& mask,
+                     bool& has_mask) {
+  if (!array.release) {
+    throw std::invalid_argument("Arrow array was already released");
+  }
+  const std::string format = schema.format ? schema.format : "";
+  const auto type = arrowDtype(format);
+  if (array.n_buffers != 2 || array.n_children != 0 || array.dictionary ||
+      array.length < 0 || array.offset < 0) {
+    throw std::invalid_argument("malformed primitive Arrow array");
+  }
+  const int64_t n = array.length;
+  const fl::Shape shape({n});
+  fl::Tensor out;
+  if (format == "b") {
+    out = tensorFromBytes(
+        shape, type, unpackArrowBits(array.buffers[1], array.offset, n).data());
+  } else {
+    const auto* data = static_cast<const char*>(array.buffers[1]);
+    out = tensorFromBytes(
+        shape, type, data + array.offset * fl::getTypeSize(type));
+  }
+  has_mask = array.buffers[0] && array.null_count != 0;
+  if (has_mask) {
+    mask = tensorFromBytes(
+        shape, fl::dtype::b8,
+        unpackArrowBits(array.buffers[0], array.offset, n).data());
+  }
+  return out;
+}
+
+// Keeps an exported tensor's bytes alive until Arrow's release callback: host
+// data is shared through a view, other tensors are staged on the host.
+struct ArrowExport {
+  fl::Tensor tensor;
+  std::unique_ptr<HostView<char>> view;
+  std::vector<char> staged;
+  const void* buffers[2] = {nullptr, nullptr};
+};
+
+void releaseArrowArray(ArrowArray* array) {
+  delete static_cast<ArrowExport*>(array->private_data);
+  array->release = nullptr;
+}
+
+void releaseArrowSchema(ArrowSchema* schema) {
+  schema->release = nullptr;
+}
+
+// Fills `array` and `schema` with `t` as a flat column in memory order.
+void toArrow(const fl::Tensor& t, ArrowArray* array, ArrowSchema* schema) {
+  const char* format = arrowFormat(t.type());
+  auto e = std::make_unique<ArrowExport>();
+  e->tensor = t;
+  if (isHostTensor(t) && t.isContiguous()) {
+    e->view = std::make_unique<HostView<char>>(e->tensor);
+    e->buffers[1] = e->view->data();
+  } else {
+    e->staged.resize(t.bytes());
+    if (!e->staged.empty()) {
+      contiguous(t).host(e->staged.data());
+    }
+    e->buffers[1] = e->staged.data();
+  }
+  *schema = ArrowSchema{
+      format, "", nullptr, 0, 0, nullptr, nullptr, releaseArrowSchema,
+      nullptr};
+  *array = ArrowArray{
+      static_cast<int64_t>(t.elements()),
+      0,
+      0,
+      2,
+      0,
+      e->buffers,
+      nullptr,
+      nullptr,
+      releaseArrowArray,
+      e.get()};
+  e.release();
+}
+
+struct LoaderOptions {
+  std::vector<fl::Dim> sample_dims; // Flashlight order
+  fl::dtype type;
+  bool length_prefixed;
+  int64_t batch_size;
+  uint64_t seed;
+  bool shuffle;
+  bool drop_last;
+  int prefetch;
+  int workers;
+};
+
+// Streams batches of records from one mapped file. Records are either fixed
+// size (one sample of `sample_dims` each) or prefixed with a little-endian
+// u32 byte count and zero-padded to the sample size. Worker threads copy
+// records straight into batch tensors allocated by the consumer, at most
+// `prefetch` batches ahead, in the order of a Philox-seeded shuffle that is
+// redrawn each epoch. Batches come out in order regardless of which worker
+// filled them; the batch axis is the outermost (last Flashlight) dimension.
+class DataLoader {
+ public:
+  DataLoader(const std::string& filename, LoaderOptions options)
+      : file_(filename), options_(std::move(options)) {
+    if (options_.batch_size <= 0 || options_.prefetch <= 0 ||
+        options_.workers <= 0) {
+      throw std::invalid_argument(
+          "batch size, prefetch and workers must be positive");
+    }
+    for (auto d : options_.sample_dims) {
+      if (d <= 0) {
+        throw std::invalid_argument("sample dimensions must be positive");
+      }
+    }
+    sample_bytes_ = checkedBytes(
+        options_.sample_dims,
+        static_cast<int64_t>(fl::getTypeSize(options_.type)));
+    if (sample_bytes_ < 0 ||
+        sample_bytes_ >
+            std::numeric_limits<int64_t>::max() / options_.batch_size) {
+      throw std::invalid_argument("batch of samples is too large");
+    }
+    indexRecords();
+    const int64_t n = offsets_.size();
+    batches_per_epoch_ = options_.drop_last
+        ? n / options_.batch_size
+        : (n + options_.batch_size - 1) / options_.batch_size;
+    if (batches_per_epoch_ == 0) {
+      throw std::invalid_argument("not enough records for one batch");
+    }
+    slots_.resize(options_.prefetch);
+    for (auto& slot : slots_) {
+      arm(slot);
+    }
+    for (int i = 0; i < options_.workers; ++i) {
+      workers_.emplace_back([this] { work(); });
+    }
+  }
+
+  ~DataLoader() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& w : workers_) {
+      w.join();
+    }
+  }
+
+  DataLoader(const DataLoader&) = delete;
+  DataLoader& operator=(const DataLoader&) = delete;
+
+  int64_t size() const {
+    return offsets_.size();
+  }
+
+  // Takes the next batch, or returns false once per epoch after its last
+  // batch. `lengths` (s64, elements per record) is set for length-prefixed
+  // files.
+  bool next(fl::Tensor& batch, fl::Tensor& lengths, bool& has_lengths) {
+    if (taken_in_epoch_ == batches_per_epoch_) {
+      taken_in_epoch_ = 0;
+      return false;
+    }
+    Slot* slot;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto& s = slots_[consumed_ % slots_.size()];
+      ready_cv_.wait(lock, [&] { return s.ready_batch == consumed_ || error_; });
+      if (error_) {
+        std::rethrow_exception(error_);
+      }
+      slot = &s;
+    }
+    // Workers cannot claim this slot again until `consumed_` moves on.
+    if (slot->view && slot->rows == options_.batch_size) {
+      slot->view.reset();
+      batch = slot->batch;
+      arm(*slot);
+    } else {
+      batch = tensorFromBytes(batchShape(slot->rows), options_.type,
+                              slot->data);
+    }
+    has_lengths = options_.length_prefixed;
+    if (has_lengths) {
+      lengths = tensorFromBytes(fl::Shape({slot->rows}), fl::dtype::s64,
+                                reinterpret_cast<char*>(slot->lengths.data()));
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      ++consumed_;
+    }
+    work_cv_.notify_all();
+    ++taken_in_epoch_;
+    return true;
+  }
+
+ private:
+  // One prefetch buffer: a batch tensor locked for the workers to fill (host
+  // backends) or a staging vector uploaded when taken.
+  struct Slot {
+    fl::Tensor batch;
+    std::unique_ptr<HostView<char>> view;
+    std::vector<char> staged;
+    char* data = nullptr;
+    std::vector<int64_t> lengths;
+    int64_t rows = 0;
+    int64_t ready_batch = -1;
+  };
+
+  fl::Shape batchShape(int64_t rows) const {
+    auto dims = options_.sample_dims;
+    dims.push_back(rows);
+    return fl::Shape(dims);
+  }
+
+  // Runs on the consumer thread, which owns all tensor ops.
+  void arm(Slot& slot) {
+    slot.batch = fl::Tensor(batchShape(options_.batch_size), options_.type);
+    if (isHostTensor(slot.batch)) {
+      slot.view = std::make_unique<HostView<char>>(slot.batch);
+      slot.data = slot.view->data();
+    } else {
+      slot.staged.resize(sample_bytes_ * options_.batch_size);
+      slot.data = slot.staged.data();
+    }
+    slot.lengths.resize(options_.batch_size);
+  }
+
+  void indexRecords() {
+    const char* base = file_.data();
+    const int64_t size = file_.size();
+    if (!options_.length_prefixed) {
+      if (size % sample_bytes_ != 0) {
+        throw std::runtime_error(
+            "file size is not a multiple of the record size");
+      }
+      for (int64_t off = 0; off < size; off += sample_bytes_) {
+        offsets_.push_back(off);
+        sizes_.push_back(sample_bytes_);
+      }
+      return;
+    }
+    for (int64_t off = 0; off < size;) {
+      if (off + 4 > size) {
+        throw std::runtime_error("truncated record length");
+      }
+      const int64_t len = littleEndian(base + off, 4);
+      off += 4;
+      if (off + len > size) {
+        throw std::runtime_error("truncated record");
+      }
+      if (len > sample_bytes_ || len % fl::getTypeSize(options_.type) != 0) {
+        throw std::runtime_error("record does not fit the sample shape");
+      }
+      offsets_.push_back(off);
+      sizes_.push_back(len);
+      off += len;
+    }
+  }
+
+  // Record order of `epoch`; cached while batches of that epoch are in flight.
+  std::shared_ptr<const std::vector<int64_t>> order(int64_t epoch) {
+    auto it = orders_.find(epoch);
+    if (it != orders_.end()) {
+      return it->second;
+    }
+    for (auto o = orders_.begin(); o != orders_.end();) {
+      o = o->first * batches_per_epoch_ + batches_per_epoch_ <= consumed_
+          ? orders_.erase(o)
+          : std::next(o);
+    }
+    auto out = std::make_shared<std::vector<int64_t>>(offsets_.size());
+    for (size_t i = 0; i < out->size(); ++i) {
+      (*out)[i] = i;
+    }
+    if (options_.shuffle) {
+      // Fisher-Yates with 64-bit draws, two per Philox block.
+      uint32_t lanes[4];
+      uint64_t counter = uint64_t(epoch) << 40;
+      for (int64_t i = out->size() - 1, k = 0; i > 0; --i, ++k) {
+        if (k % 2 == 0) {
+          Philox::block(options_.seed, counter++, lanes);
+        }
+        const uint64_t r =
+            uint64_t(lanes[2 * (k % 2)]) << 32 | lanes[2 * (k % 2) + 1];
+        std::swap((*out)[i], (*out)[r % (i + 1)]);
+      }
+    }
+    orders_.emplace(epoch, out);
+    return out;
+  }
+
+  void work() {
+    const int64_t n = offsets_.size();
+    const int64_t batch_size = options_.batch_size;
+    while (true) {
+      int64_t b;
+      Slot* slot;
+      std::shared_ptr<const std::vector<int64_t>> records;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_cv_.wait(lock, [&] {
+          return stop_ ||
+              produced_ < consumed_ + static_cast<int64_t>(slots_.size());
+        });
+        if (stop_) {
+          return;
+        }
+        b = produced_++;
+        slot = &slots_[b % slots_.size()];
+        try {
+          records = order(b / batches_per_epoch_);
+        } catch (...) {
+          error_ = std::current_exception();
+          ready_cv_.notify_all();
+          return;
+        }
+      }
+      const int64_t first = (b % batches_per_epoch_) * batch_size;
+      const int64_t rows = std::min(batch_size, n - first);
+      for (int64_t r = 0; r < rows; ++r) {
+        const int64_t i = (*records)[first + r];
+        char* dst = slot->data + r * sample_bytes_;
+        std::memcpy(dst, file_.data() + offsets_[i], sizes_[i]);
+        std::memset(dst + sizes_[i], 0, sample_bytes_ - sizes_[i]);
+        slot->lengths[r] = sizes_[i] / fl::getTypeSize(options_.type);
+      }
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        slot->rows = rows;
+        slot->ready_batch = b;
+      }
+      ready_cv_.notify_all();
+    }
+  }
+
+  MappedFile file_;
+  LoaderOptions options_;
+  int64_t sample_bytes_ = 0;
+  std::vector<int64_t> offsets_;
+  std::vector<int64_t> sizes_;
+  int64_t batches_per_epoch_ = 0;
+  int64_t taken_in_epoch_ = 0;
+  std::vector<Slot> slots_;
+  std::unordered_map<int64_t, std::shared_ptr<const std::vector<int64_t>>>
+      orders_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable ready_cv_;
+  int64_t produced_ = 0;
+  int64_t consumed_ = 0;
+  std::exception_ptr error_;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
+// Algorithm benchmarks for one conv configuration, shared by the backward
+// entry points so autotuning carries over between iterations. Autograd
+// payloads hold per-call state and are created fresh for each call.
+// DynamicBenchmark is not thread-safe, so `tuning` serializes calls on the
+// configuration while autotuning is on.
+struct ConvBenchmarks {
+  std::shared_ptr<fl::DynamicBenchmark> data;
+  std::shared_ptr<fl::DynamicBenchmark> filter;
+  std::shared_ptr<fl::DynamicBenchmark> bias;
+  std::shared_ptr<std::mutex> tuning;
+};
+
+// Configurations are kept most recently used first and the oldest are dropped
+// beyond this count, so workloads with varying shapes stay bounded. Callers
+// keep their copies of an evicted entry's benchmarks.
+constexpr size_t kMaxConvBenchmarks = 1024;
+
+using ConvBenchmarkList = std::list<std::pair<std::string, ConvBenchmarks>>;
+static std::mutex g_conv_benchmarks_mutex;
+static ConvBenchmarkList g_conv_benchmarks;
+static std::unordered_map<std::string, ConvBenchmarkList::iterator>
+    g_conv_benchmark_index;
+
+// Finds or inserts the entry for `key` and marks it most recently used. The
+// caller holds g_conv_benchmarks_mutex.
+ConvBenchmarks& convBenchmarkEntry(const std::string& key) {
+  auto it = g_conv_benchmark_index.find(key);
+  if (it != g_conv_benchmark_index.end()) {
+    g_conv_benchmarks.splice(
+        g_conv_benchmarks.begin(), g_conv_benchmarks, it->second);
+    return it->second->second;
+  }
+  g_conv_benchmarks.emplace_front(key, ConvBenchmarks{});
+  g_conv_benchmark_index[key] = g_conv_benchmarks.begin();
+  while (g_conv_benchmarks.size() > kMaxConvBenchmarks) {
+    g_conv_benchmark_index.erase(g_conv_benchmarks.back().first);
+    g_conv_benchmarks.pop_back();
+  }
+  return g_conv_benchmarks.front().second;
+}
+
+std::string convKey(const fl::Tensor& in,
+                    const fl::Tensor& wt,
+                    int sx,
+                    int sy,
+                    int px,
+                    int py,
+                    int dx,
+                    int dy,
+                    int groups) {
+  std::ostringstream key;
+  key << static_cast<int>(in.type()) << ':';
+  for (auto d : in.shape().get()) {
+    key << d << 'x';
+  }
+  key << ':';
+  for (auto d : wt.shape().get()) {
+    key << d << 'x';
+  }
+  key << ':' << sx << ',' << sy << ',' << px << ',' << py << ',' << dx << ','
+      << dy << ',' << groups;
+  return key.str();
+}
+
+// Returns the cached entry for a conv configuration, creating any missing
+// benchmarks through the backend's autograd extension.
+ConvBenchmarks convBenchmarks(const fl::Tensor& in,
+                              const fl::Tensor& wt,
+                              int sx,
+                              int sy,
+                              int px,
+                              int py,
+                              int dx,
+                              int dy,
+                              int groups) {
+  const auto key = convKey(in, wt, sx, sy, px, py, dx, dy, groups);
+  std::lock_guard<std::mutex> guard(g_conv_benchmarks_mutex);
+  auto& entry = convBenchmarkEntry(key);
+  if (!entry.data || !entry.filter || !entry.bias) {
+    auto& ext = in.backend().getExtension<fl::AutogradExtension>();
+    entry.data = entry.data ? entry.data : ext.createBenchmarkOptions();
+    entry.filter = entry.filter ? entry.filter : ext.createBenchmarkOptions();
+    entry.bias = entry.bias ? entry.bias : ext.createBenchmarkOptions();
+  }
+  if (!entry.tuning) {
+    entry.tuning = std::make_shared<std::mutex>();
+  }
+  return entry;
+}
+
+// Holds the configuration's tuning lock while autotuning is on, when the
+// benchmarks record timings and switch algorithms. Tuned or pinned benchmarks
+// are only read, so calls then run concurrently.
+std::unique_lock<std::mutex> lockConvTuning(const ConvBenchmarks& benchmarks) {
+  std::unique_lock<std::mutex> lock(*benchmarks.tuning, std::defer_lock);
+  if (fl::DynamicBenchmark::getBenchmarkMode()) {
+    lock.lock();
+  }
+  return lock;
+}
+
+#if __has_include("flashlight/fl/autograd/tensor/backend/cudnn/CudnnAutogradExtension.h")
+#include "flashlight/fl/autograd/tensor/backend/cudnn/CudnnAutogradExtension.h"
+#define FL_BINDING_PERSIST_CONV_BENCHMARKS
+using ConvKernelMode = fl::CudnnAutogradExtension::KernelMode;
+using ConvBenchmarkOptions = fl::DynamicBenchmarkOptions<ConvKernelMode>;
+#endif
+
+// Tuned choices are stored one per line as `<kind> <key> <mode>`. Only the
+// cuDNN backend has typed benchmark options; elsewhere these are no-ops.
+int saveConvBenchmarks(const std::string& filename) {
+#ifdef FL_BINDING_PERSIST_CONV_BENCHMARKS
+  std::ofstream out(filename, std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("unable to open " + filename);
+  }
+  int count = 0;
+  std::lock_guard<std::mutex> guard(g_conv_benchmarks_mutex);
+  for (const auto& it : g_conv_benchmarks) {
+    std::unique_lock<std::mutex> tuning;
+    if (it.second.tuning) {
+      tuning = std::unique_lock<std::mutex>(*it.second.tuning);
+    }
+    const std::pair<const char*, fl::DynamicBenchmark*> kinds[] = {
+        {"data", it.second.data.get()},
+        {"filter", it.second.filter.get()},
+        {"bias", it.second.bias.get()}};
+    for (const auto& kind : kinds) {
+      if (!kind.second) {
+        continue;
+      }
+      auto options = kind.second->getOptions<ConvBenchmarkOptions>();
+      if (options && options->timingsComplete()) {
+        out << kind.first << ' ' << it.first << ' '
+            << static_cast<int>(options->currentOption()) << '\n';
+        ++count;
+      }
+    }
+  }
+  return count;
+#else
+  return 0;
+#endif
+}
+
+// Pins each stored configuration to its tuned choice by seeding the cache with
+// single-option benchmarks.
+int loadConvBenchmarks(const std::string& filename) {
+#ifdef FL_BINDING_PERSIST_CONV_BENCHMARKS
+  std::ifstream in(filename);
+  if (!in) {
+    return 0;
+  }
+  int count = 0;
+  std::string kind, key;
+  int mode;
+  std::lock_guard<std::mutex> guard(g_conv_benchmarks_mutex);
+  while (in >> kind >> key >> mode) {
+    auto bench = std::make_shared<fl::DynamicBenchmark>(
+        std::make_shared<ConvBenchmarkOptions>(
+            std::vector<ConvKernelMode>{static_cast<ConvKernelMode>(mode)}, 1));
+    auto& entry = convBenchmarkEntry(key);
+    if (kind == "data") {
+      entry.data = bench;
+    } else if (kind == "filter") {
+      entry.filter = bench;
+    } else if (kind == "bias") {
+      entry.bias = bench;
+    } else {
+      continue;
+    }
+    ++count;
+  }
+  return count;
+#else
+  return 0;
+#endif
+}
+
+extern "C" {
+void fl_init() {
+  fl::init();
+  if (const char* path = std::getenv("FL_CONV_BENCHMARK_CACHE")) {
+    loadConvBenchmarks(path);
+  }
+}
+
+size_t fl_bytesUsed() {
+  return g_bytes_used;
+}
+
+void* fl_createTensor(void* shape_ptr, int64_t shape_len) {
+  try {
+    LOCK_GUARD
+    static_assert(sizeof(long long) == sizeof(int64_t));
+    auto* t = new fl::Tensor(shapeArg(shape_ptr, shape_len));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// TODO use DLM destructor
+void* fl_fromDLTensor(void* ptr) {
+  auto* dlmtensor = (DLManagedTensor*)ptr;
+  auto& dltensor = dlmtensor->dl_tensor;
+  auto shape =
+      arrayArg<long long>(dltensor.shape, dltensor.ndim, g_row_major, false);
+  auto dtype = dltensor.dtype;
+  // TODO utilize the device ID
+  auto location = (dltensor.device.device_type == kDLCPU)
+                      ? fl::MemoryLocation::Host
+                      : fl::MemoryLocation::Device;
+  bool error = false;
+  void* data = dltensor.data;
+  auto tensor = [&]() {
+    switch (dtype.code) {
+      case kDLInt:
+        if (dtype.bits == 32) {
+          return fl::Tensor::fromBuffer(fl::Shape(std::move(shape)), (int32_t*)data,
+                                        location);
+        } else if (dtype.bits == 16) {
+          return fl::Tensor::fromBuffer(fl::Shape(std::move(shape)), (int16_t*)data,
+                                        location);
+        } else if (dtype.bits == 64) {
+          return fl::Tensor::fromBuffer(fl::Shape(std::move(shape)), (int64_t*)data,
+                                        location);
+        }
+      case kDLUInt:
+        if (dtype.bits == 32) {
+          return fl::Tensor::fromBuffer(fl::Shape(std::move(shape)), (uint32_t*)data,
+                                        location);
+        } else if (dtype.bits == 16) {
+          return fl::Tensor::fromBuffer(fl::Shape(std::move(shape)), (uint16_t*)data,
+                                        location);
+        } else if (dtype.bits == 64) {
+          return fl::Tensor::fromBuffer(fl::Shape(std::move(shape)), (uint64_t*)data,
+                                        location);
+        }
+      case kDLFloat:
+        if (dtype.bits == 32) {
+          return fl::Tensor::fromBuffer(fl::Shape(std::move(shape)), (float*)data,
+                                        location);
+        } else if (dtype.bits == 64) {
+          return fl::Tensor::fromBuffer(fl::Shape(std::move(shape)), (double*)data,
+                                        location);
+        }
+      case kDLBool:
+      default:
+        error = true;
+        return fl::Tensor(fl::Shape({}));
+    }
+  }();
+  if (error) {
+    HANDLE_EXCEPTION("Unsupported datatype in DLTensor");
+  }
+  auto* t = new fl::Tensor(tensor);
+  g_bytes_used += t->bytes();
+  return t;
+}
+
+void fl_deleteDLTensor(struct DLManagedTensor* self) {
+  auto* tensor = reinterpret_cast<fl::Tensor*>(self->manager_ctx);
+  g_bytes_used -= tensor->bytes();
+  tensor->unlock();
+  delete tensor;
+  delete self->dl_tensor.shape;
+  delete self;
+}
+
+void* fl_toDLTensor(void* ptr) {
+  LOCK_GUARD
+  DLManagedTensor* dlmtensor = new DLManagedTensor();
+  DLTensor& dltensor = dlmtensor->dl_tensor;
+  const auto* tensor =
+      new fl::Tensor(reinterpret_cast<fl::Tensor*>(ptr)->copy());
+#define X(fl_prefix, dl_type, real_type, bits)   \
+  case fl::dtype::fl_prefix##bits: {             \
+    dltensor.data = tensor->device<real_type>(); \
+    dltensor.dtype = {kDL##dl_type, bits, 1};    \
+    break;                                       \
+  }
+  switch (tensor->type()) {
+    X(f, Float, float, 32)
+    X(f, Float, double, 64)
+    X(f, Float, float, 16)
+    X(s, Int, int32_t, 32)
+    X(s, Int, int16_t, 16)
+    X(s, Int, int64_t, 64)
+    X(u, UInt, uint32_t, 32)
+    X(u, UInt, uint16_t, 16)
+    X(u, UInt, uint64_t, 64)
+    default:
+      HANDLE_EXCEPTION("Unsupported datatype for DLTensor creation");
+  }
+  const auto ndim = tensor->ndim();
+  dltensor.shape = new int64_t[ndim];
+  dltensor.ndim = ndim;
+  if (tensor->location() == fl::MemoryLocation::Host) {
+    dltensor.device.device_type = kDLCPU;
+  } else if (tensor->location() == fl::MemoryLocation::Device) {
+    dltensor.device.device_type = kDLCUDA;
+  }
+  for (auto i = 0; i < ndim; ++i) {
+    const auto fl_i = g_row_major ? ndim - 1 - i : i;
+    dltensor.shape[i] = tensor->shape()[fl_i];
+  }
+  dlmtensor->manager_ctx = (void*)tensor;
+  dlmtensor->deleter = fl_deleteDLTensor;
+  return dlmtensor;
+}
+
+// Copies a fixed-width primitive Arrow array into a 1-D tensor. The validity
+// bitmap, if the array has nulls, is written to `mask_out[0]` as a b8 tensor
+// (1 = valid); otherwise `mask_out[0]` is null. The array is consumed: its
+// release callback runs before returning. The schema stays with the caller.
+void* fl_fromArrowArray(void* array_ptr, void* schema_ptr, void* mask_out) {
+  auto* array = reinterpret_cast<ArrowArray*>(array_ptr);
+  try {
+    LOCK_GUARD
+    fl::Tensor mask;
+    bool has_mask = false;
+    auto result = fromArrow(
+        *array, *reinterpret_cast<ArrowSchema*>(schema_ptr), mask, has_mask);
+    if (array->release) {
+      array->release(array);
+    }
+    auto** out = reinterpret_cast<void**>(mask_out);
+    out[0] = nullptr;
+    if (has_mask) {
+      g_bytes_used += mask.bytes();
+      out[0] = new fl::Tensor(mask);
+    }
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
+  } catch (std::exception const& e) {
+    if (array->release) {
+      array->release(array);
+    }
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    if (array->release) {
+      array->release(array);
+    }
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// Exports `t` into the caller's ArrowArray and ArrowSchema as a flat column in
+// memory order. Contiguous host tensors are shared without a copy until the
+// array's release callback runs; in-place updates of `t` copy first. Returns
+// 0, or -1 on error.
+int fl_toArrowArray(void* t, void* array_out, void* schema_out) {
+  try {
+    LOCK_GUARD
+    const auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    toArrow(*tensor, reinterpret_cast<ArrowArray*>(array_out),
+            reinterpret_cast<ArrowSchema*>(schema_out));
+    markShared(tensor);
+    return 0;
+  } catch (std::exception const& e) {
+    RECORD_EXCEPTION(e);
+    return -1;
+  } catch (...) {
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
+  }
+}
+
+void* fl_tensorFromFloat16Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(
+        fl::Tensor::fromBuffer({numel}, (float*)ptr, fl::MemoryLocation::Host)
+            .astype(fl::dtype::f16));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_tensorFromFloat32Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(
+        fl::Tensor::fromBuffer({numel}, (float*)ptr, fl::MemoryLocation::Host));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_tensorFromFloat64Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (double*)ptr,
+                                                    fl::MemoryLocation::Host));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_tensorFromInt8Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(
+        fl::Tensor::fromBuffer({numel}, (char*)ptr, fl::MemoryLocation::Host));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_tensorFromInt16Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (int16_t*)ptr,
+                                                    fl::MemoryLocation::Host));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_tensorFromInt32Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (int32_t*)ptr,
+                                                    fl::MemoryLocation::Host));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_tensorFromInt64Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (int64_t*)ptr,
+                                                    fl::MemoryLocation::Host));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_tensorFromUint8Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (uint8_t*)ptr,
+                                                    fl::MemoryLocation::Host));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_tensorFromUint16Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (uint16_t*)ptr,
+                                                    fl::MemoryLocation::Host));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_tensorFromUint32Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (uint32_t*)ptr,
+                                                    fl::MemoryLocation::Host));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_tensorFromUint64Buffer(int64_t numel, void* ptr) {
+  try {
+    LOCK_GUARD
+    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (uint64_t*)ptr,
+                                                    fl::MemoryLocation::Host));
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void fl_destroyTensor(void* t, void* /*ignore*/) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  if (tensor->hasAdapter()) {
+    g_bytes_used -= tensor->bytes();
+  }
+  releaseShared(tensor);
+  delete tensor;
+}
+
+void fl_dispose(void* t) {
+  LOCK_GUARD
+  auto& tensor = *reinterpret_cast<fl::Tensor*>(t);
+  g_bytes_used -= tensor.bytes();
+  releaseShared(&tensor);
+  fl::detail::releaseAdapterUnsafe(tensor);
+}
+
+typedef void (*JSTypedArrayBytesDeallocator)(void* bytes,
+                                             void* deallocatorContext);
+
+JSTypedArrayBytesDeallocator fl_genTensorDestroyer() {
+  return fl_destroyTensor;
+}
+
+void fl_setRowMajor() {
+  g_row_major = true;
+}
+
+void fl_setColMajor() {
+  g_row_major = false;
+}
+
+bool fl_isRowMajor() {
+  return g_row_major;
+}
+
+bool fl_isColMajor() {
+  return !g_row_major;
+}
+
+void fl_save(void* t, void* cstr_ptr, int length) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+  auto filename = std::string(cstr, length);
+  fl::save(filename, *tensor);
+}
+
+void* fl_load(void* cstr_ptr, int length) {
+  try {
+    LOCK_GUARD
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    auto filename = std::string(cstr, length);
+    fl::Tensor tensor;
+    fl::load(filename, tensor);
+    auto* t = new fl::Tensor(tensor);
+    g_bytes_used += t->bytes();
+    return t;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void fl_eval(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  fl::eval(*tensor);
+}
+
+size_t fl_elements(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->elements();
+}
+
+size_t fl_bytes(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->bytes();
+}
+
+int fl_shape(void* t, void* out, int out_len) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  if (out_len != tensor->ndim()) {
+    return -1;
+  }
+  for (auto i = 0; i < out_len; ++i) {
+    const auto idx = g_row_major ? out_len - i - 1 : i;
+    reinterpret_cast<int64_t*>(out)[i] = tensor->shape()[idx];
+  }
+  return 0;
+}
+
+int fl_ndim(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->ndim();
+}
+
+// Writes [ndim, dtype, elements, bytes, location, contiguous, shape...,
+// strides...] to `out` (int64) in one call; shape and strides (in elements)
+// follow the g_row_major order of `fl_shape`. Returns the number of values
+// written, or -1 if `out_len` is less than 6 + 2 * ndim.
+int fl_describe(void* t, void* out, int out_len) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  const int ndim = tensor->ndim();
+  const int len = 6 + 2 * ndim;
+  if (out_len < len) {
+    return -1;
+  }
+  auto* values = reinterpret_cast<int64_t*>(out);
+  values[0] = ndim;
+  values[1] = static_cast<int64_t>(tensor->type());
+  values[2] = tensor->elements();
+  values[3] = tensor->bytes();
+  values[4] = static_cast<int64_t>(tensor->location());
+  values[5] = tensor->isContiguous();
+  const auto& shape = tensor->shape();
+  const auto strides = tensor->strides();
+  for (int i = 0; i < ndim; ++i) {
+    const auto idx = g_row_major ? ndim - i - 1 : i;
+    values[6 + i] = shape[idx];
+    values[6 + ndim + i] = strides[idx];
+  }
+  return len;
+}
+
+void* fl_astype(void* t, int type) {
+  try {
+    LOCK_GUARD
+    auto dtype = static_cast<fl::dtype>(type);
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    auto new_tensor = tensor->astype(dtype);
+    g_bytes_used += new_tensor.bytes();
+    return new fl::Tensor(new_tensor);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+int fl_dtype(void* t) {
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  auto dtype = static_cast<int>(tensor->type());
+  return dtype;
+}
+
+int fl_dtypeFloat16() {
+  int dtype = static_cast<int>(fl::dtype::f16);
+  return dtype;
+}
+
+int fl_dtypeFloat32() {
+  int dtype = static_cast<int>(fl::dtype::f32);
+  return dtype;
+}
+int fl_dtypeFloat64() {
+  int dtype = static_cast<int>(fl::dtype::f64);
+  return dtype;
+}
+
+int fl_dtypeBoolInt8() {
+  int dtype = static_cast<int>(fl::dtype::b8);
+  return dtype;
+}
+
+int fl_dtypeInt16() {
+  int dtype = static_cast<int>(fl::dtype::s16);
+  return dtype;
+}
+
+int fl_dtypeInt32() {
+  int dtype = static_cast<int>(fl::dtype::s32);
+  return dtype;
+}
+
+int fl_dtypeInt64() {
+  int dtype = static_cast<int>(fl::dtype::s64);
+  return dtype;
+}
+
+int fl_dtypeUint8() {
+  int dtype = static_cast<int>(fl::dtype::u8);
+  return dtype;
+}
+
+int fl_dtypeUint16() {
+  int dtype = static_cast<int>(fl::dtype::u16);
+  return dtype;
+}
+
+int fl_dtypeUint32() {
+  int dtype = static_cast<int>(fl::dtype::u32);
+  return dtype;
+}
+
+int fl_dtypeUint64() {
+  int dtype = static_cast<int>(fl::dtype::u64);
+  return dtype;
+}
+
+float* fl_float16Buffer(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    return tensor->astype(fl::dtype::f32).host<float>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+float* fl_float32Buffer(void* t, size_t* len = NULL) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    if (len != NULL) {
+      *len = reinterpret_cast<size_t>(tensor->elements());
+    }
+    return tensor->astype(fl::dtype::f32).host<float>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+float* fl_float64Buffer(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    return tensor->astype(fl::dtype::f64).host<float>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+int* fl_boolInt8Buffer(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    return tensor->astype(fl::dtype::b8).host<int>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+int* fl_int16Buffer(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    return tensor->astype(fl::dtype::s16).host<int>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+int* fl_int32Buffer(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    return tensor->astype(fl::dtype::s32).host<int>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+int* fl_int64Buffer(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    return tensor->astype(fl::dtype::s64).host<int>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+unsigned* fl_uint8Buffer(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    return tensor->astype(fl::dtype::u8).host<unsigned>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+unsigned* fl_uint16Buffer(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    return tensor->astype(fl::dtype::u16).host<unsigned>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+unsigned* fl_uint32Buffer(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    return tensor->astype(fl::dtype::u32).host<unsigned>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+unsigned* fl_uint64Buffer(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    return tensor->astype(fl::dtype::u64).host<unsigned>();
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+float fl_float16Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<float>();
+}
+
+float fl_float32Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<float>();
+}
+
+float fl_float64Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<float>();
+}
+
+char fl_boolInt8Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<char>();
+}
+
+int16_t fl_int16Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<int16_t>();
+}
+
+int32_t fl_int32Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<int32_t>();
+}
+
+int64_t fl_int64Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<int64_t>();
+}
+
+uint8_t fl_uint8Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<uint8_t>();
+}
+
+uint16_t fl_uint16Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<uint16_t>();
+}
+
+uint32_t fl_uint32Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<uint32_t>();
+}
+
+uint64_t fl_uint64Scalar(void* t) {
+  LOCK_GUARD
+  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+  return tensor->asScalar<uint64_t>();
+}
+
+void* fl_index(void* t, void* args_ptr, int64_t args_len) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    const auto indices = indexArgs(args_ptr, args_len, &tensor->shape());
+    auto* new_tensor = new fl::Tensor(tensor->operator()(indices));
+    g_bytes_used += new_tensor->bytes();
+    return new_tensor;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_indexedAssign(void* t, void* other, void* args_ptr, int64_t args_len) {
+  try {
+    LOCK_GUARD
+    const auto indices = indexArgs(args_ptr, args_len, nullptr);
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    auto new_t = tensor->copy();
+    auto* assign = reinterpret_cast<fl::Tensor*>(other);
+    new_t(indices) *= 0;
+    new_t(indices) += *assign;
+    auto* new_tensor = new fl::Tensor(new_t);
+    g_bytes_used += new_tensor->bytes();
+    return new_tensor;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_flatten(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    auto* new_tensor = new fl::Tensor(tensor->flatten());
+    g_bytes_used += new_tensor->bytes();
+    return new_tensor;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_asContiguousTensor(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    auto* new_tensor = new fl::Tensor(tensor->asContiguousTensor());
+    g_bytes_used += new_tensor->bytes();
+    return new_tensor;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_copy(void* t) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    auto* new_tensor = new fl::Tensor(tensor->copy());
+    g_bytes_used += new_tensor->bytes();
+    return new_tensor;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void* fl_pad(void* t,
+           void* before,
+           int64_t before_len,
+           void* after,
+           int64_t after_len) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    if (before_len != after_len) {
+      throw std::invalid_argument("pad needs one before and after per axis");
+    }
+    const ArgSpan before_args(before, before_len, g_row_major);
+    const ArgSpan after_args(after, after_len, g_row_major);
+    std::vector<std::pair<int, int>> pair_vec;
+    pair_vec.reserve(after_len);
+    for (int64_t i = 0; i < after_len; ++i) {
+      pair_vec.emplace_back(before_args[i], after_args[i]);
+    }
+    auto* new_tensor = new fl::Tensor(fl::pad(*tensor, pair_vec));
+    g_bytes_used += new_tensor->bytes();
+    return new_tensor;
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// `grad_in` is Shumai equivalent to Flashlight `gradOutput`
+void* fl_conv2dBackwardData(void* grad_in, void* in, void* wt, int* params) {
+  try {
+    LOCK_GUARD
+    int sx = params[0];
+    int sy = params[1];
+    int px = params[2];
+    int py = params[3];
+    int dx = params[4];
+    int dy = params[5];
+    int groups = params[6];
+    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
+    auto* used_in = reinterpret_cast<fl::Tensor*>(in);
+    auto* used_wt = reinterpret_cast<fl::Tensor*>(wt);
+
+    auto benchmarks =
+        convBenchmarks(*used_in, *used_wt, sx, sy, px, py, dx, dy, groups);
+    auto tuning = lockConvTuning(benchmarks);
+    auto payload = std::make_shared<fl::detail::AutogradPayload>();
+
+    auto result = fl::detail::conv2dBackwardData(
+        *used_grad_in, *used_in, *used_wt, sx, sy, px, py, dx, dy, groups,
+        benchmarks.data, payload);
+
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// `grad_in` is Shumai equivalent to Flashlight `gradOutput`
+void* fl_conv2dBackwardFilter(void* grad_in, void* in, void* wt, int* params) {
+  try {
+    LOCK_GUARD
+    int sx = params[0];
+    int sy = params[1];
+    int px = params[2];
+    int py = params[3];
+    int dx = params[4];
+    int dy = params[5];
+    int groups = params[6];
+    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
+    auto* used_in = reinterpret_cast<fl::Tensor*>(in);
+    auto* used_wt = reinterpret_cast<fl::Tensor*>(wt);
+
+    auto benchmarks =
+        convBenchmarks(*used_in, *used_wt, sx, sy, px, py, dx, dy, groups);
+    auto tuning = lockConvTuning(benchmarks);
+    auto payload = std::make_shared<fl::detail::AutogradPayload>();
+
+    fl::Tensor bs;
+    auto result = std::get<0>(fl::detail::conv2dBackwardFilterBias(
+        *used_grad_in, *used_in, *used_wt, bs, sx, sy, px, py, dx, dy, groups,
+        benchmarks.filter, benchmarks.bias, payload));
+
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// `grad_in` is Shumai equivalent to Flashlight `gradOutput`. Returns the data
+// gradient and writes the filter and bias gradient handles to
+// `grads_out[0..1]`. `bias` may be null; the bias gradient is still computed.
+void* fl_conv2dBackward(void* grad_in,
+                        void* in,
+                        void* wt,
+                        void* bias,
+                        int* params,
+                        void* grads_out) {
+  try {
+    LOCK_GUARD
+    int sx = params[0];
+    int sy = params[1];
+    int px = params[2];
+    int py = params[3];
+    int dx = params[4];
+    int dy = params[5];
+    int groups = params[6];
+    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
+    auto* used_in = reinterpret_cast<fl::Tensor*>(in);
+    auto* used_wt = reinterpret_cast<fl::Tensor*>(wt);
+    auto* used_bias = reinterpret_cast<fl::Tensor*>(bias);
+
+    auto benchmarks =
+        convBenchmarks(*used_in, *used_wt, sx, sy, px, py, dx, dy, groups);
+    auto tuning = lockConvTuning(benchmarks);
+    auto payload = std::make_shared<fl::detail::AutogradPayload>();
+
+    auto data_grad = fl::detail::conv2dBackwardData(
+        *used_grad_in, *used_in, *used_wt, sx, sy, px, py, dx, dy, groups,
+        benchmarks.data, payload);
+
+    // Only the bias shape is used; it selects the bias gradient computation.
+    auto bs = used_bias ? *used_bias
+                        : fl::Tensor(fl::Shape({1, 1, used_wt->dim(3), 1}),
+                                     used_grad_in->type());
+    auto filter_bias = fl::detail::conv2dBackwardFilterBias(
+        *used_grad_in, *used_in, *used_wt, bs, sx, sy, px, py, dx, dy, groups,
+        benchmarks.filter, benchmarks.bias, payload);
+
+    auto** grads = reinterpret_cast<void**>(grads_out);
+    grads[0] = new fl::Tensor(std::get<0>(filter_bias));
+    grads[1] = new fl::Tensor(std::get<1>(filter_bias));
+    g_bytes_used += data_grad.bytes() + std::get<0>(filter_bias).bytes() +
+        std::get<1>(filter_bias).bytes();
+    return new fl::Tensor(data_grad);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// `activation` is 0 (none), 1 (relu), 2 (gelu) or 3 (sigmoid). `bias` may be
+// null and is added along the last (row-major) dimension of the product.
+void* fl_linear(void* x,
+                void* w,
+                void* bias,
+                bool trans_x,
+                bool trans_w,
+                int32_t activation) {
+  try {
+    LOCK_GUARD
+    auto* used_x = reinterpret_cast<fl::Tensor*>(x);
+    auto* used_w = reinterpret_cast<fl::Tensor*>(w);
+    auto* used_bias = reinterpret_cast<fl::Tensor*>(bias);
+    if (activation < 0 || activation > 3) {
+      throw std::invalid_argument("unknown activation");
+    }
+    auto result = linear(*used_x, *used_w, used_bias, trans_x, trans_w,
+                         static_cast<Activation>(activation));
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// Batched `fl_matmul` over leading dimensions; either side may broadcast.
+void* fl_bmm(void* tensor, void* other) {
+  try {
+    LOCK_GUARD
+    auto* tensor_ptr = reinterpret_cast<fl::Tensor*>(tensor);
+    auto* other_ptr = reinterpret_cast<fl::Tensor*>(other);
+    auto result = bmm(*tensor_ptr, *other_ptr);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// Returns int8 weights (b8 storage) quantized symmetrically per channel along
+// `axis` and writes the f32 scales handle to `scales_out`.
+void* fl_quantizePerChannel(void* t, int32_t axis, void* scales_out) {
+  try {
+    LOCK_GUARD
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    auto used_axis = axisArg(axis, g_row_major, tensor->ndim());
+    fl::Tensor scales;
+    auto result = quantizePerChannel(*tensor, used_axis, scales);
+    reinterpret_cast<void**>(scales_out)[0] = new fl::Tensor(scales);
+    g_bytes_used += result.bytes() + scales.bytes();
+    return new fl::Tensor(result);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// Row-major [M, K] input times [N, K] quantized weights (as produced by
+// `fl_quantizePerChannel(w, 0)`), giving [M, N]. `x` is f32 or int8 with
+// per-tensor `x_scale`. With `out_scale` > 0 the result is requantized to int8,
+// otherwise it is dequantized to f32. `bias` may be null.
+void* fl_qlinear(void* x,
+                 float x_scale,
+                 void* qweight,
+                 void* scales,
+                 void* bias,
+                 float out_scale) {
+  try {
+    LOCK_GUARD
+    auto* used_x = reinterpret_cast<fl::Tensor*>(x);
+    auto* used_qweight = reinterpret_cast<fl::Tensor*>(qweight);
+    auto* used_scales = reinterpret_cast<fl::Tensor*>(scales);
+    auto* used_bias = reinterpret_cast<fl::Tensor*>(bias);
+    auto result = qlinear(*used_x, x_scale, *used_qweight, *used_scales,
+                          used_bias, out_scale);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// Fused scaled dot-product attention over row-major q [..., Lq, D],
+// k [..., Lk, D] and v [..., Lk, Dv], never materializing the [Lq, Lk] scores
+// on host. `mask` (nullable) is additive, or boolean with set entries kept, and
+// is [Lq, Lk] or [..., Lq, Lk]. With `causal` query i only attends to keys
+// 0..i, and a query with every key masked out gets zeros. Writes the per-query
+// logsumexp handle to `lse_out[0]` for `fl_attentionBackward`.
+void* fl_attention(void* q,
+                   void* k,
+                   void* v,
+                   void* mask,
+                   bool causal,
+                   void* lse_out) {
+  try {
+    LOCK_GUARD
+    auto* used_q = reinterpret_cast<fl::Tensor*>(q);
+    auto* used_k = reinterpret_cast<fl::Tensor*>(k);
+    auto* used_v = reinterpret_cast<fl::Tensor*>(v);
+    auto* used_mask = reinterpret_cast<fl::Tensor*>(mask);
+    fl::Tensor result, lse;
+    attentionForward(*used_q, *used_k, *used_v, used_mask, causal, result, lse);
+    reinterpret_cast<void**>(lse_out)[0] = new fl::Tensor(lse);
+    g_bytes_used += result.bytes() + lse.bytes();
+    return new fl::Tensor(result);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// `out` and `lse` are the results of `fl_attention` with the same inputs;
+// `grad` has the shape of `out`, and any other shapes fail with a null return.
+// Returns the q gradient and writes the k and v gradient handles to
+// `grads_out[0..1]`.
+void* fl_attentionBackward(void* grad_in,
+                           void* q,
+                           void* k,
+                           void* v,
+                           void* mask,
+                           void* out,
+                           void* lse,
+                           bool causal,
+                           void* grads_out) {
+  try {
+    LOCK_GUARD
+    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
+    auto* used_q = reinterpret_cast<fl::Tensor*>(q);
+    auto* used_k = reinterpret_cast<fl::Tensor*>(k);
+    auto* used_v = reinterpret_cast<fl::Tensor*>(v);
+    auto* used_mask = reinterpret_cast<fl::Tensor*>(mask);
+    auto* used_out = reinterpret_cast<fl::Tensor*>(out);
+    auto* used_lse = reinterpret_cast<fl::Tensor*>(lse);
+    fl::Tensor dq, dk, dv;
+    attentionBackward(*used_grad_in, *used_q, *used_k, *used_v, used_mask,
+                      *used_out, *used_lse, causal, dq, dk, dv);
+    auto** grads = reinterpret_cast<void**>(grads_out);
+    grads[0] = new fl::Tensor(dk);
+    grads[1] = new fl::Tensor(dv);
+    g_bytes_used += dq.bytes() + dk.bytes() + dv.bytes();
+    return new fl::Tensor(dq);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// Looks up rows of a [vocab, dim] table for integer `ids` of any shape.
+void* fl_embedding(void* table, void* ids) {
+  try {
+    LOCK_GUARD
+    auto* used_table = reinterpret_cast<fl::Tensor*>(table);
+    auto* used_ids = reinterpret_cast<fl::Tensor*>(ids);
+    auto result = embedding(*used_table, *used_ids);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// Returns the distinct ids (int64, ascending) of an `fl_embedding` call and
+// writes the handle of their summed gradient rows [unique, dim] to
+// `rows_out[0]`.
+void* fl_embeddingBackward(void* grad_in, void* ids, void* rows_out) {
+  try {
+    LOCK_GUARD
+    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
+    auto* used_ids = reinterpret_cast<fl::Tensor*>(ids);
+    fl::Tensor rows;
+    auto result = embeddingBackward(*used_grad_in, *used_ids, rows);
+    reinterpret_cast<void**>(rows_out)[0] = new fl::Tensor(rows);
+    g_bytes_used += result.bytes() + rows.bytes();
+    return new fl::Tensor(result);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+// Adds `alpha` * `rows` [n, dim] into the table rows named by `ids` in place,
+// e.g. alpha = -lr with the output of `fl_embeddingBackward`. Returns 0, or -1
+// on error.
+int fl_embeddingUpdate(void* table, void* ids, void* rows, double alpha) {
+  try {
+    LOCK_GUARD
+    auto* used_table = reinterpret_cast<fl::Tensor*>(table);
+    auto* used_ids = reinterpret_cast<fl::Tensor*>(ids);
+    auto* used_rows = reinterpret_cast<fl::Tensor*>(rows);
+    embeddingUpdate(*used_table, *used_ids, *used_rows, alpha);
+    return 0;
+  } catch (std::exception const& e) {
+    RECORD_EXCEPTION(e);
+    return -1;
+  } catch (...) {
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
+  }
+}
+
+// Updates `len` parameters and their Adam moments in place in one call.
+// `params`, `grads`, `m` and `v` are arrays of tensor handles and `hyper` holds
+// {lr, beta1, beta2, eps, weight_decay, step} as doubles. With `decoupled` the
+// weight decay is AdamW-style. Returns 0, or -1 on error.
+int fl_adamStep(void* params,
+                void* grads,
+                void* m,
+                void* v,
+                int64_t len,
+                void* hyper,
+                bool decoupled) {
+  try {
+    LOCK_GUARD
+    if (!params || !grads || !m || !v) {
+      throw std::invalid_argument("missing parameter, gradient or moment list");
+    }
+    if (!hyper) {
+      throw std::invalid_argument("missing Adam hyperparameters");
+    }
+    auto groups = tensorGroups({params, grads, m, v}, len);
+    const auto* h = reinterpret_cast<const double*>(hyper);
+    adamStep(groups, {h[0], h[1], h[2], h[3], h[4], h[5], decoupled});
+    return 0;
+  } catch (std::exception const& e) {
+    RECORD_EXCEPTION(e);
+    return -1;
+  } catch (...) {
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
+  }
+}
+
+// SGD counterpart of `fl_adamStep`. `momentum_buffers` may be null when the
+// momentum is 0, and `hyper` holds {lr, momentum, dampening, weight_decay,
+// nesterov}.
+int fl_sgdStep(void* params,
+               void* grads,
+               void* momentum_buffers,
+               int64_t len,
+               void* hyper) {
+  try {
+    LOCK_GUARD
+    if (!params || !grads) {
+      throw std::invalid_argument("missing parameter or gradient list");
+    }
+    if (!hyper) {
+      throw std::invalid_argument("missing SGD hyperparameters");
+    }
+    const auto* h = reinterpret_cast<const double*>(hyper);
+    auto groups = tensorGroups(
+        {params, grads, h[1] != 0 ? momentum_buffers : nullptr}, len);
+    sgdStep(groups, {h[0], h[1], h[2], h[3], h[4] != 0});
+    return 0;
+  } catch (std::exception const& e) {
+    RECORD_EXCEPTION(e);
+    return -1;
+  } catch (...) {
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
+  }
+}
+
+// Scales the `len` gradients in place so that their global L2 norm is at most
+// `max_norm`, in one call. Returns the norm before clipping, or -1 on error.
+double fl_clipByGlobalNorm(void* grads, int64_t len, double max_norm) {
+  try {
+    LOCK_GUARD
+    if (!grads) {
+      throw std::invalid_argument("missing gradient list");
+    }
+    return clipByGlobalNorm(tensorGroups({grads}, len), max_norm);
+  } catch (std::exception const& e) {
+    RECORD_EXCEPTION(e);
+    return -1;
+  } catch (...) {
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
+  }
+}
+
+// Creates an explicit Philox generator. Fills from it are reproducible for a
+// given seed and call sequence, independent of the thread count.
+void* fl_createRng(uint64_t seed) {
+  try {
+    return new Rng(seed);
+  } catch (std::exception const& e) {
+    HANDLE_EXCEPTION(e);
+  } catch (...) {
+    HANDLE_EXCEPTION("[unknown]");
+  }
+}
+
+void fl_destroyRng(void* rng) {
+  delete reinterpret_cast<Rng*>(rng);
 }
 
-void* fl_tensorFromFloat16Buffer(int64_t numel, void* ptr) {
+// Fills `t` in place with uniform [0, 1) values. Returns 0, or -1 on error.
+int fl_randInto(void* rng, void* t) {
   try {
     LOCK_GUARD
-    auto* t = new fl::Tensor(
-        fl::Tensor::fromBuffer({numel}, (float*)ptr, fl::MemoryLocation::Host)
-            .astype(fl::dtype::f16));
-    g_bytes_used += t->bytes();
-    return t;
+    randomInto(*reinterpret_cast<Rng*>(rng), *reinterpret_cast<fl::Tensor*>(t),
+               false);
+    return 0;
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    RECORD_EXCEPTION(e);
+    return -1;
   } catch (...) {
-    HANDLE_EXCEPTION("[unknown]");
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
   }
 }
 
-void* fl_tensorFromFloat32Buffer(int64_t numel, void* ptr) {
+// Fills `t` in place with standard normal values. Returns 0, or -1 on error.
+int fl_randnInto(void* rng, void* t) {
   try {
     LOCK_GUARD
-    auto* t = new fl::Tensor(
-        fl::Tensor::fromBuffer({numel}, (float*)ptr, fl::MemoryLocation::Host));
-    g_bytes_used += t->bytes();
-    return t;
+    randomInto(*reinterpret_cast<Rng*>(rng), *reinterpret_cast<fl::Tensor*>(t),
+               true);
+    return 0;
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    RECORD_EXCEPTION(e);
+    return -1;
   } catch (...) {
-    HANDLE_EXCEPTION("[unknown]");
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
   }
 }
 
-void* fl_tensorFromFloat64Buffer(int64_t numel, void* ptr) {
+// Fused dropout with probability `p` drawing from `rng`. When `mask_out` is set
+// the bit-packed keep mask (u8, one bit per element) handle is written to
+// `mask_out[0]` for `fl_dropoutBackward`.
+void* fl_dropout(void* t, double p, void* rng, void* mask_out) {
   try {
     LOCK_GUARD
-    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (double*)ptr,
-                                                    fl::MemoryLocation::Host));
-    g_bytes_used += t->bytes();
-    return t;
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    fl::Tensor mask;
+    auto result = dropout(*tensor, p, *reinterpret_cast<Rng*>(rng), mask);
+    if (mask_out) {
+      reinterpret_cast<void**>(mask_out)[0] = new fl::Tensor(mask);
+      g_bytes_used += mask.bytes();
+    }
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_tensorFromInt8Buffer(int64_t numel, void* ptr) {
+void* fl_dropoutBackward(void* grad_in, void* mask, double p) {
   try {
     LOCK_GUARD
-    auto* t = new fl::Tensor(
-        fl::Tensor::fromBuffer({numel}, (char*)ptr, fl::MemoryLocation::Host));
-    g_bytes_used += t->bytes();
-    return t;
+    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
+    auto* used_mask = reinterpret_cast<fl::Tensor*>(mask);
+    auto result = dropoutBackward(*used_grad_in, *used_mask, p);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_tensorFromInt16Buffer(int64_t numel, void* ptr) {
+// Enables memoization of fl_full, fl_identity, fl_arange and fl_iota results
+// with up to `max_bytes` of cached storage. Disabling it drops the entries.
+void fl_setConstantCache(bool enabled, int64_t max_bytes) {
+  ConstantCache::get().configure(enabled, max_bytes);
+}
+
+void fl_clearConstantCache() {
+  ConstantCache::get().clear();
+}
+
+// Writes {hits, misses, cached bytes, entries} to `out`.
+void fl_constantCacheStats(void* out) {
+  ConstantCache::get().stats(reinterpret_cast<int64_t*>(out));
+}
+
+// Stacks same-shape tensors along a new `axis` of the result.
+void* fl_stack(void* tensors_ptr, int64_t tensors_len, int32_t axis) {
   try {
     LOCK_GUARD
-    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (int16_t*)ptr,
-                                                    fl::MemoryLocation::Host));
-    g_bytes_used += t->bytes();
-    return t;
+    TensorSpan tensors(tensors_ptr, tensors_len);
+    if (tensors_len == 0) {
+      throw std::invalid_argument("fl_stack expects at least one tensor");
+    }
+    auto used_axis = axisArg(axis, g_row_major, tensors[0].ndim() + 1);
+    auto result = stack(tensors, used_axis);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_tensorFromInt32Buffer(int64_t numel, void* ptr) {
+// Saves `count` tensors under `names` (NUL-separated, `names_len` bytes) as a
+// mappable checkpoint readable with `fl_openCheckpoint`. Returns 0, or -1 on
+// error.
+int fl_saveCheckpoint(void* cstr_ptr,
+                      int length,
+                      void* names_ptr,
+                      int64_t names_len,
+                      void* tensors_ptr,
+                      int64_t count) {
   try {
     LOCK_GUARD
-    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (int32_t*)ptr,
-                                                    fl::MemoryLocation::Host));
-    g_bytes_used += t->bytes();
-    return t;
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    saveCheckpoint(std::string(cstr, length),
+                   nulSeparated(names_ptr, names_len),
+                   TensorSpan(tensors_ptr, count));
+    return 0;
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    RECORD_EXCEPTION(e);
+    return -1;
   } catch (...) {
-    HANDLE_EXCEPTION("[unknown]");
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
   }
 }
 
-void* fl_tensorFromInt64Buffer(int64_t numel, void* ptr) {
+// Maps a checkpoint and reads its header; no tensor data is touched until
+// `fl_checkpointTensor`. Close the handle with `fl_closeCheckpoint`.
+void* fl_openCheckpoint(void* cstr_ptr, int length) {
   try {
-    LOCK_GUARD
-    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (int64_t*)ptr,
-                                                    fl::MemoryLocation::Host));
-    g_bytes_used += t->bytes();
-    return t;
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    return new MappedCheckpoint(std::string(cstr, length));
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_tensorFromUint8Buffer(int64_t numel, void* ptr) {
+void fl_closeCheckpoint(void* checkpoint) {
+  delete reinterpret_cast<MappedCheckpoint*>(checkpoint);
+}
+
+int64_t fl_checkpointCount(void* checkpoint) {
+  return reinterpret_cast<MappedCheckpoint*>(checkpoint)->names().size();
+}
+
+// Copies up to `out_len` bytes of the name of tensor `index` to `out` and
+// returns its full length, or -1 if `index` is out of range.
+int fl_checkpointName(void* checkpoint, int64_t index, void* out, int out_len) {
+  const auto& names = reinterpret_cast<MappedCheckpoint*>(checkpoint)->names();
+  if (index < 0 || index >= static_cast<int64_t>(names.size())) {
+    return -1;
+  }
+  const auto& name = names[index];
+  std::memcpy(
+      out, name.data(), std::min<size_t>(name.size(), std::max(out_len, 0)));
+  return name.size();
+}
+
+void* fl_checkpointTensor(void* checkpoint, void* cstr_ptr, int length) {
   try {
     LOCK_GUARD
-    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (uint8_t*)ptr,
-                                                    fl::MemoryLocation::Host));
-    g_bytes_used += t->bytes();
-    return t;
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    auto* used_checkpoint = reinterpret_cast<MappedCheckpoint*>(checkpoint);
+    bool shared = false;
+    auto result = used_checkpoint->load(std::string(cstr, length), shared);
+    g_bytes_used += result.bytes();
+    auto* handle = new fl::Tensor(result);
+    if (shared) {
+      markShared(handle);
+    }
+    return handle;
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_tensorFromUint16Buffer(int64_t numel, void* ptr) {
+// Writes `count` tensors named by `names` (NUL-separated, `names_len` bytes)
+// to one checkpoint file with a CRC32C per tensor, using parallel chunked
+// writes and a single fsync. Returns 0, or -1 on error.
+int fl_saveBundle(void* names_ptr,
+                  int64_t names_len,
+                  void* tensors_ptr,
+                  int64_t count,
+                  void* cstr_ptr,
+                  int length) {
   try {
     LOCK_GUARD
-    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (uint16_t*)ptr,
-                                                    fl::MemoryLocation::Host));
-    g_bytes_used += t->bytes();
-    return t;
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    saveBundle(std::string(cstr, length), nulSeparated(names_ptr, names_len),
+               TensorSpan(tensors_ptr, count));
+    return 0;
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    RECORD_EXCEPTION(e);
+    return -1;
   } catch (...) {
-    HANDLE_EXCEPTION("[unknown]");
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
   }
 }
 
-void* fl_tensorFromUint32Buffer(int64_t numel, void* ptr) {
+// Opens a bundle (or any checkpoint) and reads every tensor up front with
+// parallel chunked reads, verifying checksums. Returns a checkpoint handle for
+// `fl_checkpointTensor` and friends, or null on error.
+void* fl_loadBundle(void* cstr_ptr, int length) {
   try {
     LOCK_GUARD
-    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (uint32_t*)ptr,
-                                                    fl::MemoryLocation::Host));
-    g_bytes_used += t->bytes();
-    return t;
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    auto checkpoint =
+        std::make_unique<MappedCheckpoint>(std::string(cstr, length));
+    checkpoint->preload();
+    return checkpoint.release();
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_tensorFromUint64Buffer(int64_t numel, void* ptr) {
+// Starts writing `count` tensors as a bundle (see `fl_saveBundle`) on a
+// background thread and returns a job handle, or null on error. The tensors
+// are snapshotted copy-on-write: later in-place updates give the caller's
+// handles fresh storage, so training can continue while the write runs. Blocks
+// only while in-flight snapshots exceed the `fl_setSaveAsyncLimit` budget.
+void* fl_saveAsync(void* names_ptr,
+                   int64_t names_len,
+                   void* tensors_ptr,
+                   int64_t count,
+                   void* cstr_ptr,
+                   int length) {
   try {
     LOCK_GUARD
-    auto* t = new fl::Tensor(fl::Tensor::fromBuffer({numel}, (uint64_t*)ptr,
-                                                    fl::MemoryLocation::Host));
-    g_bytes_used += t->bytes();
-    return t;
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    TensorSpan tensors(tensors_ptr, count);
+    auto snapshot = snapshotBundle(nulSeparated(names_ptr, names_len), tensors);
+    for (int64_t i = 0; i < count; ++i) {
+      markShared(&tensors[i]);
+    }
+    auto job = AsyncSaver::get().submit(std::string(cstr, length),
+                                        std::move(snapshot));
+    return new std::shared_ptr<SaveJob>(std::move(job));
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void fl_destroyTensor(void* t, void* /*ignore*/) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  if (tensor->hasAdapter()) {
-    g_bytes_used -= tensor->bytes();
+// Returns 1 once the save finished, 0 while it is pending and -1 if it failed.
+int fl_saveAsyncStatus(void* job_ptr) {
+  auto& job = *reinterpret_cast<std::shared_ptr<SaveJob>*>(job_ptr);
+  std::lock_guard<std::mutex> guard(job->mutex);
+  if (!job->done) {
+    return 0;
   }
-  delete tensor;
-}
-
-void fl_dispose(void* t) {
-  LOCK_GUARD
-  auto& tensor = *reinterpret_cast<fl::Tensor*>(t);
-  g_bytes_used -= tensor.bytes();
-  fl::detail::releaseAdapterUnsafe(tensor);
-}
-
-typedef void (*JSTypedArrayBytesDeallocator)(void* bytes,
-                                             void* deallocatorContext);
-
-JSTypedArrayBytesDeallocator fl_genTensorDestroyer() {
-  return fl_destroyTensor;
-}
-
-void fl_setRowMajor() {
-  g_row_major = true;
-}
-
-void fl_setColMajor() {
-  g_row_major = false;
+  return job->error ? -1 : 1;
 }
 
-bool fl_isRowMajor() {
-  return g_row_major;
+// Blocks until the save finished. Returns 0, or -1 if it failed.
+int fl_saveAsyncWait(void* job_ptr) {
+  auto& job = *reinterpret_cast<std::shared_ptr<SaveJob>*>(job_ptr);
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->cv.wait(lock, [&] { return job->done; });
+  if (job->error) {
+    try {
+      std::rethrow_exception(job->error);
+    } catch (std::exception const& e) {
+      RECORD_EXCEPTION(e);
+    } catch (...) {
+      RECORD_EXCEPTION("[unknown]");
+    }
+    return -1;
+  }
+  return 0;
 }
 
-bool fl_isColMajor() {
-  return !g_row_major;
+// Frees a job handle; a pending save still completes.
+void fl_destroySaveAsync(void* job_ptr) {
+  delete reinterpret_cast<std::shared_ptr<SaveJob>*>(job_ptr);
 }
 
-void fl_save(void* t, void* cstr_ptr, int length) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  const char* cstr = reinterpret_cast<char*>(cstr_ptr);
-  auto filename = std::string(cstr, length);
-  fl::save(filename, *tensor);
+// Bytes of snapshots that may be queued or in progress before `fl_saveAsync`
+// blocks (default 2 GiB); 0 disables the limit.
+void fl_setSaveAsyncLimit(int64_t bytes) {
+  AsyncSaver::get().setLimit(bytes);
 }
 
-void* fl_load(void* cstr_ptr, int length) {
+// Reads a .npy file through a read-only mapping, copying the data straight
+// into the tensor. See `NpyArray` for how `fortran_order` maps onto dims.
+void* fl_loadNpy(void* cstr_ptr, int length) {
   try {
     LOCK_GUARD
     const char* cstr = reinterpret_cast<char*>(cstr_ptr);
-    auto filename = std::string(cstr, length);
-    fl::Tensor tensor;
-    fl::load(filename, tensor);
-    auto* t = new fl::Tensor(tensor);
-    g_bytes_used += t->bytes();
-    return t;
+    MappedFile file(std::string(cstr, length));
+    auto result = npyTensor(file.data(), file.size());
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void fl_eval(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  fl::eval(*tensor);
-}
-
-size_t fl_elements(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->elements();
-}
-
-size_t fl_bytes(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->bytes();
-}
-
-int fl_shape(void* t, void* out, int out_len) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  if (out_len != tensor->ndim()) {
+// Writes `t` as a .npy file. Returns 0, or -1 on error.
+int fl_saveNpy(void* t, void* cstr_ptr, int length) {
+  try {
+    LOCK_GUARD
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    saveNpy(std::string(cstr, length), *reinterpret_cast<fl::Tensor*>(t));
+    return 0;
+  } catch (std::exception const& e) {
+    RECORD_EXCEPTION(e);
+    return -1;
+  } catch (...) {
+    RECORD_EXCEPTION("[unknown]");
     return -1;
   }
-  for (auto i = 0; i < out_len; ++i) {
-    const auto idx = g_row_major ? out_len - i - 1 : i;
-    reinterpret_cast<int64_t*>(out)[i] = tensor->shape()[idx];
-  }
-  return 0;
-}
-
-int fl_ndim(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->ndim();
 }
 
-void* fl_astype(void* t, int type) {
+// Maps an uncompressed .npz archive and reads its directory. Close the handle
+// with `fl_closeNpz`.
+void* fl_openNpz(void* cstr_ptr, int length) {
   try {
-    LOCK_GUARD
-    auto dtype = static_cast<fl::dtype>(type);
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    auto new_tensor = tensor->astype(dtype);
-    g_bytes_used += new_tensor.bytes();
-    return new fl::Tensor(new_tensor);
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    return new NpzArchive(std::string(cstr, length));
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-int fl_dtype(void* t) {
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  auto dtype = static_cast<int>(tensor->type());
-  return dtype;
-}
-
-int fl_dtypeFloat16() {
-  int dtype = static_cast<int>(fl::dtype::f16);
-  return dtype;
-}
-
-int fl_dtypeFloat32() {
-  int dtype = static_cast<int>(fl::dtype::f32);
-  return dtype;
-}
-int fl_dtypeFloat64() {
-  int dtype = static_cast<int>(fl::dtype::f64);
-  return dtype;
-}
-
-int fl_dtypeBoolInt8() {
-  int dtype = static_cast<int>(fl::dtype::b8);
-  return dtype;
-}
-
-int fl_dtypeInt16() {
-  int dtype = static_cast<int>(fl::dtype::s16);
-  return dtype;
-}
-
-int fl_dtypeInt32() {
-  int dtype = static_cast<int>(fl::dtype::s32);
-  return dtype;
-}
-
-int fl_dtypeInt64() {
-  int dtype = static_cast<int>(fl::dtype::s64);
-  return dtype;
-}
-
-int fl_dtypeUint8() {
-  int dtype = static_cast<int>(fl::dtype::u8);
-  return dtype;
-}
-
-int fl_dtypeUint16() {
-  int dtype = static_cast<int>(fl::dtype::u16);
-  return dtype;
+void fl_closeNpz(void* archive) {
+  delete reinterpret_cast<NpzArchive*>(archive);
 }
 
-int fl_dtypeUint32() {
-  int dtype = static_cast<int>(fl::dtype::u32);
-  return dtype;
+int64_t fl_npzCount(void* archive) {
+  return reinterpret_cast<NpzArchive*>(archive)->names().size();
 }
 
-int fl_dtypeUint64() {
-  int dtype = static_cast<int>(fl::dtype::u64);
-  return dtype;
+// Copies up to `out_len` bytes of the name of array `index` to `out` and
+// returns its full length, or -1 if `index` is out of range.
+int fl_npzName(void* archive, int64_t index, void* out, int out_len) {
+  const auto& names = reinterpret_cast<NpzArchive*>(archive)->names();
+  if (index < 0 || index >= static_cast<int64_t>(names.size())) {
+    return -1;
+  }
+  const auto& name = names[index];
+  std::memcpy(
+      out, name.data(), std::min<size_t>(name.size(), std::max(out_len, 0)));
+  return name.size();
 }
 
-float* fl_float16Buffer(void* t) {
+void* fl_npzTensor(void* archive, void* cstr_ptr, int length) {
   try {
     LOCK_GUARD
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    return tensor->astype(fl::dtype::f32).host<float>();
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    auto result = reinterpret_cast<NpzArchive*>(archive)->load(
+        std::string(cstr, length));
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-float* fl_float32Buffer(void* t, size_t* len = NULL) {
+// Writes `count` tensors named by `names` (NUL-separated, `names_len` bytes)
+// as an uncompressed .npz archive. Returns 0, or -1 on error.
+int fl_saveNpz(void* names_ptr,
+               int64_t names_len,
+               void* tensors_ptr,
+               int64_t count,
+               void* cstr_ptr,
+               int length) {
   try {
     LOCK_GUARD
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    if (len != NULL) {
-      *len = reinterpret_cast<size_t>(tensor->elements());
-    }
-    return tensor->astype(fl::dtype::f32).host<float>();
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    saveNpz(std::string(cstr, length), nulSeparated(names_ptr, names_len),
+            TensorSpan(tensors_ptr, count));
+    return 0;
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    RECORD_EXCEPTION(e);
+    return -1;
   } catch (...) {
-    HANDLE_EXCEPTION("[unknown]");
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
   }
 }
 
-float* fl_float64Buffer(void* t) {
+// Opens a streaming loader over the records in a file; see `DataLoader`.
+// `shape` is one sample's shape and `type` its dtype. `workers` threads fill
+// up to `prefetch` batches ahead. Free with `fl_destroyLoader`.
+void* fl_createLoader(void* cstr_ptr,
+                      int length,
+                      void* shape_ptr,
+                      int64_t shape_len,
+                      int type,
+                      bool length_prefixed,
+                      int64_t batch_size,
+                      uint64_t seed,
+                      bool shuffle,
+                      bool drop_last,
+                      int prefetch,
+                      int workers) {
   try {
     LOCK_GUARD
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    return tensor->astype(fl::dtype::f64).host<float>();
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    LoaderOptions options;
+    options.sample_dims =
+        arrayArg<long long>(shape_ptr, shape_len, g_row_major, false);
+    options.type = static_cast<fl::dtype>(type);
+    options.length_prefixed = length_prefixed;
+    options.batch_size = batch_size;
+    options.seed = seed;
+    options.shuffle = shuffle;
+    options.drop_last = drop_last;
+    options.prefetch = prefetch;
+    options.workers = workers;
+    return new DataLoader(std::string(cstr, length), std::move(options));
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-int* fl_boolInt8Buffer(void* t) {
+void fl_destroyLoader(void* loader) {
+  LOCK_GUARD
+  delete reinterpret_cast<DataLoader*>(loader);
+}
+
+int64_t fl_loaderSize(void* loader) {
+  return reinterpret_cast<DataLoader*>(loader)->size();
+}
+
+// Writes the next batch to `out[0]` and, for length-prefixed files, the
+// per-record element counts to `out[1]` (null otherwise). Returns 1, 0 at the
+// end of an epoch (the next call starts a reshuffled one), or -1 on error.
+int fl_loaderNext(void* loader, void* out) {
   try {
     LOCK_GUARD
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    return tensor->astype(fl::dtype::b8).host<int>();
+    fl::Tensor batch;
+    fl::Tensor lengths;
+    bool has_lengths = false;
+    if (!reinterpret_cast<DataLoader*>(loader)->next(
+            batch, lengths, has_lengths)) {
+      return 0;
+    }
+    auto** handles = reinterpret_cast<void**>(out);
+    g_bytes_used += batch.bytes();
+    handles[0] = new fl::Tensor(batch);
+    handles[1] = nullptr;
+    if (has_lengths) {
+      g_bytes_used += lengths.bytes();
+      handles[1] = new fl::Tensor(lengths);
+    }
+    return 1;
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    RECORD_EXCEPTION(e);
+    return -1;
   } catch (...) {
-    HANDLE_EXCEPTION("[unknown]");
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
   }
 }
 
-int* fl_int16Buffer(void* t) {
-  try {
-    LOCK_GUARD
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    return tensor->astype(fl::dtype::s16).host<int>();
-  } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
-  } catch (...) {
-    HANDLE_EXCEPTION("[unknown]");
+// Returns the code of the last failure on this thread (an ErrorCode, 0 if
+// none) and copies its message, NUL-terminated and truncated to `out_len`
+// bytes, to `out` when it is non-null.
+int fl_lastError(void* out, int out_len) {
+  const auto& error = t_last_error;
+  if (out && out_len > 0) {
+    std::snprintf(reinterpret_cast<char*>(out), out_len, "%s", error.message);
   }
+  return error.code;
 }
 
-int* fl_int32Buffer(void* t) {
+void fl_clearLastError() {
+  t_last_error = LastError();
+}
+
+// Logs at most `per_second` native failures to stderr (default 10); 0 turns
+// logging off. Failures are recorded for `fl_lastError` either way.
+void fl_setErrorLogging(int per_second) {
+  g_error_log_rate = per_second;
+}
+
+// Enables Flashlight's conv algorithm autotuning for subsequent calls
+void fl_setConvBenchmarkMode(bool enabled) {
+  fl::DynamicBenchmark::setBenchmarkMode(enabled);
+}
+
+// Writes the tuned conv algorithm choices; returns the number of entries
+int fl_saveConvBenchmarks(void* cstr_ptr, int length) {
   try {
-    LOCK_GUARD
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    return tensor->astype(fl::dtype::s32).host<int>();
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    return saveConvBenchmarks(std::string(cstr, length));
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    RECORD_EXCEPTION(e);
+    return -1;
   } catch (...) {
-    HANDLE_EXCEPTION("[unknown]");
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
   }
 }
 
-int* fl_int64Buffer(void* t) {
+// Reloads choices written by `fl_saveConvBenchmarks`, which `fl_init` also does
+// for the file named by FL_CONV_BENCHMARK_CACHE
+int fl_loadConvBenchmarks(void* cstr_ptr, int length) {
   try {
-    LOCK_GUARD
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    return tensor->astype(fl::dtype::s64).host<int>();
+    const char* cstr = reinterpret_cast<char*>(cstr_ptr);
+    return loadConvBenchmarks(std::string(cstr, length));
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    RECORD_EXCEPTION(e);
+    return -1;
   } catch (...) {
-    HANDLE_EXCEPTION("[unknown]");
+    RECORD_EXCEPTION("[unknown]");
+    return -1;
   }
 }
 
-unsigned* fl_uint8Buffer(void* t) {
+void fl_clearConvBenchmarks() {
+  std::lock_guard<std::mutex> guard(g_conv_benchmarks_mutex);
+  g_conv_benchmarks.clear();
+  g_conv_benchmark_index.clear();
+}
+
+// Returns the sorted values and writes the int64 permutation handle to
+// `indices_out`. Host tensors use a stable radix sort; other devices fall back
+// to the backend sort.
+void* fl_sortWithIndices(void* t,
+                         int32_t axis,
+                         bool descending,
+                         void* indices_out) {
   try {
     LOCK_GUARD
     auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    return tensor->astype(fl::dtype::u8).host<unsigned>();
+    auto used_axis = axisArg(axis, g_row_major, tensor->ndim());
+    fl::Tensor values;
+    fl::Tensor indices;
+    if (!sortWithIndices(*tensor, used_axis, descending, values, indices)) {
+      fl::sort(values, indices, *tensor, used_axis,
+               descending ? fl::SortMode::Descending : fl::SortMode::Ascending);
+      indices = indices.astype(fl::dtype::s64);
+    }
+    auto* indices_tensor = new fl::Tensor(indices);
+    g_bytes_used += values.bytes() + indices.bytes();
+    reinterpret_cast<void**>(indices_out)[0] = indices_tensor;
+    return new fl::Tensor(values);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-unsigned* fl_uint16Buffer(void* t) {
+void* fl_argsort(void* t, int32_t axis, bool descending) {
   try {
     LOCK_GUARD
     auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    return tensor->astype(fl::dtype::u16).host<unsigned>();
+    auto used_axis = axisArg(axis, g_row_major, tensor->ndim());
+    fl::Tensor values;
+    fl::Tensor indices;
+    if (!sortWithIndices(*tensor, used_axis, descending, values, indices)) {
+      indices = fl::argsort(*tensor, used_axis,
+                            descending ? fl::SortMode::Descending
+                                       : fl::SortMode::Ascending)
+                    .astype(fl::dtype::s64);
+    }
+    g_bytes_used += indices.bytes();
+    return new fl::Tensor(indices);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-unsigned* fl_uint32Buffer(void* t) {
+void* fl_softmax(void* t, int32_t axis) {
   try {
     LOCK_GUARD
     auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    return tensor->astype(fl::dtype::u32).host<unsigned>();
+    auto used_axis = axisArg(axis, g_row_major, tensor->ndim());
+    auto result =
+        softmaxForward(*tensor, used_axis, SoftmaxMode::Softmax, true);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-unsigned* fl_uint64Buffer(void* t) {
+void* fl_logSoftmax(void* t, int32_t axis) {
   try {
     LOCK_GUARD
     auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    return tensor->astype(fl::dtype::u64).host<unsigned>();
+    auto used_axis = axisArg(axis, g_row_major, tensor->ndim());
+    auto result =
+        softmaxForward(*tensor, used_axis, SoftmaxMode::LogSoftmax, true);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-float fl_float16Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<float>();
-}
-
-float fl_float32Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<float>();
-}
-
-float fl_float64Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<float>();
-}
-
-char fl_boolInt8Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<char>();
-}
-
-int16_t fl_int16Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<int16_t>();
-}
-
-int32_t fl_int32Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<int32_t>();
-}
-
-int64_t fl_int64Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<int64_t>();
-}
-
-uint8_t fl_uint8Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<uint8_t>();
-}
-
-uint16_t fl_uint16Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<uint16_t>();
-}
-
-uint32_t fl_uint32Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<uint32_t>();
-}
-
-uint64_t fl_uint64Scalar(void* t) {
-  LOCK_GUARD
-  auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-  return tensor->asScalar<uint64_t>();
-}
-
-void* fl_index(void* t, void* args_ptr, int64_t args_len) {
+void* fl_logsumexp(void* t, int32_t axis, bool keep_dims) {
   try {
     LOCK_GUARD
-    auto args = arrayArg<int64_t>(args_ptr, args_len, false, false);
-    std::vector<int64_t> start;
-    std::vector<int64_t> end;
-    std::vector<int64_t> stride;
-    if (args.size() % 3 != 0) {
-      throw std::exception();
-    }
-    for (auto i = 0; i < (args.size() - 2); i += 3) {
-      if (g_row_major) {
-        start.emplace(start.begin(), args[i + 0]);
-        end.emplace(end.begin(), args[i + 1]);
-        stride.emplace(stride.begin(), args[i + 2]);
-      } else {
-        start.emplace_back(args[i + 0]);
-        end.emplace_back(args[i + 1]);
-        stride.emplace_back(args[i + 2]);
-      }
-    }
-
-    std::vector<fl::Index> indices;
-    indices.reserve(start.size());
     auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    auto shape = tensor->shape();
-    for (auto i = 0; i < start.size(); ++i) {
-      if (start[i] == -1 && end[i] == -1) {
-        indices.emplace_back(fl::span);
-      } else {
-        if (start[i] == -1) {
-          start[i] = 0;
-        }
-        if (end[i] == -1) {
-          end[i] = shape[i];
-        }
-        if (start[i] + 1 == end[i]) {
-          indices.emplace_back(start[i]);
-        } else {
-          indices.emplace_back(
-              fl::range(start[i], end[i], stride.size() ? stride[i] : 1));
-        }
-      }
-    }
-    auto* new_tensor = new fl::Tensor(tensor->operator()(indices));
-    g_bytes_used += new_tensor->bytes();
-    return new_tensor;
+    auto used_axis = axisArg(axis, g_row_major, tensor->ndim());
+    auto result =
+        softmaxForward(*tensor, used_axis, SoftmaxMode::LogSumExp, keep_dims);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_indexedAssign(void* t, void* other, void* args_ptr, int64_t args_len) {
+// `out` is the result of `fl_softmax` along the same axis
+void* fl_softmaxBackward(void* grad_in, void* out, int32_t axis) {
   try {
     LOCK_GUARD
-    auto args = arrayArg<int64_t>(args_ptr, args_len, false, false);
-    std::vector<int64_t> start;
-    std::vector<int64_t> end;
-    std::vector<int64_t> stride;
-    if (args.size() % 3 != 0) {
-      throw std::exception();
-    }
-    for (auto i = 0; i < (args.size() - 2); i += 3) {
-      if (g_row_major) {
-        start.emplace(start.begin(), args[i + 0]);
-        end.emplace(end.begin(), args[i + 1]);
-        stride.emplace(stride.begin(), args[i + 2]);
-      } else {
-        start.emplace_back(args[i + 0]);
-        end.emplace_back(args[i + 1]);
-        stride.emplace_back(args[i + 2]);
-      }
-    }
-
-    std::vector<fl::Index> indices;
-    indices.reserve(start.size());
-    for (auto i = 0; i < start.size(); ++i) {
-      if (start[i] == -1 && end[i] == -1) {
-        indices.emplace_back(fl::span);
-      } else if (start[i] + 1 == end[i]) {
-        indices.emplace_back(start[i]);
-      } else {
-        indices.emplace_back(
-            fl::range(start[i], end[i], stride.size() ? stride[i] : 1));
-      }
-    }
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    auto new_t = tensor->copy();
-    auto* assign = reinterpret_cast<fl::Tensor*>(other);
-    new_t(indices) *= 0;
-    new_t(indices) += *assign;
-    auto* new_tensor = new fl::Tensor(new_t);
-    g_bytes_used += new_tensor->bytes();
-    return new_tensor;
+    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
+    auto* used_out = reinterpret_cast<fl::Tensor*>(out);
+    auto used_axis = axisArg(axis, g_row_major, used_out->ndim());
+    auto result = softmaxBackward(*used_grad_in, *used_out, *used_out,
+                                  used_axis, SoftmaxMode::Softmax);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_flatten(void* t) {
+// `out` is the result of `fl_logSoftmax` along the same axis
+void* fl_logSoftmaxBackward(void* grad_in, void* out, int32_t axis) {
   try {
     LOCK_GUARD
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    auto* new_tensor = new fl::Tensor(tensor->flatten());
-    g_bytes_used += new_tensor->bytes();
-    return new_tensor;
+    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
+    auto* used_out = reinterpret_cast<fl::Tensor*>(out);
+    auto used_axis = axisArg(axis, g_row_major, used_out->ndim());
+    auto result = softmaxBackward(*used_grad_in, *used_out, *used_out,
+                                  used_axis, SoftmaxMode::LogSoftmax);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_asContiguousTensor(void* t) {
+// `out` is the result of `fl_logsumexp` over `in`, with or without kept dims
+void* fl_logsumexpBackward(void* grad_in, void* in, void* out, int32_t axis) {
   try {
     LOCK_GUARD
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    auto* new_tensor = new fl::Tensor(tensor->asContiguousTensor());
-    g_bytes_used += new_tensor->bytes();
-    return new_tensor;
+    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
+    auto* used_in = reinterpret_cast<fl::Tensor*>(in);
+    auto* used_out = reinterpret_cast<fl::Tensor*>(out);
+    auto used_axis = axisArg(axis, g_row_major, used_in->ndim());
+    auto result = softmaxBackward(*used_grad_in, *used_in, *used_out,
+                                  used_axis, SoftmaxMode::LogSumExp);
+    g_bytes_used += result.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_copy(void* t) {
+// Normalizes over the trailing `norm_ndim` dimensions. `weight` and `bias` may
+// be null. Writes the saved mean and inverse std handles to `stats_out[0..1]`.
+void* fl_layerNorm(void* t,
+                   void* weight,
+                   void* bias,
+                   int32_t norm_ndim,
+                   double eps,
+                   void* stats_out) {
   try {
     LOCK_GUARD
     auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    auto* new_tensor = new fl::Tensor(tensor->copy());
-    g_bytes_used += new_tensor->bytes();
-    return new_tensor;
+    auto* used_weight = reinterpret_cast<fl::Tensor*>(weight);
+    auto* used_bias = reinterpret_cast<fl::Tensor*>(bias);
+    fl::Tensor result, mean, invstd;
+    layerNormForward(*tensor, used_weight, used_bias, norm_ndim, eps, result,
+                     mean, invstd);
+    auto** stats = reinterpret_cast<void**>(stats_out);
+    stats[0] = new fl::Tensor(mean);
+    stats[1] = new fl::Tensor(invstd);
+    g_bytes_used += result.bytes() + mean.bytes() + invstd.bytes();
+    return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-void* fl_pad(void* t,
-           void* before,
-           int64_t before_len,
-           void* after,
-           int64_t after_len) {
+// `mean` and `invstd` are the stats written by `fl_layerNorm`. When `weight` is
+// set, its and the bias gradient handles are written to `grads_out[0..1]`.
+void* fl_layerNormBackward(void* grad_in,
+                           void* in,
+                           void* weight,
+                           void* mean,
+                           void* invstd,
+                           int32_t norm_ndim,
+                           void* grads_out) {
   try {
     LOCK_GUARD
-    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
-    auto before_vec = arrayArg<int64_t>(before, before_len, g_row_major, false);
-    auto after_vec = arrayArg<int64_t>(after, after_len, g_row_major, false);
-    std::vector<std::pair<int, int>> pair_vec;
-    pair_vec.reserve(after_vec.size());
-    for (auto i = 0; i < after_vec.size(); ++i) {
-      pair_vec.emplace_back(before_vec[i], after_vec[i]);
+    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
+    auto* used_in = reinterpret_cast<fl::Tensor*>(in);
+    auto* used_weight = reinterpret_cast<fl::Tensor*>(weight);
+    auto* used_mean = reinterpret_cast<fl::Tensor*>(mean);
+    auto* used_invstd = reinterpret_cast<fl::Tensor*>(invstd);
+    fl::Tensor dx, dw, db;
+    layerNormBackward(*used_grad_in, *used_in, used_weight, *used_mean,
+                      *used_invstd, norm_ndim, dx, dw, db);
+    if (used_weight) {
+      auto** grads = reinterpret_cast<void**>(grads_out);
+      grads[0] = new fl::Tensor(dw);
+      grads[1] = new fl::Tensor(db);
+      g_bytes_used += dw.bytes() + db.bytes();
     }
-    auto* new_tensor = new fl::Tensor(fl::pad(*tensor, pair_vec));
-    g_bytes_used += new_tensor->bytes();
-    return new_tensor;
+    g_bytes_used += dx.bytes();
+    return new fl::Tensor(dx);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-// `grad_in` is Shumai equivalent to Flashlight `gradOutput`
-void* fl_conv2dBackwardData(void* grad_in, void* in, void* wt, int* params) {
+// Normalizes per channel along `axis`. In training mode `running_mean` and
+// `running_var` (either may be null) are updated in place; otherwise they are
+// used as the statistics. Writes the saved mean and inverse std handles to
+// `stats_out[0..1]`.
+void* fl_batchNorm(void* t,
+                   void* weight,
+                   void* bias,
+                   void* running_mean,
+                   void* running_var,
+                   int32_t axis,
+                   bool train,
+                   double momentum,
+                   double eps,
+                   void* stats_out) {
   try {
     LOCK_GUARD
-    int sx = params[0];
-    int sy = params[1];
-    int px = params[2];
-    int py = params[3];
-    int dx = params[4];
-    int dy = params[5];
-    int groups = params[6];
-    auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
-    auto* used_in = reinterpret_cast<fl::Tensor*>(in);
-    auto* used_wt = reinterpret_cast<fl::Tensor*>(wt);
-
-    auto payload = std::make_shared<fl::detail::AutogradPayload>();
-    std::shared_ptr<fl::DynamicBenchmark> dataBench;
-
-    auto result = fl::detail::conv2dBackwardData(
-        *used_grad_in, *used_in, *used_wt, sx, sy, px, py, dx, dy, groups,
-        dataBench, payload);
-
-    g_bytes_used += result.bytes();
+    auto* tensor = reinterpret_cast<fl::Tensor*>(t);
+    auto* used_weight = reinterpret_cast<fl::Tensor*>(weight);
+    auto* used_bias = reinterpret_cast<fl::Tensor*>(bias);
+    auto* used_running_mean = reinterpret_cast<fl::Tensor*>(running_mean);
+    auto* used_running_var = reinterpret_cast<fl::Tensor*>(running_var);
+    auto used_axis = axisArg(axis, g_row_major, tensor->ndim());
+    fl::Tensor result, mean, invstd;
+    batchNormForward(*tensor, used_weight, used_bias, used_running_mean,
+                     used_running_var, used_axis, train, momentum, eps, result,
+                     mean, invstd);
+    auto** stats = reinterpret_cast<void**>(stats_out);
+    stats[0] = new fl::Tensor(mean);
+    stats[1] = new fl::Tensor(invstd);
+    g_bytes_used += result.bytes() + mean.bytes() + invstd.bytes();
     return new fl::Tensor(result);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
 }
 
-// `grad_in` is Shumai equivalent to Flashlight `gradOutput`
-void* fl_conv2dBackwardFilter(void* grad_in, void* in, void* wt, int* params) {
+// `mean` and `invstd` are the stats written by `fl_batchNorm`. When `weight` is
+// set, its and the bias gradient handles are written to `grads_out[0..1]`.
+void* fl_batchNormBackward(void* grad_in,
+                           void* in,
+                           void* weight,
+                           void* mean,
+                           void* invstd,
+                           int32_t axis,
+                           bool train,
+                           void* grads_out) {
   try {
     LOCK_GUARD
-    int sx = params[0];
-    int sy = params[1];
-    int px = params[2];
-    int py = params[3];
-    int dx = params[4];
-    int dy = params[5];
-    int groups = params[6];
     auto* used_grad_in = reinterpret_cast<fl::Tensor*>(grad_in);
     auto* used_in = reinterpret_cast<fl::Tensor*>(in);
-    auto* used_wt = reinterpret_cast<fl::Tensor*>(wt);
-
-    auto payload = std::make_shared<fl::detail::AutogradPayload>();
-    std::shared_ptr<fl::DynamicBenchmark> biasBench;
-    std::shared_ptr<fl::DynamicBenchmark> filterBench;
-
-    fl::Tensor bs;
-    auto result = std::get<0>(fl::detail::conv2dBackwardFilterBias(
-        *used_grad_in, *used_in, *used_wt, bs, sx, sy, px, py, dx, dy, groups,
-        biasBench, filterBench, payload));
-
-    g_bytes_used += result.bytes();
-    return new fl::Tensor(result);
+    auto* used_weight = reinterpret_cast<fl::Tensor*>(weight);
+    auto* used_mean = reinterpret_cast<fl::Tensor*>(mean);
+    auto* used_invstd = reinterpret_cast<fl::Tensor*>(invstd);
+    auto used_axis = axisArg(axis, g_row_major, used_in->ndim());
+    fl::Tensor dx, dw, db;
+    batchNormBackward(*used_grad_in, *used_in, used_weight, *used_mean,
+                      *used_invstd, used_axis, train, dx, dw, db);
+    if (used_weight) {
+      auto** grads = reinterpret_cast<void**>(grads_out);
+      grads[0] = new fl::Tensor(dw);
+      grads[1] = new fl::Tensor(db);
+      g_bytes_used += dw.bytes() + db.bytes();
+    }
+    g_bytes_used += dx.bytes();
+    return new fl::Tensor(dx);
   } catch (std::exception const& e) {
-    HANDLE_EXCEPTION(e.what());
+    HANDLE_EXCEPTION(e);
   } catch (...) {
     HANDLE_EXCEPTION("[unknown]");
   }
@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -6,10 +7,105 @@ size_t fl_bytesUsed(void);
 int fl_dtype(void* tensor);
 int fl_dtypeFloat16(void);
 void fl_destroyTensor(void* t, void* hint);
+int fl_lastError(char *out, int out_len);
+void fl_clearLastError(void);
 
 
 void fl_dispose(void* t);
 size_t fl_elements(void *t);
 void *fl_asContiguousTensor(void *t);
 void *fl_tensorFromFloat32Buffer(int64_t numel, float *ptr);
-float *fl_float32Buffer(void *t, size_t *len);
\ No newline at end of file
+float *fl_float32Buffer(void *t, size_t *len);
+int fl_ndim(void *t);
+int fl_shape(void *t, int64_t *out, int out_len);
+void *fl_reshape(void *t, int64_t *shape, int64_t shape_len);
+
+// Handle arrays (`indices_out`, `grads_out`, tensor lists) hold int64_t
+// addresses of tensor handles.
+void *fl_sortWithIndices(void *t, int32_t axis, bool descending, int64_t *indices_out);
+void *fl_argsort(void *t, int32_t axis, bool descending);
+void *fl_softmax(void *t, int32_t axis);
+void *fl_logSoftmax(void *t, int32_t axis);
+void *fl_logsumexp(void *t, int32_t axis, bool keep_dims);
+void *fl_softmaxBackward(void *grad_in, void *out, int32_t axis);
+void *fl_logSoftmaxBackward(void *grad_in, void *out, int32_t axis);
+void *fl_logsumexpBackward(void *grad_in, void *in, void *out, int32_t axis);
+void *fl_layerNorm(void *t, void *weight, void *bias, int32_t norm_ndim, double eps, int64_t *stats_out);
+void *fl_layerNormBackward(void *grad_in, void *in, void *weight, void *mean, void *invstd, int32_t norm_ndim, int64_t *grads_out);
+void *fl_batchNorm(void *t, void *weight, void *bias, void *running_mean, void *running_var, int32_t axis, bool train, double momentum, double eps, int64_t *stats_out);
+void *fl_batchNormBackward(void *grad_in, void *in, void *weight, void *mean, void *invstd, int32_t axis, bool train, int64_t *grads_out);
+void *fl_conv2dBackwardData(void *grad_in, void *in, void *wt, int32_t *params);
+void fl_setConvBenchmarkMode(bool enabled);
+int fl_saveConvBenchmarks(const char *path, int length);
+int fl_loadConvBenchmarks(const char *path, int length);
+void fl_clearConvBenchmarks(void);
+void *fl_conv2dBackwardFilter(void *grad_in, void *in, void *wt, int32_t *params);
+void *fl_conv2dBackward(void *grad_in, void *in, void *wt, void *bias, int32_t *params, int64_t *grads_out);
+void *fl_linear(void *x, void *w, void *bias, bool trans_x, bool trans_w, int32_t activation);
+void *fl_bmm(void *t, void *other);
+void *fl_quantizePerChannel(void *t, int32_t axis, int64_t *scales_out);
+void *fl_qlinear(void *x, float x_scale, void *qweight, void *scales, void *bias, float out_scale);
+void *fl_attention(void *q, void *k, void *v, void *mask, bool causal, int64_t *lse_out);
+void *fl_attentionBackward(void *grad_in, void *q, void *k, void *v, void *mask, void *out, void *lse, bool causal, int64_t *grads_out);
+void *fl_astype(void *t, int type);
+int fl_dtypeInt64(void);
+void *fl_embedding(void *table, void *ids);
+void *fl_embeddingBackward(void *grad_in, void *ids, int64_t *rows_out);
+int fl_embeddingUpdate(void *table, void *ids, void *rows, double alpha);
+// `hyper` arrays hold doubles; see `fl_adamStep` and `fl_sgdStep` for the order.
+int fl_adamStep(int64_t *params, int64_t *grads, int64_t *m, int64_t *v, int64_t len, double *hyper, bool decoupled);
+int fl_sgdStep(int64_t *params, int64_t *grads, int64_t *momentum_buffers, int64_t len, double *hyper);
+double fl_clipByGlobalNorm(int64_t *grads, int64_t len, double max_norm);
+void *fl_createRng(uint64_t seed);
+void fl_destroyRng(void *rng);
+int fl_randInto(void *rng, void *t);
+int fl_randnInto(void *rng, void *t);
+void *fl_dropout(void *t, double p, void *rng, int64_t *mask_out);
+void *fl_dropoutBackward(void *grad_in, void *mask, double p);
+void fl_setConstantCache(bool enabled, int64_t max_bytes);
+void fl_clearConstantCache(void);
+void fl_constantCacheStats(int64_t *out);
+void *fl_full(int64_t *shape, int64_t shape_len, float val);
+void *fl_identity(int64_t dim);
+void *fl_arange(float start, float end, float step);
+void *fl_stack(int64_t *tensors, int64_t tensors_len, int32_t axis);
+void *fl_concatenate(int64_t *tensors, int64_t tensors_len, int32_t axis);
+// `names` are NUL-separated, `names_len` bytes in total.
+int fl_saveCheckpoint(const char *path, int length, const char *names, int64_t names_len, int64_t *tensors, int64_t count);
+void *fl_openCheckpoint(const char *path, int length);
+void fl_closeCheckpoint(void *checkpoint);
+int64_t fl_checkpointCount(void *checkpoint);
+int fl_checkpointName(void *checkpoint, int64_t index, char *out, int out_len);
+void *fl_checkpointTensor(void *checkpoint, const char *name, int length);
+int fl_saveBundle(const char *names, int64_t names_len, int64_t *tensors, int64_t count, const char *path, int length);
+void *fl_loadBundle(const char *path, int length);
+void *fl_saveAsync(const char *names, int64_t names_len, int64_t *tensors, int64_t count, const char *path, int length);
+int fl_saveAsyncStatus(void *job);
+int fl_saveAsyncWait(void *job);
+void fl_destroySaveAsync(void *job);
+void fl_setSaveAsyncLimit(int64_t bytes);
+void *fl_loadNpy(const char *path, int length);
+int fl_saveNpy(void *t, const char *path, int length);
+void *fl_openNpz(const char *path, int length);
+void fl_closeNpz(void *archive);
+int64_t fl_npzCount(void *archive);
+int fl_npzName(void *archive, int64_t index, char *out, int out_len);
+void *fl_npzTensor(void *archive, const char *name, int length);
+int fl_saveNpz(const char *names, int64_t names_len, int64_t *tensors, int64_t count, const char *path, int length);
+// `array` and `schema` point at Arrow C Data Interface structs (80 and 72
+// bytes).
+void *fl_fromArrowArray(uint8_t *array, uint8_t *schema, int64_t *mask_out);
+int fl_toArrowArray(void *t, uint8_t *array_out, uint8_t *schema_out);
+int fl_dtypeFloat32(void);
+void *fl_createLoader(const char *path, int length, int64_t *shape, int64_t shape_len, int type, bool length_prefixed, int64_t batch_size, uint64_t seed, bool shuffle, bool drop_last, int prefetch, int workers);
+void fl_destroyLoader(void *loader);
+int64_t fl_loaderSize(void *loader);
+int fl_loaderNext(void *loader, int64_t *out);
+int fl_describe(void *t, int64_t *out, int out_len);
+void fl_setErrorLogging(int per_second);
+void *fl_rand(int64_t *shape, int64_t shape_len);
+void *fl_randn(int64_t *shape, int64_t shape_len);
+void *fl_createTensor(int64_t *shape, int64_t shape_len);
+void *fl_transpose(void *t, int64_t *axes, int64_t axes_len);
+void *fl_tile(void *t, int64_t *shape, int64_t shape_len);
+void *fl_sum(void *t, int64_t *axes, int64_t axes_len, bool keep_dims);
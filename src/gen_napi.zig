@@ -217,6 +217,22 @@ pub const JSCtx = struct {
         return self.undefined() catch @panic("throw return undefined");
     }
 
+    pub const ErrorKind = enum { generic, type_error, range_error };
+
+    /// throws a JS `Error`, `TypeError` or `RangeError` with a runtime message
+    /// and an optional `code` property
+    pub fn throw_error(self: *JSCtx, kind: ErrorKind, code: ?[*:0]const u8, message: [*:0]const u8) napi.napi_value {
+        const status = switch (kind) {
+            .generic => napi.napi_throw_error(self.env, code, message),
+            .type_error => napi.napi_throw_type_error(self.env, code, message),
+            .range_error => napi.napi_throw_range_error(self.env, code, message),
+        };
+        err_check(status) catch |e| {
+            if (e != error.napi_pending_exception) std.debug.panic("throw failed {s} {any}", .{ message, e });
+        };
+        return self.undefined() catch @panic("throw return undefined");
+    }
+
     // TODO: use this to throw errors w custom messages
     pub fn throw(self: *JSCtx, comptime message: [:0]const u8) ConversionError {
         var result = napi.napi_throw_error(self.env, null, message);
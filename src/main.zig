@@ -185,20 +185,34 @@ fn wrapped_struct_get_b(v: *DemoStruct2) i64 {
     return v.b;
 }
 
+// `fl_*` calls that take or fill arrays of handles (tensor lists, gradient
+// outputs) pass them as `int64_t` addresses in a `BigInt64Array`.
+fn handle_address(handle: *anyopaque) i64 {
+    return @intCast(i64, @ptrToInt(handle));
+}
+
+fn handle_from_address(address: i64) ?*anyopaque {
+    return @intToPtr(?*anyopaque, @intCast(usize, address));
+}
+
 fn initModule(js: *napigen.JSCtx, exports: napigen.napi_value) !napigen.napi_value {
-    // @setEvalBranchQuota(100_000);
-    // inline for (comptime std.meta.declarations(fl)) |d| {
-    // shumai bindings demo (WIP)
-    // if (comptime std.mem.startsWith(u8, d.name, "fl_")) {
-    // if (comptime std.mem.eql(u8, d.name, "fl_destroyTensor")) continue;
+    @setEvalBranchQuota(100_000);
+    inline for (comptime std.meta.declarations(fl)) |d| {
+        // shumai bindings declared in `cpp/flashlight_binding.h`
+        if (comptime std.mem.startsWith(u8, d.name, "fl_")) {
+            if (comptime std.mem.eql(u8, d.name, "fl_destroyTensor")) continue;
 
-    // const T = @TypeOf(@field(fl, d.name));
+            const T = @TypeOf(@field(fl, d.name));
 
-    // if (@typeInfo(T) == .Fn) {
-    // try js.set_named_property(exports, d.name ++ "", try js.create_named_function(d.name ++ "", @field(fl, d.name)));
-    // }
-    // }
-    // }
+            if (@typeInfo(T) == .Fn) {
+                try js.set_named_property(exports, d.name ++ "", try js.create_named_function(d.name ++ "", @field(fl, d.name)));
+            }
+        }
+    }
+
+    // handle <-> address helpers for `fl_*` calls that take arrays of handles
+    try js.set_named_property(exports, "handle_address", try js.create_named_function("handle_address", handle_address));
+    try js.set_named_property(exports, "handle_from_address", try js.create_named_function("handle_from_address", handle_from_address));
 
     // unit test functions
     try js.set_named_property(exports, "slice_to_Int8Array", try js.create_named_function("slice_to_Int8Array", slice_to_Int8Array));
@@ -239,6 +253,9 @@ fn initModule(js: *napigen.JSCtx, exports: napigen.napi_value) !napigen.napi_val
 const parse_external = [_][]const u8{ "fl_dtype", "fl_dispose", "fl_asContiguousTensor", "fl_elements", "fl_float32Buffer" };
 
 pub fn custom_arg_parser(js: *napigen.JSCtx, comptime T: type, v: napigen.napi_value, comptime ctx: napigen.FnCtx) !T {
+    // `size_t*` out-params receive the length of the C array the call returns
+    if (T == [*c]usize) return ctx.len;
+
     inline for (parse_external) |n| {
         if (comptime std.mem.eql(u8, ctx.name, n) and T == ?*anyopaque) {
             return js.get_external(T, v);
@@ -248,18 +265,60 @@ pub fn custom_arg_parser(js: *napigen.JSCtx, comptime T: type, v: napigen.napi_v
     return js.arg_parser(T, v, ctx);
 }
 
+fn release_nothing(_: napigen.napi_env, _: ?*anyopaque, _: ?*anyopaque) callconv(.C) void {}
+
 fn finalize_tensor(_: napigen.napi_env, finalize_data: ?*anyopaque, finalize_hint: ?*anyopaque) callconv(.C) void {
     return fl.fl_destroyTensor(finalize_data, finalize_hint);
 }
 
 const create_external = [_][]const u8{ "fl_tensorFromFloat32Buffer", "fl_asContiguousTensor" };
 
+// `fl_*` calls signal failure with a null pointer or a negative int.
+fn failed(v: anytype) bool {
+    return switch (@typeInfo(@TypeOf(v))) {
+        .Optional => v == null,
+        .Pointer => |p| if (p.size == .C) v == null else false,
+        .Int => |i| if (i.signedness == .signed) v < 0 else false,
+        else => false,
+    };
+}
+
+// Throws the error recorded by the failing `fl_*` call: invalid arguments
+// as `TypeError`, out-of-range ones as `RangeError` and the rest as `Error`,
+// with the category in `code`. Returns null if nothing was recorded.
+fn throw_last_error(js: *napigen.JSCtx) ?napigen.napi_value {
+    var message: [512]u8 = undefined;
+    const code = fl.fl_lastError(&message, message.len);
+    if (code == 0) return null;
+    fl.fl_clearLastError();
+    const msg = @ptrCast([*:0]const u8, &message);
+    return switch (code) {
+        1 => js.throw_error(.type_error, "FL_INVALID_ARGUMENT", msg),
+        2 => js.throw_error(.range_error, "FL_OUT_OF_RANGE", msg),
+        3 => js.throw_error(.generic, "FL_OUT_OF_MEMORY", msg),
+        4 => js.throw_error(.generic, "FL_RUNTIME_ERROR", msg),
+        else => js.throw_error(.generic, "FL_UNKNOWN_ERROR", msg),
+    };
+}
+
 pub fn custom_return_handler(js: *napigen.JSCtx, v: anytype, comptime ctx: napigen.FnCtx) !napigen.napi_value {
+    if (comptime std.mem.startsWith(u8, ctx.name, "fl_")) {
+        if (failed(v)) {
+            if (throw_last_error(js)) |e| return e;
+        }
+    }
+
     inline for (create_external) |n| {
         if (comptime std.mem.eql(u8, ctx.name, n)) {
             return js.create_external_with_finalizer(@ptrCast(*anyopaque, @constCast(v)), finalize_tensor, null);
         }
     }
 
+    // other opaque handles (tensors, checkpoints, loaders, ...) are released by
+    // their own `fl_*` calls rather than by the garbage collector
+    if (comptime @TypeOf(v) == ?*anyopaque) {
+        return if (v) |p| js.create_external_with_finalizer(p, release_nothing, null) else js.null();
+    }
+
     return js.return_handler(v, ctx);
 }
@@ -0,0 +1,51 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, dispose } from './fl';
+
+// Arrow C Data Interface structs, filled in by `fl_toArrowArray`
+function arrowStructs() {
+  return { array: new Uint8Array(80), schema: new Uint8Array(72) };
+}
+
+describe('fl - Arrow C Data Interface', () => {
+  test('tensors export as a flat column in memory order', () => {
+    const a = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const { array, schema } = arrowStructs();
+    expect(fl.fl_toArrowArray(a, array, schema)).toBe(0);
+    const header = new BigInt64Array(array.buffer, 0, 4);
+    expect(header[0]).toBe(6n); // length
+    expect(header[1]).toBe(0n); // null_count
+    expect(header[3]).toBe(2n); // n_buffers
+    const mask = new BigInt64Array(1);
+    const b = fl.fl_fromArrowArray(array, schema, mask);
+    expect(mask[0]).toBe(0n);
+    expect(shape(b)).toStrictEqual([6]);
+    expect(values(b)).toStrictEqual([1, 2, 3, 4, 5, 6]);
+    dispose(a, b);
+  })
+
+  test('the export keeps its values when the tensor is updated in place', () => {
+    const a = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const { array, schema } = arrowStructs();
+    fl.fl_toArrowArray(a, array, schema);
+    const rng = fl.fl_createRng(1n);
+    fl.fl_randInto(rng, a);
+    const b = fl.fl_fromArrowArray(array, schema, new BigInt64Array(1));
+    expect(values(b)).toStrictEqual([1, 2, 3, 4, 5, 6]);
+    fl.fl_destroyRng(rng);
+    dispose(a, b);
+  })
+
+  test('integer columns keep their type and arrays import only once', () => {
+    const f = tensor([1, 2, 3]);
+    const i = fl.fl_astype(f, fl.fl_dtypeInt64());
+    const { array, schema } = arrowStructs();
+    fl.fl_toArrowArray(i, array, schema);
+    const mask = new BigInt64Array(1);
+    const b = fl.fl_fromArrowArray(array, schema, mask);
+    expect(fl.fl_dtype(b)).toBe(fl.fl_dtypeInt64());
+    expect(values(b)).toStrictEqual([1, 2, 3]);
+    // importing consumed the array
+    expect(() => fl.fl_fromArrowArray(array, schema, mask)).toThrow(TypeError);
+    dispose(f, i, b);
+  })
+})
@@ -0,0 +1,75 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, fromHandle, dispose, expectClose } from './fl';
+
+const Q = [1, 0, 0.5, -1];         // [Lq = 2, D = 2]
+const K = [1, 1, 0, 1, -1, 0.5];   // [Lk = 3, D = 2]
+const V = [1, 2, 3, 4, 5, 6];      // [Lk = 3, Dv = 2]
+
+// softmax(q k^T / sqrt(D) + mask) v, with zeros for fully masked queries
+function reference(q: number[], causal = false, mask?: number[]): number[] {
+  const out: number[] = [];
+  for (let i = 0; i < 2; ++i) {
+    const s = [0, 1, 2].map((j) =>
+      (q[i * 2] * K[j * 2] + q[i * 2 + 1] * K[j * 2 + 1]) / Math.SQRT2 +
+      (mask ? mask[i * 3 + j] : 0) + (causal && j > i ? -Infinity : 0));
+    const m = Math.max(...s);
+    const e = s.map((x) => (m === -Infinity ? 0 : Math.exp(x - m)));
+    const z = e.reduce((a, b) => a + b, 0);
+    for (let d = 0; d < 2; ++d) out.push(z ? e.reduce((a, w, j) => a + w * V[j * 2 + d], 0) / z : 0);
+  }
+  return out;
+}
+
+describe('fl - attention', () => {
+  test('`fl_attention` matches softmax(q k^T / sqrt(d)) v', () => {
+    const [q, k, v] = [tensor(Q, [2, 2]), tensor(K, [3, 2]), tensor(V, [3, 2])];
+    const lse = new BigInt64Array(1);
+    const out = fl.fl_attention(q, k, v, null, false, lse);
+    expectClose(values(out), reference(Q));
+    dispose(q, k, v, out, fromHandle(lse[0]));
+  })
+
+  test('causal queries only attend to earlier keys', () => {
+    const [q, k, v] = [tensor(Q, [2, 2]), tensor(K, [3, 2]), tensor(V, [3, 2])];
+    const lse = new BigInt64Array(1);
+    const out = fl.fl_attention(q, k, v, null, true, lse);
+    const result = values(out);
+    expect(result.slice(0, 2)).toStrictEqual([1, 2]);
+    expectClose(result, reference(Q, true));
+    dispose(q, k, v, out, fromHandle(lse[0]));
+  })
+
+  test('a query with every key masked out gets zeros', () => {
+    const [q, k, v] = [tensor(Q, [2, 2]), tensor(K, [3, 2]), tensor(V, [3, 2])];
+    const maskValues = [0, 0, 0, -Infinity, -Infinity, -Infinity];
+    const mask = tensor(maskValues, [2, 3]);
+    const lse = new BigInt64Array(1);
+    const out = fl.fl_attention(q, k, v, mask, false, lse);
+    const result = values(out);
+    expect(result.slice(2)).toStrictEqual([0, 0]);
+    expectClose(result, reference(Q, false, maskValues));
+    dispose(q, k, v, mask, out, fromHandle(lse[0]));
+  })
+
+  test('`fl_attentionBackward` matches finite differences', () => {
+    const [q, k, v] = [tensor(Q, [2, 2]), tensor(K, [3, 2]), tensor(V, [3, 2])];
+    const lse = new BigInt64Array(1);
+    const out = fl.fl_attention(q, k, v, null, false, lse);
+    const gv = [1, 0, 0, 1];
+    const g = tensor(gv, [2, 2]);
+    const grads = new BigInt64Array(2);
+    const dq = fl.fl_attentionBackward(g, q, k, v, null, out, fromHandle(lse[0]), false, grads);
+    const loss = (qv: number[]) => reference(qv).reduce((a, x, i) => a + x * gv[i], 0);
+    const numeric = Q.map((_, i) => {
+      const [a, b] = [Q.slice(), Q.slice()];
+      a[i] += 1e-4;
+      b[i] -= 1e-4;
+      return (loss(a) - loss(b)) / 2e-4;
+    });
+    expectClose(values(dq), numeric, 1e-4);
+    // columns of dv sum to the columns of g, since each softmax row sums to one
+    const dv = values(fromHandle(grads[1]));
+    expectClose([dv[0] + dv[2] + dv[4], dv[1] + dv[3] + dv[5]], [1, 1]);
+    dispose(q, k, v, out, g, dq, fromHandle(lse[0]), fromHandle(grads[0]), fromHandle(grads[1]));
+  })
+})
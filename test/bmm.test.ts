@@ -0,0 +1,37 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, dispose } from './fl';
+
+describe('fl - batched matmul', () => {
+  const A = [1, 2, 3, 4, 5, 6, -1, 0, 1, 2, -2, 0.5]; // [2, 2, 3]
+  const B = [1, 0, 0, 1, 1, 1];                       // [3, 2]
+  const expected = [4, 5, 10, 11, 0, 1, 2.5, -1.5];
+
+  test('`fl_bmm` broadcasts an unbatched right-hand side', () => {
+    const a = tensor(A, [2, 2, 3]);
+    const b = tensor(B, [3, 2]);
+    const c = fl.fl_bmm(a, b);
+    expect(shape(c)).toStrictEqual([2, 2, 2]);
+    expect(values(c)).toStrictEqual(expected);
+    dispose(a, b, c);
+  })
+
+  test('broadcasts batch dimensions of size one', () => {
+    const a = tensor(A, [2, 2, 3]);
+    const b = tensor(B, [1, 3, 2]);
+    const c = fl.fl_bmm(a, b);
+    expect(values(c)).toStrictEqual(expected);
+    const a4 = tensor(Array(24).fill(1), [2, 1, 3, 4]);
+    const b4 = tensor(Array(24).fill(1), [3, 4, 2]);
+    const c4 = fl.fl_bmm(a4, b4);
+    expect(shape(c4)).toStrictEqual([2, 3, 3, 2]);
+    expect(values(c4).every((v) => v === 4)).toBe(true);
+    dispose(a, b, c, a4, b4, c4);
+  })
+
+  test('rejects mismatched inner dimensions', () => {
+    const a = tensor(A, [2, 2, 3]);
+    const b = tensor([1, 2, 3, 4], [2, 2]);
+    expect(() => fl.fl_bmm(a, b)).toThrow(TypeError);
+    dispose(a, b);
+  })
+})
@@ -0,0 +1,51 @@
+import { expect, describe, test } from 'bun:test';
+import { readFileSync, writeFileSync, unlinkSync } from 'fs';
+import { fl, tensor, values, shape, handles, dispose, cstr, tempPath, errorCode } from './fl';
+
+function get(ckpt: any, name: string) {
+  const n = cstr(name);
+  return fl.fl_checkpointTensor(ckpt, n, n.length);
+}
+
+function saveBundle(path: string, names: string, tensors: any[]) {
+  const p = cstr(path);
+  const n = cstr(names);
+  return fl.fl_saveBundle(n, BigInt(n.length), handles(tensors), BigInt(tensors.length), p, p.length);
+}
+
+describe('fl - checkpoint bundles', () => {
+  // large enough to be split into several I/O chunks
+  const BIG = Array.from({ length: 10000 }, (_, i) => i * 0.5);
+
+  test('bundles round-trip through `fl_loadBundle`', () => {
+    const path = tempPath('bundle.bin');
+    const w = tensor(BIG, [100, 100]);
+    const b = tensor([-1.5, 0.25]);
+    expect(saveBundle(path, 'weight\0bias', [w, b])).toBe(0);
+    const p = cstr(path);
+    const ckpt = fl.fl_loadBundle(p, p.length);
+    expect(fl.fl_checkpointCount(ckpt)).toBe(2n);
+    const w2 = get(ckpt, 'weight');
+    const b2 = get(ckpt, 'bias');
+    expect(shape(w2)).toStrictEqual([100, 100]);
+    expect(values(w2)).toStrictEqual(BIG);
+    expect(values(b2)).toStrictEqual([-1.5, 0.25]);
+    fl.fl_closeCheckpoint(ckpt);
+    dispose(w, b, w2, b2);
+    unlinkSync(path);
+  })
+
+  test('a corrupted tensor fails its checksum', () => {
+    const path = tempPath('bundle-corrupt.bin');
+    const w = tensor(BIG, [100, 100]);
+    const b = tensor([-1.5, 0.25]);
+    saveBundle(path, 'weight\0bias', [w, b]);
+    const bytes = readFileSync(path);
+    bytes[bytes.length - 3] ^= 0x40; // inside `bias`, the last tensor
+    writeFileSync(path, bytes);
+    const p = cstr(path);
+    expect(errorCode(() => fl.fl_loadBundle(p, p.length))).toBe('FL_RUNTIME_ERROR');
+    dispose(w, b);
+    unlinkSync(path);
+  })
+})
@@ -0,0 +1,61 @@
+import { expect, describe, test } from 'bun:test';
+import { writeFileSync, unlinkSync } from 'fs';
+import { fl, tensor, values, shape, handles, dispose, cstr, tempPath, errorCode } from './fl';
+
+function open(path: string) {
+  const p = cstr(path);
+  return fl.fl_openCheckpoint(p, p.length);
+}
+
+function get(ckpt: any, name: string) {
+  const n = cstr(name);
+  return fl.fl_checkpointTensor(ckpt, n, n.length);
+}
+
+// A file holding an 8-byte little-endian header length followed by `body`.
+function writeRaw(path: string, headerLen: number, body: string) {
+  const len = Buffer.alloc(8);
+  len.writeBigUInt64LE(BigInt(headerLen));
+  writeFileSync(path, Buffer.concat([len, Buffer.from(body)]));
+}
+
+describe('fl - mapped checkpoints', () => {
+  test('tensors round-trip by name', () => {
+    const path = tempPath('ckpt.bin');
+    const w = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const b = tensor([-1.5, 0.25]);
+    const p = cstr(path);
+    const names = cstr('weight\0bias');
+    expect(fl.fl_saveCheckpoint(p, p.length, names, BigInt(names.length), handles([w, b]), 2n)).toBe(0);
+    const ckpt = open(path);
+    expect(fl.fl_checkpointCount(ckpt)).toBe(2n);
+    const out = new Uint8Array(16);
+    expect(fl.fl_checkpointName(ckpt, 1n, out, out.length)).toBe(4);
+    expect(new TextDecoder().decode(out.subarray(0, 4))).toBe('bias');
+    const w2 = get(ckpt, 'weight');
+    const b2 = get(ckpt, 'bias');
+    expect(shape(w2)).toStrictEqual([2, 3]);
+    expect(values(w2)).toStrictEqual([1, 2, 3, 4, 5, 6]);
+    expect(values(b2)).toStrictEqual([-1.5, 0.25]);
+    expect(() => get(ckpt, 'missing')).toThrow(RangeError);
+    fl.fl_closeCheckpoint(ckpt);
+    dispose(w, b, w2, b2);
+    unlinkSync(path);
+  })
+
+  test('malformed files are rejected when opened', () => {
+    const path = tempPath('bad-ckpt.bin');
+    writeFileSync(path, 'abc');
+    expect(errorCode(() => open(path))).toBe('FL_RUNTIME_ERROR');
+    // the header length runs past the end of the file
+    writeRaw(path, 1000, '{}');
+    expect(errorCode(() => open(path))).toBe('FL_RUNTIME_ERROR');
+    // the data offsets run past the end of the file
+    const header = '{"x":{"dtype":"F32","shape":[4],"data_offsets":[0,16]}}';
+    writeRaw(path, header.length, header + 'abcd');
+    expect(errorCode(() => open(path))).toBe('FL_RUNTIME_ERROR');
+    writeRaw(path, 5, '{"x":');
+    expect(errorCode(() => open(path))).toBe('FL_RUNTIME_ERROR');
+    unlinkSync(path);
+  })
+})
@@ -0,0 +1,20 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, handles, dispose, expectClose } from './fl';
+
+describe('fl - global norm clipping', () => {
+  test('`fl_clipByGlobalNorm` scales every gradient by the same factor', () => {
+    const g = [tensor([3, 4]), tensor([12], [1, 1])];
+    expectClose([fl.fl_clipByGlobalNorm(handles(g), 2n, 6.5)], [13]);
+    expectClose(values(g[0]), [1.5, 2]);
+    expectClose(values(g[1]), [6]);
+    dispose(...g);
+  })
+
+  test('gradients under the limit are left alone', () => {
+    const g = [tensor([3, 4]), tensor([12], [1, 1])];
+    expectClose([fl.fl_clipByGlobalNorm(handles(g), 2n, 20)], [13]);
+    expect(values(g[0])).toStrictEqual([3, 4]);
+    expect(values(g[1])).toStrictEqual([12]);
+    dispose(...g);
+  })
+})
@@ -0,0 +1,57 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, values, shape, dispose } from './fl';
+
+// {hits, misses, cached bytes, entries}
+function stats(): number[] {
+  const out = new BigInt64Array(4);
+  fl.fl_constantCacheStats(out);
+  return Array.from(out, Number);
+}
+
+function full(dims: number[], value: number) {
+  return fl.fl_full(new BigInt64Array(dims.map(BigInt)), BigInt(dims.length), value);
+}
+
+describe('fl - constant cache', () => {
+  test('repeated constants are served from the cache', () => {
+    fl.fl_setConstantCache(true, 1n << 20n);
+    fl.fl_clearConstantCache();
+    const [hits, misses] = stats();
+    const a = full([2, 3], 1.5);
+    const b = full([2, 3], 1.5);
+    const c = full([2, 3], 2.5);
+    expect(shape(b)).toStrictEqual([2, 3]);
+    expect(values(b)).toStrictEqual([1.5, 1.5, 1.5, 1.5, 1.5, 1.5]);
+    expect(stats()).toStrictEqual([hits + 1, misses + 2, 48, 2]);
+    const e1 = fl.fl_identity(3n);
+    const e2 = fl.fl_identity(3n);
+    expect(values(e2)).toStrictEqual([1, 0, 0, 0, 1, 0, 0, 0, 1]);
+    const r = fl.fl_arange(0, 5, 2);
+    expect(values(r)).toStrictEqual([0, 2, 4]);
+    expect(stats().slice(0, 2)).toStrictEqual([hits + 2, misses + 4]);
+    dispose(a, b, c, e1, e2, r);
+    fl.fl_setConstantCache(false, 0n);
+  })
+
+  test('in-place writes do not leak into other cached handles', () => {
+    fl.fl_setConstantCache(true, 1n << 20n);
+    const a = full([2, 3], 1.5);
+    const b = full([2, 3], 1.5);
+    const rng = fl.fl_createRng(1n);
+    fl.fl_randInto(rng, a);
+    expect(values(a)).not.toStrictEqual(values(b));
+    expect(values(b)).toStrictEqual([1.5, 1.5, 1.5, 1.5, 1.5, 1.5]);
+    const c = full([2, 3], 1.5);
+    expect(values(c)).toStrictEqual([1.5, 1.5, 1.5, 1.5, 1.5, 1.5]);
+    dispose(a, b, c);
+    fl.fl_destroyRng(rng);
+    fl.fl_setConstantCache(false, 0n);
+  })
+
+  test('disabling the cache drops its entries', () => {
+    fl.fl_setConstantCache(true, 1n << 20n);
+    dispose(full([4], 7));
+    fl.fl_setConstantCache(false, 0n);
+    expect(stats().slice(2)).toStrictEqual([0, 0]);
+  })
+})
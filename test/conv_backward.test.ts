@@ -0,0 +1,40 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, fromHandle, dispose } from './fl';
+
+describe('fl - combined conv2d backward', () => {
+  // stride, padding, dilation (x, y) and groups
+  const params = new Int32Array([1, 1, 0, 0, 1, 1, 1]);
+
+  test('returns data, filter and bias gradients of a 1x1 conv', () => {
+    const x = tensor([1, 2, 3, 4], [1, 1, 2, 2]);
+    const w = tensor([3], [1, 1, 1, 1]);
+    const b = tensor([0], [1, 1, 1, 1]);
+    const g = tensor([1, 1, 1, 1], [1, 1, 2, 2]);
+    const grads = new BigInt64Array(2);
+    const dx = fl.fl_conv2dBackward(g, x, w, b, params, grads);
+    const dw = fromHandle(grads[0]);
+    const db = fromHandle(grads[1]);
+    expect(values(dx)).toStrictEqual([3, 3, 3, 3]);
+    expect(values(dw)).toStrictEqual([10]);
+    expect(values(db)).toStrictEqual([4]);
+    dispose(x, w, b, g, dx, dw, db);
+  })
+
+  test('matches the separate data and filter backward calls', () => {
+    const x = tensor([1, 0, 2, -1, 3, 1, 0, 2, -2], [1, 1, 3, 3]);
+    const w = tensor([1, -1, 2, 0.5], [1, 1, 2, 2]);
+    const g = tensor([1, 2, -1, 0.5], [1, 1, 2, 2]);
+    const grads = new BigInt64Array(2);
+    const dx = fl.fl_conv2dBackward(g, x, w, null, params, grads);
+    const dw = fromHandle(grads[0]);
+    const db = fromHandle(grads[1]);
+    const dxAlone = fl.fl_conv2dBackwardData(g, x, w, params);
+    const dwAlone = fl.fl_conv2dBackwardFilter(g, x, w, params);
+    expect(shape(dx)).toStrictEqual([1, 1, 3, 3]);
+    expect(values(dx)).toStrictEqual(values(dxAlone));
+    expect(values(dw)).toStrictEqual(values(dwAlone));
+    // without a bias tensor the bias gradient still sums the output gradient
+    expect(values(db)).toStrictEqual([2.5]);
+    dispose(x, w, g, dx, dw, db, dxAlone, dwAlone);
+  })
+})
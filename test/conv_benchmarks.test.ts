@@ -0,0 +1,35 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, dispose, cstr, tempPath } from './fl';
+
+describe('fl - conv benchmark cache', () => {
+  // stride, padding, dilation (x, y) and groups
+  const params = new Int32Array([1, 1, 0, 0, 1, 1, 1]);
+
+  test('tuned backward passes give the same gradients as untuned ones', () => {
+    const x = tensor([1, 2, 3, 4], [1, 1, 2, 2]);
+    const w = tensor([3], [1, 1, 1, 1]);
+    const g = tensor([1, 1, 1, 1], [1, 1, 2, 2]);
+    fl.fl_setConvBenchmarkMode(false);
+    const plain = fl.fl_conv2dBackwardData(g, x, w, params);
+    fl.fl_setConvBenchmarkMode(true);
+    const tuned = [0, 1, 2].map(() => fl.fl_conv2dBackwardData(g, x, w, params));
+    fl.fl_setConvBenchmarkMode(false);
+    expect(values(plain)).toStrictEqual([3, 3, 3, 3]);
+    for (const t of tuned) expect(values(t)).toStrictEqual(values(plain));
+    dispose(x, w, g, plain, ...tuned);
+  })
+
+  test('saved choices load back with the same count', () => {
+    const path = tempPath('conv-benchmarks.txt');
+    const saved = fl.fl_saveConvBenchmarks(cstr(path), cstr(path).length);
+    expect(saved).toBeGreaterThanOrEqual(0);
+    fl.fl_clearConvBenchmarks();
+    expect(fl.fl_loadConvBenchmarks(cstr(path), cstr(path).length)).toBe(saved);
+    require('fs').rmSync(path, { force: true });
+  })
+
+  test('loading a missing file pins nothing', () => {
+    const path = tempPath('missing-benchmarks.txt');
+    expect(fl.fl_loadConvBenchmarks(cstr(path), cstr(path).length)).toBe(0);
+  })
+})
@@ -0,0 +1,40 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, shape, dispose } from './fl';
+
+function describeTensor(t: any): number[] {
+  const out = new BigInt64Array(16);
+  const n = fl.fl_describe(t, out, out.length);
+  return Array.from(out.subarray(0, n), Number);
+}
+
+describe('fl - tensor metadata', () => {
+  test('`fl_describe` reports type, sizes, shape and strides in one call', () => {
+    const t = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const [ndim, dtype, elements, bytes, , contiguous, ...dims] = describeTensor(t);
+    expect(ndim).toBe(2);
+    expect(dtype).toBe(fl.fl_dtype(t));
+    expect(elements).toBe(6);
+    expect(bytes).toBe(24);
+    expect(contiguous).toBe(1);
+    // shape, then strides in elements, both row-major
+    expect(dims).toStrictEqual([2, 3, 3, 1]);
+    dispose(t);
+  })
+
+  test('the shape matches `fl_shape` for higher ranks', () => {
+    const t = tensor(new Array(24).fill(0), [2, 3, 4]);
+    const info = describeTensor(t);
+    expect(info[0]).toBe(3);
+    expect(info.slice(6, 9)).toStrictEqual(shape(t));
+    expect(info.slice(9)).toStrictEqual([12, 4, 1]);
+    dispose(t);
+  })
+
+  test('a short buffer returns -1 without writing', () => {
+    const t = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const out = new BigInt64Array(9);
+    expect(fl.fl_describe(t, out, out.length)).toBe(-1);
+    expect(out.every((v) => v === 0n)).toBe(true);
+    dispose(t);
+  })
+})
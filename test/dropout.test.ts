@@ -0,0 +1,48 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, fromHandle, dispose } from './fl';
+
+function ones() {
+  return tensor(new Array(1000).fill(1), [10, 100]);
+}
+
+describe('fl - fused dropout', () => {
+  test('kept values are scaled by 1 / (1 - p) and the mask is bit-packed', () => {
+    const rng = fl.fl_createRng(42n);
+    const x = ones();
+    const maskOut = new BigInt64Array(1);
+    const y = fl.fl_dropout(x, 0.25, rng, maskOut);
+    const mask = fromHandle(maskOut[0]);
+    const v = values(y);
+    const kept = v.filter((e) => e !== 0);
+    expect(kept.every((e) => Math.abs(e - 4 / 3) < 1e-6)).toBe(true);
+    expect(kept.length).toBeGreaterThan(650);
+    expect(kept.length).toBeLessThan(850);
+    expect(shape(mask)).toStrictEqual([125]);
+    // the backward pass reapplies the same mask and scale
+    const g = fl.fl_dropoutBackward(x, mask, 0.25);
+    expect(values(g)).toStrictEqual(v);
+    dispose(x, y, mask, g);
+    fl.fl_destroyRng(rng);
+  })
+
+  test('the same seed drops the same elements', () => {
+    const a = fl.fl_createRng(3n);
+    const b = fl.fl_createRng(3n);
+    const x = ones();
+    const ya = fl.fl_dropout(x, 0.5, a, null);
+    const yb = fl.fl_dropout(x, 0.5, b, null);
+    expect(values(ya)).toStrictEqual(values(yb));
+    dispose(x, ya, yb);
+    fl.fl_destroyRng(a);
+    fl.fl_destroyRng(b);
+  })
+
+  test('p = 0 keeps every element', () => {
+    const rng = fl.fl_createRng(0n);
+    const x = ones();
+    const y = fl.fl_dropout(x, 0, rng, null);
+    expect(values(y)).toStrictEqual(values(x));
+    dispose(x, y);
+    fl.fl_destroyRng(rng);
+  })
+})
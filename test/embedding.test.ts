@@ -0,0 +1,54 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, fromHandle, dispose } from './fl';
+
+function ids(v: number[], s: number[] = [v.length]) {
+  const f = tensor(v, s);
+  const t = fl.fl_astype(f, fl.fl_dtypeInt64());
+  dispose(f);
+  return t;
+}
+
+describe('fl - embedding', () => {
+  const TABLE = [0, 1, 2, 3, 4, 5, 6, 7, 8, 9]; // [vocab = 5, dim = 2]
+
+  test('`fl_embedding` gathers table rows for ids of any shape', () => {
+    const table = tensor(TABLE, [5, 2]);
+    const flat = ids([3, 1, 3]);
+    const e = fl.fl_embedding(table, flat);
+    expect(shape(e)).toStrictEqual([3, 2]);
+    expect(values(e)).toStrictEqual([6, 7, 2, 3, 6, 7]);
+    const grid = ids([0, 4, 2, 2], [2, 2]);
+    const e2 = fl.fl_embedding(table, grid);
+    expect(shape(e2)).toStrictEqual([2, 2, 2]);
+    expect(values(e2)).toStrictEqual([0, 1, 8, 9, 4, 5, 4, 5]);
+    dispose(table, flat, e, grid, e2);
+  })
+
+  test('`fl_embeddingBackward` sums the rows of repeated ids', () => {
+    const idx = ids([3, 1, 3]);
+    const g = tensor([1, 2, 3, 4, 5, 6], [3, 2]);
+    const rowsOut = new BigInt64Array(1);
+    const unique = fl.fl_embeddingBackward(g, idx, rowsOut);
+    const rows = fromHandle(rowsOut[0]);
+    expect(values(unique)).toStrictEqual([1, 3]);
+    expect(shape(rows)).toStrictEqual([2, 2]);
+    expect(values(rows)).toStrictEqual([3, 4, 6, 8]);
+    dispose(idx, g, unique, rows);
+  })
+
+  test('`fl_embeddingUpdate` only touches the named rows', () => {
+    const table = tensor(TABLE, [5, 2]);
+    const idx = ids([1, 3]);
+    const rows = tensor([3, 4, 6, 8], [2, 2]);
+    expect(fl.fl_embeddingUpdate(table, idx, rows, -1)).toBe(0);
+    expect(values(table)).toStrictEqual([0, 1, -1, -1, 4, 5, 0, -1, 8, 9]);
+    dispose(table, idx, rows);
+  })
+
+  test('out-of-range ids throw a RangeError', () => {
+    const table = tensor(TABLE, [5, 2]);
+    const bad = ids([5]);
+    expect(() => fl.fl_embedding(table, bad)).toThrow(RangeError);
+    dispose(table, bad);
+  })
+})
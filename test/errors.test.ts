@@ -0,0 +1,59 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, handles, dispose, cstr, tempPath } from './fl';
+
+function thrown(fn: () => unknown): any {
+  try {
+    fn();
+  } catch (e) {
+    return e;
+  }
+  throw new Error('expected an error');
+}
+
+describe('fl - native errors', () => {
+  fl.fl_setErrorLogging(0);
+
+  test('invalid arguments throw a TypeError', () => {
+    const e = thrown(() => fl.fl_stack(handles([]), 0n, 0));
+    expect(e).toBeInstanceOf(TypeError);
+    expect(e.code).toBe('FL_INVALID_ARGUMENT');
+    expect(e.message).toContain('fl_stack expects at least one tensor');
+  })
+
+  test('out-of-range lookups throw a RangeError', () => {
+    const path = tempPath('errors.npz');
+    const t = tensor([1, 2]);
+    const p = cstr(path);
+    const names = cstr('a');
+    fl.fl_saveNpz(names, BigInt(names.length), handles([t]), 1n, p, p.length);
+    const archive = fl.fl_openNpz(p, p.length);
+    const missing = cstr('b');
+    const e = thrown(() => fl.fl_npzTensor(archive, missing, missing.length));
+    expect(e).toBeInstanceOf(RangeError);
+    expect(e.code).toBe('FL_OUT_OF_RANGE');
+    fl.fl_closeNpz(archive);
+    dispose(t);
+    require('fs').unlinkSync(path);
+  })
+
+  test('runtime failures throw an Error with their code', () => {
+    const p = cstr(tempPath('does-not-exist.npy'));
+    const e = thrown(() => fl.fl_loadNpy(p, p.length));
+    expect(e).toBeInstanceOf(Error);
+    expect(e).not.toBeInstanceOf(TypeError);
+    expect(e.code).toBe('FL_RUNTIME_ERROR');
+  })
+
+  test('a thrown error clears the native error state', () => {
+    thrown(() => fl.fl_stack(handles([]), 0n, 0));
+    const out = new Uint8Array(64);
+    expect(fl.fl_lastError(out, out.length)).toBe(0);
+  })
+
+  test('failures without a recorded error return their status', () => {
+    const t = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    // too short for [ndim, dtype, elements, bytes, location, contiguous, 2 dims, 2 strides]
+    expect(fl.fl_describe(t, new BigInt64Array(4), 4)).toBe(-1);
+    dispose(t);
+  })
+})
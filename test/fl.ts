@@ -0,0 +1,67 @@
+// Helpers shared by the flashlight binding tests. Tensor handles come back as
+// externals; arrays of handles travel as int64 addresses (`BigInt64Array`).
+export const fl = require('../zig-out/lib/example.node');
+
+fl.fl_init();
+
+export function tensor(values: number[], shape: number[] = [values.length]) {
+  const flat = fl.fl_tensorFromFloat32Buffer(BigInt(values.length), new Float32Array(values));
+  if (shape.length === 1) return flat;
+  const t = fl.fl_reshape(flat, new BigInt64Array(shape.map(BigInt)), BigInt(shape.length));
+  fl.fl_dispose(flat);
+  return t;
+}
+
+// Values of `t` in row-major order, converted to float32.
+export function values(t: any): number[] {
+  return Array.from(fl.fl_float32Buffer(t, null) as Float32Array);
+}
+
+export function shape(t: any): number[] {
+  const ndim = fl.fl_ndim(t);
+  const out = new BigInt64Array(ndim);
+  fl.fl_shape(t, out, ndim);
+  return Array.from(out, Number);
+}
+
+export function handles(tensors: any[]): BigInt64Array {
+  return new BigInt64Array(tensors.map((t) => fl.handle_address(t)));
+}
+
+export function fromHandle(address: bigint) {
+  return fl.handle_from_address(address);
+}
+
+export function dispose(...tensors: any[]) {
+  for (const t of tensors) fl.fl_dispose(t);
+}
+
+export function expectClose(actual: number[], expected: number[], tolerance = 1e-5) {
+  if (actual.length !== expected.length) {
+    throw new Error(`expected ${expected.length} values, got ${actual.length}`);
+  }
+  actual.forEach((a, i) => {
+    if (!(Math.abs(a - expected[i]) <= tolerance)) {
+      throw new Error(`value ${i}: expected ${expected[i]}, got ${a}`);
+    }
+  });
+}
+
+// Path or name bytes for the `(const char *, int length)` argument pairs.
+export function cstr(s: string): Uint8Array {
+  return new TextEncoder().encode(s);
+}
+
+export function tempPath(name: string): string {
+  return require('path').join(require('os').tmpdir(), `fl-${process.pid}-${name}`);
+}
+
+// The `code` of the error thrown by `fn`, e.g. 'FL_RUNTIME_ERROR'.
+export function errorCode(fn: () => unknown): string | undefined {
+  try {
+    fn();
+  } catch (e: any) {
+    return e.code;
+  }
+  throw new Error('expected an error');
+}
@@ -0,0 +1,75 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, dispose, expectClose } from './fl';
+
+const M = 2;
+const K = 3;
+const N = 2;
+const X = [1, -2, 0.5, 3, 0, -1];   // [M, K]
+const W = [0.5, -1, 2, 1, -0.5, 0]; // [K, N]
+const B = [0.25, -3];
+
+function transpose(a: number[], rows: number, cols: number): number[] {
+  const out: number[] = [];
+  for (let j = 0; j < cols; ++j) for (let i = 0; i < rows; ++i) out.push(a[i * cols + j]);
+  return out;
+}
+
+function reference(act: number): number[] {
+  const out: number[] = [];
+  for (let i = 0; i < M; ++i) {
+    for (let j = 0; j < N; ++j) {
+      let s = B[j];
+      for (let k = 0; k < K; ++k) s += X[i * K + k] * W[k * N + j];
+      out.push(act === 1 ? Math.max(0, s) : act === 3 ? 1 / (1 + Math.exp(-s)) : s);
+    }
+  }
+  return out;
+}
+
+describe('fl - linear', () => {
+  test('`fl_linear` adds the bias along the last dimension', () => {
+    const x = tensor(X, [M, K]);
+    const w = tensor(W, [K, N]);
+    const b = tensor(B);
+    const y = fl.fl_linear(x, w, b, false, false, 0);
+    expect(shape(y)).toStrictEqual([M, N]);
+    expectClose(values(y), reference(0));
+    dispose(x, w, b, y);
+  })
+
+  test('transpose flags read stored operands as their transposes', () => {
+    const xt = tensor(transpose(X, M, K), [K, M]);
+    const wt = tensor(transpose(W, K, N), [N, K]);
+    const b = tensor(B);
+    for (const [tx, tw] of [[true, false], [false, true], [true, true]]) {
+      const x = tx ? xt : tensor(X, [M, K]);
+      const w = tw ? wt : tensor(W, [K, N]);
+      const y = fl.fl_linear(x, w, b, tx, tw, 0);
+      expectClose(values(y), reference(0));
+      dispose(y);
+      if (!tx) dispose(x);
+      if (!tw) dispose(w);
+    }
+    dispose(xt, wt, b);
+  })
+
+  test('fuses relu and sigmoid epilogues', () => {
+    const x = tensor(X, [M, K]);
+    const w = tensor(W, [K, N]);
+    const b = tensor(B);
+    for (const act of [1, 3]) {
+      const y = fl.fl_linear(x, w, b, false, false, act);
+      expectClose(values(y), reference(act));
+      dispose(y);
+    }
+    dispose(x, w, b);
+  })
+
+  test('works without a bias', () => {
+    const x = tensor(X, [M, K]);
+    const w = tensor(W, [K, N]);
+    const y = fl.fl_linear(x, w, null, false, false, 0);
+    expectClose(values(y), reference(0).map((v, i) => v - B[i % N]));
+    dispose(x, w, y);
+  })
+})
@@ -0,0 +1,95 @@
+import { expect, describe, test } from 'bun:test';
+import { writeFileSync, unlinkSync } from 'fs';
+import { fl, values, shape, fromHandle, dispose, cstr, tempPath } from './fl';
+
+type Options = { lengthPrefixed?: boolean; batch: number; seed?: bigint; shuffle?: boolean; dropLast?: boolean };
+
+function loader(path: string, dims: number[], o: Options) {
+  const p = cstr(path);
+  const s = new BigInt64Array(dims.map(BigInt));
+  return fl.fl_createLoader(p, p.length, s, BigInt(dims.length), fl.fl_dtypeFloat32(),
+    o.lengthPrefixed ?? false, BigInt(o.batch), o.seed ?? 0n, o.shuffle ?? false, o.dropLast ?? false, 2, 2);
+}
+
+// Shapes and values of the batches of one epoch.
+function epoch(l: any) {
+  const batches: { shape: number[], values: number[], lengths?: number[] }[] = [];
+  const out = new BigInt64Array(2);
+  while (fl.fl_loaderNext(l, out) === 1) {
+    const batch = fromHandle(out[0]);
+    batches.push({ shape: shape(batch), values: values(batch) });
+    if (out[1] !== 0n) {
+      const lengths = fromHandle(out[1]);
+      batches[batches.length - 1].lengths = values(lengths);
+      dispose(lengths);
+    }
+    dispose(batch);
+  }
+  return batches;
+}
+
+// Ten fixed-size records [i, i + 0.5].
+function writeRecords(path: string) {
+  writeFileSync(path, Buffer.from(new Float32Array(Array.from({ length: 10 }, (_, i) => [i, i + 0.5]).flat()).buffer));
+}
+
+describe('fl - streaming data loader', () => {
+  test('batches come out in file order without shuffling', () => {
+    const path = tempPath('records.bin');
+    writeRecords(path);
+    const l = loader(path, [2], { batch: 4 });
+    expect(fl.fl_loaderSize(l)).toBe(10n);
+    const batches = epoch(l);
+    expect(batches.map((b) => b.shape)).toStrictEqual([[4, 2], [4, 2], [2, 2]]);
+    expect(batches.flatMap((b) => b.values)).toStrictEqual(Array.from({ length: 10 }, (_, i) => [i, i + 0.5]).flat());
+    fl.fl_destroyLoader(l);
+    const dropped = loader(path, [2], { batch: 4, dropLast: true });
+    expect(epoch(dropped).map((b) => b.shape)).toStrictEqual([[4, 2], [4, 2]]);
+    fl.fl_destroyLoader(dropped);
+    unlinkSync(path);
+  })
+
+  test('the same seed gives the same shuffled order', () => {
+    const path = tempPath('records-shuffled.bin');
+    writeRecords(path);
+    const a = loader(path, [2], { batch: 5, seed: 42n, shuffle: true });
+    const b = loader(path, [2], { batch: 5, seed: 42n, shuffle: true });
+    const first = epoch(a);
+    expect(epoch(b)).toStrictEqual(first);
+    const order = first.flatMap((e) => e.values).filter((_, i) => i % 2 === 0);
+    expect([...order].sort((x, y) => x - y)).toStrictEqual([0, 1, 2, 3, 4, 5, 6, 7, 8, 9]);
+    // every epoch draws a new order
+    expect(epoch(a)).not.toStrictEqual(first);
+    fl.fl_destroyLoader(a);
+    fl.fl_destroyLoader(b);
+    unlinkSync(path);
+  })
+
+  test('length-prefixed records are zero-padded and report their lengths', () => {
+    const path = tempPath('records-prefixed.bin');
+    const parts: Buffer[] = [];
+    for (let i = 1; i <= 3; ++i) {
+      const len = Buffer.alloc(4);
+      len.writeUInt32LE(4 * i);
+      parts.push(len, Buffer.from(new Float32Array(Array.from({ length: i }, (_, k) => i * 10 + k)).buffer));
+    }
+    writeFileSync(path, Buffer.concat(parts));
+    const l = loader(path, [3], { lengthPrefixed: true, batch: 2 });
+    expect(fl.fl_loaderSize(l)).toBe(3n);
+    expect(epoch(l)).toStrictEqual([
+      { shape: [2, 3], values: [10, 0, 0, 20, 21, 0], lengths: [1, 2] },
+      { shape: [1, 3], values: [30, 31, 32], lengths: [3] },
+    ]);
+    fl.fl_destroyLoader(l);
+    unlinkSync(path);
+  })
+
+  test('bad sample shapes and batch sizes are rejected', () => {
+    const path = tempPath('records-bad.bin');
+    writeRecords(path);
+    expect(() => loader(path, [0], { batch: 4 })).toThrow(TypeError);
+    expect(() => loader(path, [2 ** 40, 2 ** 40], { batch: 4 })).toThrow(TypeError);
+    expect(() => loader(path, [2], { batch: 20, dropLast: true })).toThrow(TypeError);
+    unlinkSync(path);
+  })
+})
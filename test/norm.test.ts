@@ -0,0 +1,77 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, fromHandle, dispose, expectClose } from './fl';
+
+function normalizeRows(x: number[], cols: number): number[] {
+  const out: number[] = [];
+  for (let r = 0; r < x.length; r += cols) {
+    const row = x.slice(r, r + cols);
+    const mean = row.reduce((a, b) => a + b, 0) / cols;
+    const v = row.reduce((a, b) => a + (b - mean) ** 2, 0) / cols;
+    out.push(...row.map((b) => (b - mean) / Math.sqrt(v)));
+  }
+  return out;
+}
+
+describe('fl - normalization', () => {
+  const data = [1, 2, 3, 4, 2, 4, 6, 8];
+
+  test('`fl_layerNorm` applies weight and bias and saves the stats', () => {
+    const x = tensor(data, [2, 4]);
+    const w = tensor([1, 2, 1, 2]);
+    const b = tensor([0, 0, 1, 1]);
+    const stats = new BigInt64Array(2);
+    const y = fl.fl_layerNorm(x, w, b, 1, 0, stats);
+    const xhat = normalizeRows(data, 4);
+    expectClose(values(y), xhat.map((v, i) => v * [1, 2, 1, 2][i % 4] + [0, 0, 1, 1][i % 4]));
+    const mean = fromHandle(stats[0]);
+    const invstd = fromHandle(stats[1]);
+    expectClose(values(mean), [2.5, 5]);
+    expectClose(values(invstd), [1 / Math.sqrt(1.25), 1 / Math.sqrt(5)]);
+    dispose(x, w, b, y, mean, invstd);
+  })
+
+  test('`fl_layerNormBackward` matches the analytic gradient', () => {
+    const x = tensor(data, [2, 4]);
+    const stats = new BigInt64Array(2);
+    const y = fl.fl_layerNorm(x, null, null, 1, 0, stats);
+    const mean = fromHandle(stats[0]);
+    const invstd = fromHandle(stats[1]);
+    const gv = [1, 0, 0, 0, 0, 1, 0, 0];
+    const g = tensor(gv, [2, 4]);
+    const dx = fl.fl_layerNormBackward(g, x, null, mean, invstd, 1, new BigInt64Array(2));
+    const xhat = normalizeRows(data, 4);
+    const istd = [1 / Math.sqrt(1.25), 1 / Math.sqrt(5)];
+    const expected = xhat.map((h, i) => {
+      const r = Math.floor(i / 4) * 4;
+      let gMean = 0;
+      let ghMean = 0;
+      for (let j = r; j < r + 4; ++j) {
+        gMean += gv[j] / 4;
+        ghMean += (gv[j] * xhat[j]) / 4;
+      }
+      return istd[r / 4] * (gv[i] - gMean - h * ghMean);
+    });
+    expectClose(values(dx), expected);
+    dispose(x, y, mean, invstd, g, dx);
+  })
+
+  test('`fl_batchNorm` updates running stats in training and uses them in eval', () => {
+    const x = tensor([1, 10, 3, 20, 5, 30, 7, 40], [4, 2]);
+    const runningMean = tensor([0, 0]);
+    const runningVar = tensor([1, 1]);
+    const stats = new BigInt64Array(2);
+    const y = fl.fl_batchNorm(x, null, null, runningMean, runningVar, 1, true, 0.5, 0, stats);
+    expectClose(values(y), [-1.3416407, -1.3416407, -0.4472136, -0.4472136, 0.4472136, 0.4472136, 1.3416407, 1.3416407]);
+    // momentum 0.5 towards the batch mean and the unbiased batch variance
+    expectClose(values(runningMean), [2, 12.5]);
+    expectClose(values(runningVar), [0.5 + 0.5 * (20 / 3), 0.5 + 0.5 * (500 / 3)], 1e-4);
+    dispose(fromHandle(stats[0]), fromHandle(stats[1]));
+
+    const evalY = fl.fl_batchNorm(x, null, null, runningMean, runningVar, 1, false, 0.5, 0, stats);
+    const rm = [2, 12.5];
+    const rv = values(runningVar);
+    const xv = [1, 10, 3, 20, 5, 30, 7, 40];
+    expectClose(values(evalY), xv.map((v, i) => (v - rm[i % 2]) / Math.sqrt(rv[i % 2])), 1e-4);
+    dispose(x, runningMean, runningVar, y, evalY, fromHandle(stats[0]), fromHandle(stats[1]));
+  })
+})
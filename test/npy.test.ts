@@ -0,0 +1,93 @@
+import { expect, describe, test } from 'bun:test';
+import { readFileSync, writeFileSync, unlinkSync } from 'fs';
+import { fl, tensor, values, shape, handles, dispose, cstr, tempPath, errorCode } from './fl';
+
+function loadNpy(path: string) {
+  const p = cstr(path);
+  return fl.fl_loadNpy(p, p.length);
+}
+
+function openNpz(path: string) {
+  const p = cstr(path);
+  return fl.fl_openNpz(p, p.length);
+}
+
+// A version 1.0 .npy file with header `dict`, padded the way NumPy does.
+function npy(dict: string, data: Buffer): Buffer {
+  let header = dict;
+  while ((10 + header.length + 1) % 64) header += ' ';
+  header += '\n';
+  const prefix = Buffer.from([0x93, ...Buffer.from('NUMPY'), 1, 0, header.length & 0xff, header.length >> 8]);
+  return Buffer.concat([prefix, Buffer.from(header), data]);
+}
+
+const DATA = Buffer.from(new Float32Array([1, 2, 3, 4, 5, 6]).buffer);
+
+describe('fl - NumPy files', () => {
+  test('.npy files round-trip', () => {
+    const path = tempPath('a.npy');
+    const a = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const p = cstr(path);
+    expect(fl.fl_saveNpy(a, p, p.length)).toBe(0);
+    const b = loadNpy(path);
+    expect(shape(b)).toStrictEqual([2, 3]);
+    expect(values(b)).toStrictEqual([1, 2, 3, 4, 5, 6]);
+    dispose(a, b);
+    unlinkSync(path);
+  })
+
+  test('files written by NumPy load in both orders', () => {
+    const path = tempPath('c.npy');
+    writeFileSync(path, npy("{'descr': '<f4', 'fortran_order': False, 'shape': (2, 3), }", DATA));
+    const c = loadNpy(path);
+    expect(shape(c)).toStrictEqual([2, 3]);
+    expect(values(c)).toStrictEqual([1, 2, 3, 4, 5, 6]);
+    // Fortran-order data reads as its transpose without a copy
+    writeFileSync(path, npy("{'descr': '<f4', 'fortran_order': True, 'shape': (2, 3), }", DATA));
+    const f = loadNpy(path);
+    expect(shape(f)).toStrictEqual([3, 2]);
+    expect(values(f)).toStrictEqual([1, 2, 3, 4, 5, 6]);
+    dispose(c, f);
+    unlinkSync(path);
+  })
+
+  test('malformed .npy files are rejected', () => {
+    const path = tempPath('bad.npy');
+    const cases = [
+      npy("{'descr': '<f4', 'fortran_order': False, 'shape': (2, 3), }", DATA.subarray(0, 8)),
+      npy("{'descr': '<f4', 'fortran_order': False, 'shape': (-2, 3), }", DATA),
+      npy("{'descr': '<c8', 'fortran_order': False, 'shape': (3,), }", DATA),
+      Buffer.concat([Buffer.from('NOTNUMPY'), DATA]),
+    ];
+    for (const bytes of cases) {
+      writeFileSync(path, bytes);
+      expect(errorCode(() => loadNpy(path))).toBe('FL_RUNTIME_ERROR');
+    }
+    unlinkSync(path);
+  })
+
+  test('.npz archives round-trip by name', () => {
+    const path = tempPath('a.npz');
+    const w = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const b = tensor([-1.5, 0.25]);
+    const p = cstr(path);
+    const names = cstr('weight\0bias');
+    expect(fl.fl_saveNpz(names, BigInt(names.length), handles([w, b]), 2n, p, p.length)).toBe(0);
+    const archive = openNpz(path);
+    expect(fl.fl_npzCount(archive)).toBe(2n);
+    const out = new Uint8Array(16);
+    expect(fl.fl_npzName(archive, 0n, out, out.length)).toBe(6);
+    expect(new TextDecoder().decode(out.subarray(0, 6))).toBe('weight');
+    const n = cstr('weight');
+    const w2 = fl.fl_npzTensor(archive, n, n.length);
+    expect(shape(w2)).toStrictEqual([2, 3]);
+    expect(values(w2)).toStrictEqual([1, 2, 3, 4, 5, 6]);
+    fl.fl_closeNpz(archive);
+    dispose(w, b, w2);
+
+    const bytes = readFileSync(path);
+    writeFileSync(path, bytes.subarray(0, bytes.length >> 1));
+    expect(errorCode(() => openNpz(path))).toBe('FL_RUNTIME_ERROR');
+    unlinkSync(path);
+  })
+})
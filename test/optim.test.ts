@@ -0,0 +1,65 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, handles, dispose, expectClose } from './fl';
+
+describe('fl - fused optimizer steps', () => {
+  test('`fl_adamStep` updates every parameter and both moments', () => {
+    const p = [tensor([1, 2]), tensor([-1, 0.5, 3], [3, 1])];
+    const g = [tensor([0.5, -1]), tensor([2, 0, -0.25], [3, 1])];
+    const m = [tensor([0, 0]), tensor([0, 0, 0], [3, 1])];
+    const v = [tensor([0, 0]), tensor([0, 0, 0], [3, 1])];
+    // lr, beta1, beta2, eps, weight_decay, step
+    const hyper = new Float64Array([0.1, 0.9, 0.999, 1e-8, 0, 1]);
+    expect(fl.fl_adamStep(handles(p), handles(g), handles(m), handles(v), 2n, hyper, false)).toBe(0);
+    // the first bias-corrected step moves each weight by lr * sign(g)
+    expectClose(values(p[0]), [0.9, 2.1]);
+    expectClose(values(p[1]), [-1.1, 0.5, 3.1]);
+    expectClose(values(m[0]), [0.05, -0.1]);
+    expectClose(values(v[0]), [0.00025, 0.001]);
+    dispose(...p, ...g, ...m, ...v);
+  })
+
+  test('decoupled weight decay scales the parameter before the update', () => {
+    const p = tensor([1, 2]);
+    const g = tensor([0.5, -1]);
+    const m = tensor([0, 0]);
+    const v = tensor([0, 0]);
+    const hyper = new Float64Array([0.1, 0.9, 0.999, 1e-8, 0.5, 1]);
+    expect(fl.fl_adamStep(handles([p]), handles([g]), handles([m]), handles([v]), 1n, hyper, true)).toBe(0);
+    expectClose(values(p), [0.85, 2.0]);
+    dispose(p, g, m, v);
+  })
+
+  test('invalid Adam hyperparameters throw and leave the parameters alone', () => {
+    const p = tensor([1, 2]);
+    const g = tensor([0.5, -1]);
+    const m = tensor([0, 0]);
+    const v = tensor([0, 0]);
+    const hyper = new Float64Array([0.1, 1, 0.999, 1e-8, 0, 1]);
+    expect(() => fl.fl_adamStep(handles([p]), handles([g]), handles([m]), handles([v]), 1n, hyper, false)).toThrow(TypeError);
+    expect(values(p)).toStrictEqual([1, 2]);
+    dispose(p, g, m, v);
+  })
+
+  test('`fl_sgdStep` accumulates momentum across steps', () => {
+    const p = tensor([1, 2]);
+    const g = tensor([0.5, -1]);
+    const buf = tensor([0, 0]);
+    // lr, momentum, dampening, weight_decay, nesterov
+    const hyper = new Float64Array([0.1, 0.9, 0, 0, 0]);
+    fl.fl_sgdStep(handles([p]), handles([g]), handles([buf]), 1n, hyper);
+    expectClose(values(p), [0.95, 2.1]);
+    fl.fl_sgdStep(handles([p]), handles([g]), handles([buf]), 1n, hyper);
+    expectClose(values(buf), [0.95, -1.9]);
+    expectClose(values(p), [0.855, 2.29]);
+    dispose(p, g, buf);
+  })
+
+  test('`fl_sgdStep` without momentum needs no buffers', () => {
+    const p = tensor([1, 2]);
+    const g = tensor([0.5, -1]);
+    const hyper = new Float64Array([0.1, 0, 0, 0.5, 0]);
+    expect(fl.fl_sgdStep(handles([p]), handles([g]), null, 1n, hyper)).toBe(0);
+    expectClose(values(p), [0.9, 2]);
+    dispose(p, g);
+  })
+})
@@ -0,0 +1,43 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, fromHandle, dispose, expectClose } from './fl';
+
+describe('fl - int8 quantization', () => {
+  // rows are multiples of their scales (0.01 and 0.02), so they quantize exactly
+  const W = [1.27, -0.64, 0, 0.01, -2.54, 1, 0.5, 2]; // [N = 2, K = 4]
+
+  test('`fl_quantizePerChannel` uses max |w| / 127 per channel', () => {
+    const w = tensor(W, [2, 4]);
+    const scales = new BigInt64Array(1);
+    const q = fl.fl_quantizePerChannel(w, 0, scales);
+    const s = fromHandle(scales[0]);
+    expect(shape(q)).toStrictEqual([2, 4]);
+    expectClose(values(s), [0.01, 0.02]);
+    dispose(w, q, s);
+  })
+
+  test('`fl_qlinear` with an identity input dequantizes the weights', () => {
+    const w = tensor(W, [2, 4]);
+    const scales = new BigInt64Array(1);
+    const q = fl.fl_quantizePerChannel(w, 0, scales);
+    const s = fromHandle(scales[0]);
+    const eye = tensor([1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1], [4, 4]);
+    const y = fl.fl_qlinear(eye, 0, q, s, null, 0);
+    expect(shape(y)).toStrictEqual([4, 2]);
+    expectClose(values(y), [1.27, -2.54, -0.64, 1, 0, 0.5, 0.01, 2]);
+    dispose(w, q, s, eye, y);
+  })
+
+  test('`fl_qlinear` stays close to the float result', () => {
+    const w = tensor(W, [2, 4]);
+    const scales = new BigInt64Array(1);
+    const q = fl.fl_quantizePerChannel(w, 0, scales);
+    const s = fromHandle(scales[0]);
+    const xv = [0.3, -0.7, 0.2, 0.9];
+    const x = tensor(xv, [1, 4]);
+    const b = tensor([0.5, -0.5]);
+    const y = fl.fl_qlinear(x, 0, q, s, b, 0);
+    const expected = [0, 1].map((n) => xv.reduce((acc, v, k) => acc + v * W[n * 4 + k], n ? -0.5 : 0.5));
+    expectClose(values(y), expected, 0.02);
+    dispose(w, q, s, x, b, y);
+  })
+})
@@ -0,0 +1,45 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, dispose } from './fl';
+
+function zeros() {
+  return tensor(new Array(1000).fill(0), [10, 100]);
+}
+
+describe('fl - seeded generators', () => {
+  test('the same seed reproduces the same uniform fill', () => {
+    const a = fl.fl_createRng(42n);
+    const b = fl.fl_createRng(42n);
+    const c = fl.fl_createRng(7n);
+    const x = zeros();
+    const y = zeros();
+    const z = zeros();
+    expect(fl.fl_randInto(a, x)).toBe(0);
+    fl.fl_randInto(b, y);
+    fl.fl_randInto(c, z);
+    const vx = values(x);
+    expect(vx).toStrictEqual(values(y));
+    expect(vx).not.toStrictEqual(values(z));
+    expect(vx.every((v) => v >= 0 && v < 1)).toBe(true);
+    expect(shape(x)).toStrictEqual([10, 100]);
+    // the stream advances between fills
+    fl.fl_randInto(a, x);
+    expect(values(x)).not.toStrictEqual(vx);
+    dispose(x, y, z);
+    fl.fl_destroyRng(a);
+    fl.fl_destroyRng(b);
+    fl.fl_destroyRng(c);
+  })
+
+  test('`fl_randnInto` draws standard normal values', () => {
+    const rng = fl.fl_createRng(1n);
+    const x = zeros();
+    expect(fl.fl_randnInto(rng, x)).toBe(0);
+    const v = values(x);
+    const mean = v.reduce((a, b) => a + b, 0) / v.length;
+    const variance = v.reduce((a, b) => a + (b - mean) ** 2, 0) / v.length;
+    expect(Math.abs(mean)).toBeLessThan(0.15);
+    expect(Math.abs(variance - 1)).toBeLessThan(0.2);
+    dispose(x);
+    fl.fl_destroyRng(rng);
+  })
+})
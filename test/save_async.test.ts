@@ -0,0 +1,45 @@
+import { expect, describe, test } from 'bun:test';
+import { unlinkSync } from 'fs';
+import { fl, tensor, values, handles, dispose, cstr, tempPath, errorCode } from './fl';
+
+function saveAsync(path: string, names: string, tensors: any[]) {
+  const p = cstr(path);
+  const n = cstr(names);
+  return fl.fl_saveAsync(n, BigInt(n.length), handles(tensors), BigInt(tensors.length), p, p.length);
+}
+
+describe('fl - asynchronous saves', () => {
+  const BIG = Array.from({ length: 10000 }, (_, i) => i * 0.5);
+
+  test('the file holds the values from when the save started', () => {
+    const path = tempPath('async.bin');
+    const w = tensor(BIG, [100, 100]);
+    const b = tensor([-1.5, 0.25]);
+    const job = saveAsync(path, 'weight\0bias', [w, b]);
+    // keep training while the write runs
+    const rng = fl.fl_createRng(1n);
+    fl.fl_randInto(rng, w);
+    expect(fl.fl_saveAsyncWait(job)).toBe(0);
+    expect(fl.fl_saveAsyncStatus(job)).toBe(1);
+    fl.fl_destroySaveAsync(job);
+    expect(values(w)).not.toStrictEqual(BIG);
+    const p = cstr(path);
+    const ckpt = fl.fl_loadBundle(p, p.length);
+    const n = cstr('weight');
+    const w2 = fl.fl_checkpointTensor(ckpt, n, n.length);
+    expect(values(w2)).toStrictEqual(BIG);
+    fl.fl_closeCheckpoint(ckpt);
+    fl.fl_destroyRng(rng);
+    dispose(w, b, w2);
+    unlinkSync(path);
+  })
+
+  test('a failed save is reported by `fl_saveAsyncWait`', () => {
+    const b = tensor([-1.5, 0.25]);
+    const job = saveAsync('/nonexistent-dir/fl-async.bin', 'bias', [b]);
+    expect(errorCode(() => fl.fl_saveAsyncWait(job))).toBe('FL_RUNTIME_ERROR');
+    expect(fl.fl_saveAsyncStatus(job)).toBe(-1);
+    fl.fl_destroySaveAsync(job);
+    dispose(b);
+  })
+})
@@ -0,0 +1,52 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, dispose } from './fl';
+
+function dims(d: number[]): [BigInt64Array, bigint] {
+  return [new BigInt64Array(d.map(BigInt)), BigInt(d.length)];
+}
+
+describe('fl - shape and axis arguments', () => {
+  test('shape arguments are read in row-major order', () => {
+    const r = fl.fl_rand(...dims([2, 3, 4]));
+    const n = fl.fl_randn(...dims([5, 1]));
+    const e = fl.fl_createTensor(...dims([4, 5]));
+    expect(shape(r)).toStrictEqual([2, 3, 4]);
+    expect(values(r).every((v) => v >= 0 && v < 1)).toBe(true);
+    expect(shape(n)).toStrictEqual([5, 1]);
+    expect(shape(e)).toStrictEqual([4, 5]);
+    dispose(r, n, e);
+  })
+
+  test('`fl_transpose` permutes row-major axes', () => {
+    const t = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const tt = fl.fl_transpose(t, ...dims([1, 0]));
+    expect(shape(tt)).toStrictEqual([3, 2]);
+    expect(values(tt)).toStrictEqual([1, 4, 2, 5, 3, 6]);
+    const c = fl.fl_createTensor(...dims([2, 3, 4]));
+    const ct = fl.fl_transpose(c, ...dims([2, 0, 1]));
+    expect(shape(ct)).toStrictEqual([4, 2, 3]);
+    dispose(t, tt, c, ct);
+  })
+
+  test('`fl_tile` and `fl_reshape` take row-major shapes', () => {
+    const t = tensor([1, 2], [1, 2]);
+    const tiled = fl.fl_tile(t, ...dims([2, 2]));
+    expect(shape(tiled)).toStrictEqual([2, 4]);
+    expect(values(tiled)).toStrictEqual([1, 2, 1, 2, 1, 2, 1, 2]);
+    const r = fl.fl_reshape(tiled, ...dims([4, 2]));
+    expect(values(r)).toStrictEqual([1, 2, 1, 2, 1, 2, 1, 2]);
+    dispose(t, tiled, r);
+  })
+
+  test('axis lists accept negative axes', () => {
+    const t = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const rows = fl.fl_sum(t, ...dims([1]), false);
+    const last = fl.fl_sum(t, ...dims([-1]), false);
+    const cols = fl.fl_sum(t, ...dims([0]), true);
+    expect(values(rows)).toStrictEqual([6, 15]);
+    expect(values(last)).toStrictEqual([6, 15]);
+    expect(shape(cols)).toStrictEqual([1, 3]);
+    expect(values(cols)).toStrictEqual([5, 7, 9]);
+    dispose(t, rows, last, cols);
+  })
+})
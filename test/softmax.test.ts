@@ -0,0 +1,78 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, dispose, expectClose } from './fl';
+
+function softmaxRows(x: number[], cols: number): number[] {
+  const out: number[] = [];
+  for (let r = 0; r < x.length; r += cols) {
+    const row = x.slice(r, r + cols);
+    const max = Math.max(...row);
+    const e = row.map((v) => Math.exp(v - max));
+    const sum = e.reduce((a, b) => a + b, 0);
+    out.push(...e.map((v) => v / sum));
+  }
+  return out;
+}
+
+describe('fl - softmax', () => {
+  const data = [1, 2, 3, -1, 0, 1000];
+
+  test('`fl_softmax` and `fl_logSoftmax` normalize along the axis', () => {
+    const x = tensor(data, [2, 3]);
+    const y = fl.fl_softmax(x, 1);
+    const logY = fl.fl_logSoftmax(x, 1);
+    const expected = softmaxRows(data, 3);
+    expectClose(values(y), expected);
+    expectClose(values(logY), [-2.4076059, -1.4076059, -0.4076059, -1001, -1000, 0]);
+    dispose(x, y, logY);
+  })
+
+  test('`fl_logsumexp` is stable for large inputs', () => {
+    const x = tensor(data, [2, 3]);
+    const lse = fl.fl_logsumexp(x, 1, false);
+    expect(shape(lse)).toStrictEqual([2]);
+    expectClose(values(lse), [3.4076059, 1000]);
+    dispose(x, lse);
+  })
+
+  test('a row of -Infinity next to a finite value puts all weight on it', () => {
+    const x = tensor([-Infinity, -Infinity, 0], [1, 3]);
+    const y = fl.fl_softmax(x, 1);
+    expect(values(y)).toStrictEqual([0, 0, 1]);
+    dispose(x, y);
+  })
+
+  test('`fl_softmaxBackward` matches y * (g - sum(g * y))', () => {
+    const x = tensor(data, [2, 3]);
+    const y = fl.fl_softmax(x, 1);
+    const g = tensor([1, 0, 0, 0, 1, 0], [2, 3]);
+    const dx = fl.fl_softmaxBackward(g, y, 1);
+    const yv = softmaxRows(data, 3);
+    const gv = [1, 0, 0, 0, 1, 0];
+    const expected = yv.map((v, i) => {
+      const r = Math.floor(i / 3) * 3;
+      let dot = 0;
+      for (let j = r; j < r + 3; ++j) dot += gv[j] * yv[j];
+      return v * (gv[i] - dot);
+    });
+    expectClose(values(dx), expected);
+    dispose(x, y, g, dx);
+  })
+
+  test('`fl_logsumexpBackward` scales softmax by the incoming gradient', () => {
+    const x = tensor(data, [2, 3]);
+    const lse = fl.fl_logsumexp(x, 1, false);
+    const g = tensor([1, 2]);
+    const dx = fl.fl_logsumexpBackward(g, x, lse, 1);
+    const yv = softmaxRows(data, 3);
+    expectClose(values(dx), yv.map((v, i) => v * (i < 3 ? 1 : 2)));
+    dispose(x, lse, g, dx);
+  })
+
+  test('`fl_softmaxBackward` rejects a gradient of the wrong shape', () => {
+    const x = tensor(data, [2, 3]);
+    const y = fl.fl_softmax(x, 1);
+    const g = tensor([1, 2, 3]);
+    expect(() => fl.fl_softmaxBackward(g, y, 1)).toThrow(TypeError);
+    dispose(x, y, g);
+  })
+})
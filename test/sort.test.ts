@@ -0,0 +1,32 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, fromHandle, dispose } from './fl';
+
+describe('fl - sort', () => {
+  test('`fl_sortWithIndices` returns values and a stable permutation', () => {
+    const t = tensor([3, 1, 2, 1, 3]);
+    const out = new BigInt64Array(1);
+    const sorted = fl.fl_sortWithIndices(t, 0, false, out);
+    const indices = fromHandle(out[0]);
+    expect(values(sorted)).toStrictEqual([1, 1, 2, 3, 3]);
+    expect(values(indices)).toStrictEqual([1, 3, 2, 0, 4]);
+    dispose(t, sorted, indices);
+  })
+
+  test('descending sort keeps equal keys in their original order', () => {
+    const t = tensor([3, 1, 2, 1, 3]);
+    const out = new BigInt64Array(1);
+    const sorted = fl.fl_sortWithIndices(t, 0, true, out);
+    const indices = fromHandle(out[0]);
+    expect(values(sorted)).toStrictEqual([3, 3, 2, 1, 1]);
+    expect(values(indices)).toStrictEqual([0, 4, 2, 1, 3]);
+    dispose(t, sorted, indices);
+  })
+
+  test('`fl_argsort` sorts each row along the last axis', () => {
+    const t = tensor([2, 0, 1, -1, 5, 4], [2, 3]);
+    const indices = fl.fl_argsort(t, 1, false);
+    expect(shape(indices)).toStrictEqual([2, 3]);
+    expect(values(indices)).toStrictEqual([1, 2, 0, 0, 2, 1]);
+    dispose(t, indices);
+  })
+})
@@ -0,0 +1,42 @@
+import { expect, describe, test } from 'bun:test';
+import { fl, tensor, values, shape, handles, dispose } from './fl';
+
+describe('fl - concatenate and stack', () => {
+  test('`fl_concatenate` joins along an existing axis', () => {
+    const a = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const b = tensor([7, 8, 9, 10, 11, 12], [2, 3]);
+    const c = tensor([13, 14], [2, 1]);
+    const rows = fl.fl_concatenate(handles([a, b]), 2n, 0);
+    expect(shape(rows)).toStrictEqual([4, 3]);
+    expect(values(rows)).toStrictEqual([1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12]);
+    const cols = fl.fl_concatenate(handles([a, c]), 2n, 1);
+    expect(shape(cols)).toStrictEqual([2, 4]);
+    expect(values(cols)).toStrictEqual([1, 2, 3, 13, 4, 5, 6, 14]);
+    expect(() => fl.fl_concatenate(handles([a, c]), 2n, 0)).toThrow();
+    dispose(a, b, c, rows, cols);
+  })
+
+  test('`fl_stack` inserts a new axis at every position', () => {
+    const a = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    const b = tensor([7, 8, 9, 10, 11, 12], [2, 3]);
+    const expected = [
+      [[2, 2, 3], [1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12]],
+      [[2, 2, 3], [1, 2, 3, 7, 8, 9, 4, 5, 6, 10, 11, 12]],
+      [[2, 3, 2], [1, 7, 2, 8, 3, 9, 4, 10, 5, 11, 6, 12]],
+    ];
+    expected.forEach(([dims, vals], axis) => {
+      const s = fl.fl_stack(handles([a, b]), 2n, axis);
+      expect(shape(s)).toStrictEqual(dims);
+      expect(values(s)).toStrictEqual(vals);
+      dispose(s);
+    });
+    dispose(a, b);
+  })
+
+  test('`fl_stack` rejects an empty list and a bad axis', () => {
+    const a = tensor([1, 2, 3, 4, 5, 6], [2, 3]);
+    expect(() => fl.fl_stack(handles([]), 0n, 0)).toThrow(TypeError);
+    expect(() => fl.fl_stack(handles([a, a]), 2n, 5)).toThrow(TypeError);
+    dispose(a);
+  })
+})